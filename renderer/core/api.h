@@ -13,5 +13,7 @@
 #include "scene.h"
 #include "skeleton.h"
 #include "texture.h"
+#include "trace.h"
+#include "workers.h"
 
 #endif
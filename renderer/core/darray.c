@@ -21,6 +21,12 @@ void darray_free(void *darray) {
     }
 }
 
+void darray_clear(void *darray) {
+    if (darray != NULL) {
+        DARRAY_OCCUPIED(darray) = 0;
+    }
+}
+
 void *darray_hold(void *darray, int count, int item_size) {
     int header_size = sizeof(int) * 2;
     assert(count > 0 && item_size > 0);
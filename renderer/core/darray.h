@@ -10,5 +10,6 @@
 void *darray_hold(void *darray, int count, int item_size);
 int darray_size(void *darray);
 void darray_free(void *darray);
+void darray_clear(void *darray);
 
 #endif
@@ -78,13 +78,12 @@ static void draw_texture(framebuffer_t *framebuffer, texture_t *texture,
         for (src_c = 0; src_c < width; src_c++) {
             int dst_r = row + src_r;
             int dst_c = col + src_c;
-            int src_index = src_r * texture->width + src_c;
             int dst_index = (dst_r * framebuffer->width + dst_c) * 4;
-            vec4_t *src_pixel = &texture->buffer[src_index];
+            vec4_t src_pixel = texture_fetch(texture, src_r, src_c);
             unsigned char *dst_pixel = &framebuffer->color_buffer[dst_index];
-            dst_pixel[0] += float_to_uchar(src_pixel->x);
-            dst_pixel[1] += float_to_uchar(src_pixel->y);
-            dst_pixel[2] += float_to_uchar(src_pixel->z);
+            dst_pixel[0] += float_to_uchar(src_pixel.x);
+            dst_pixel[1] += float_to_uchar(src_pixel.y);
+            dst_pixel[2] += float_to_uchar(src_pixel.z);
         }
     }
 }
@@ -2,12 +2,27 @@
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
+#include "darray.h"
 #include "graphics.h"
 #include "macro.h"
 #include "maths.h"
+#include "platform.h"
+#include "raster.h"
+#include "trace.h"
+#include "workers.h"
 
 /* framebuffer management */
 
+static struct hiz *create_hiz(int width, int height);
+static void release_hiz(struct hiz *hiz);
+static void clear_hiz(struct hiz *hiz, float depth);
+static void release_bins(struct bins *bins);
+static void release_visibility(struct visibility *visibility);
+#ifdef GRAPHICS_STATS
+static void reserve_tile_stats(struct hiz *hiz);
+static stats_t *get_tile_stats(framebuffer_t *framebuffer, int x, int y);
+#endif
+
 framebuffer_t *framebuffer_create(int width, int height) {
     int color_buffer_size = width * height * 4;
     int depth_buffer_size = sizeof(float) * width * height;
@@ -16,12 +31,20 @@ framebuffer_t *framebuffer_create(int width, int height) {
     framebuffer_t *framebuffer;
 
     assert(width > 0 && height > 0);
+    /* before any worker thread tests the spans */
+    raster_select_kernel();
 
     framebuffer = (framebuffer_t*)malloc(sizeof(framebuffer_t));
     framebuffer->width = width;
     framebuffer->height = height;
     framebuffer->color_buffer = (unsigned char*)malloc(color_buffer_size);
     framebuffer->depth_buffer = (float*)malloc(depth_buffer_size);
+    framebuffer->hiz = create_hiz(width, height);
+    framebuffer->bins = NULL;
+#ifdef GRAPHICS_STATS
+    reserve_tile_stats(framebuffer->hiz);
+#endif
+    framebuffer->visibility = NULL;
 
     framebuffer_clear_color(framebuffer, default_color);
     framebuffer_clear_depth(framebuffer, default_depth);
@@ -30,6 +53,13 @@ framebuffer_t *framebuffer_create(int width, int height) {
 }
 
 void framebuffer_release(framebuffer_t *framebuffer) {
+    if (framebuffer->bins) {
+        release_bins(framebuffer->bins);
+    }
+    release_hiz(framebuffer->hiz);
+    if (framebuffer->visibility) {
+        release_visibility(framebuffer->visibility);
+    }
     free(framebuffer->color_buffer);
     free(framebuffer->depth_buffer);
     free(framebuffer);
@@ -38,6 +68,7 @@ void framebuffer_release(framebuffer_t *framebuffer) {
 void framebuffer_clear_color(framebuffer_t *framebuffer, vec4_t color) {
     int num_pixels = framebuffer->width * framebuffer->height;
     int i;
+    graphics_flush(framebuffer);
     for (i = 0; i < num_pixels; i++) {
         framebuffer->color_buffer[i * 4 + 0] = float_to_uchar(color.x);
         framebuffer->color_buffer[i * 4 + 1] = float_to_uchar(color.y);
@@ -49,9 +80,11 @@ void framebuffer_clear_color(framebuffer_t *framebuffer, vec4_t color) {
 void framebuffer_clear_depth(framebuffer_t *framebuffer, float depth) {
     int num_pixels = framebuffer->width * framebuffer->height;
     int i;
+    graphics_flush(framebuffer);
     for (i = 0; i < num_pixels; i++) {
         framebuffer->depth_buffer[i] = depth;
     }
+    clear_hiz(framebuffer->hiz, depth);
 }
 
 /* program management */
@@ -66,6 +99,8 @@ struct program {
     int sizeof_uniforms;
     int double_sided;
     int enable_blend;
+    depth_mode_t depth_mode;
+    int derivatives;
     /* for shaders */
     void *shader_attribs[3];
     void *shader_varyings;
@@ -75,6 +110,11 @@ struct program {
     vec4_t out_coords[MAX_VARYINGS];
     void *in_varyings[MAX_VARYINGS];
     void *out_varyings[MAX_VARYINGS];
+    /* for indexed drawing */
+    int max_vertices;
+    vec4_t *vertex_coords;
+    unsigned char *vertex_codes;
+    unsigned char *vertex_varyings;
 };
 
 program_t *program_create(
@@ -96,13 +136,16 @@ program_t *program_create(
     program->sizeof_uniforms = sizeof_uniforms;
     program->double_sided = double_sided;
     program->enable_blend = enable_blend;
+    program->depth_mode = DEPTH_DEFAULT;
+    program->derivatives = 0;
 
     for (i = 0; i < 3; i++) {
         program->shader_attribs[i] = malloc(sizeof_attribs);
         memset(program->shader_attribs[i], 0, sizeof_attribs);
     }
-    program->shader_varyings = malloc(sizeof_varyings);
-    memset(program->shader_varyings, 0, sizeof_varyings);
+    /* followed by the derivatives along x and y */
+    program->shader_varyings = malloc(sizeof_varyings * 3);
+    memset(program->shader_varyings, 0, sizeof_varyings * 3);
     program->shader_uniforms = malloc(sizeof_uniforms);
     memset(program->shader_uniforms, 0, sizeof_uniforms);
     for (i = 0; i < MAX_VARYINGS; i++) {
@@ -111,6 +154,10 @@ program_t *program_create(
         program->out_varyings[i] = malloc(sizeof_varyings);
         memset(program->out_varyings[i], 0, sizeof_varyings);
     }
+    program->max_vertices = 0;
+    program->vertex_coords = NULL;
+    program->vertex_codes = NULL;
+    program->vertex_varyings = NULL;
 
     return program;
 }
@@ -126,6 +173,9 @@ void program_release(program_t *program) {
         free(program->in_varyings[i]);
         free(program->out_varyings[i]);
     }
+    free(program->vertex_coords);
+    free(program->vertex_codes);
+    free(program->vertex_varyings);
     free(program);
 }
 
@@ -138,8 +188,64 @@ void *program_get_uniforms(program_t *program) {
     return program->shader_uniforms;
 }
 
+void program_set_depth_mode(program_t *program, depth_mode_t depth_mode) {
+    program->depth_mode = depth_mode;
+}
+
+void program_set_derivatives(program_t *program, int derivatives) {
+    program->derivatives = derivatives;
+}
+
 /* graphics pipeline */
 
+/*
+ * the pipeline statistics are gathered only with GRAPHICS_STATS defined, the
+ * stages run by the submitting thread count into a global, and those run
+ * tile by tile count into a slot of the tile, which is owned by a single
+ * worker thread during a flush, so that no locking or atomics are needed,
+ * the slots are padded to keep the workers off each other's cache lines,
+ * and they are summed only when the statistics are queried
+ */
+
+#ifdef GRAPHICS_STATS
+
+typedef struct {
+    stats_t stats;
+    char padding[64];
+} slot_t;
+
+static stats_t g_stats;
+static slot_t *g_tile_stats = NULL;
+static int g_num_tile_stats = 0;
+
+static int count_lanes(int mask) {
+    int count = 0;
+    for (; mask != 0; mask >>= 1) {
+        count += mask & 1;
+    }
+    return count;
+}
+
+static void add_stats(stats_t *stats, stats_t *other) {
+    stats->num_triangles += other->num_triangles;
+    stats->num_clipped += other->num_clipped;
+    stats->num_outside += other->num_outside;
+    stats->num_backfacing += other->num_backfacing;
+    stats->num_degenerate += other->num_degenerate;
+    stats->num_occluded += other->num_occluded;
+    stats->num_tested += other->num_tested;
+    stats->num_depth_rejected += other->num_depth_rejected;
+    stats->num_shaded += other->num_shaded;
+    stats->num_discarded += other->num_discarded;
+    stats->num_blended += other->num_blended;
+    stats->vertex_time += other->vertex_time;
+    stats->clip_time += other->clip_time;
+    stats->raster_time += other->raster_time;
+    stats->fragment_time += other->fragment_time;
+}
+
+#endif
+
 /*
  * for triangle clipping, see
  * http://fabiensanglard.net/polygon_codec/
@@ -274,6 +380,17 @@ static int is_vertex_visible(vec4_t v) {
     return fabs(v.x) <= v.w && fabs(v.y) <= v.w && fabs(v.z) <= v.w;
 }
 
+static int get_outside_code(vec4_t v) {
+    int code = 0;
+    int plane;
+    for (plane = POSITIVE_W; plane <= NEGATIVE_Z; plane++) {
+        if (!is_inside_plane(v, (plane_t)plane)) {
+            code |= 1 << plane;
+        }
+    }
+    return code;
+}
+
 static int clip_triangle(
         int sizeof_varyings,
         vec4_t in_coords[MAX_VARYINGS], void *in_varyings[MAX_VARYINGS],
@@ -292,6 +409,9 @@ static int clip_triangle(
     } else {
         int varying_num_floats = sizeof_varyings / sizeof(float);
         int num_vertices = 3;
+#ifdef GRAPHICS_STATS
+        g_stats.num_clipped += 1;
+#endif
         CLIP_IN2OUT(POSITIVE_W);
         CLIP_OUT2IN(POSITIVE_X);
         CLIP_IN2OUT(NEGATIVE_X);
@@ -355,47 +475,58 @@ static bbox_t find_bounding_box(vec2_t abc[3], int width, int height) {
 }
 
 /*
- * for barycentric coordinates, see
- * http://blackpawn.com/texts/pointinpoly/
+ * for edge functions and the top-left fill rule, see
+ * https://fgiesen.wordpress.com/2013/02/06/the-barycentric-conspiracy/
+ * https://fgiesen.wordpress.com/2013/02/08/triangle-rasterization-in-practice/
  *
- * solve
- *     P = A + s * AB + t * AC  -->  AP = s * AB + t * AC
- * then
- *     s = (AC.y * AP.x - AC.x * AP.y) / (AB.x * AC.y - AB.y * AC.x)
- *     t = (AB.x * AP.y - AB.y * AP.x) / (AB.x * AC.y - AB.y * AC.x)
+ * vertices are snapped to fixed point with 8 bits of subpixel precision,
+ * the edge function of the directed edge from A to B is
+ *     E_AB(P) = (B.x - A.x) * (P.y - A.y) - (B.y - A.y) * (P.x - A.x)
+ * which is positive if P lies on the left side of the edge, and
+ *     weight_A = E_BC(P) / E_AB(C)
+ *     weight_B = E_CA(P) / E_AB(C)
+ *     weight_C = E_AB(P) / E_AB(C)
  *
- * notice
- *     P = A + s * AB + t * AC
- *       = A + s * (B - A) + t * (C - A)
- *       = (1 - s - t) * A + s * B + t * C
- * then
- *     weight_A = 1 - s - t
- *     weight_B = s
- *     weight_C = t
+ * the edge functions are integer-valued, but the products need more than
+ * 32 bits and C89 has no 64-bit integer type, so they are kept in doubles,
+ * which represent all the integers involved exactly
  */
-static vec3_t calculate_weights(vec2_t abc[3], vec2_t p) {
-    vec2_t a = abc[0];
-    vec2_t b = abc[1];
-    vec2_t c = abc[2];
-    vec2_t ab = vec2_sub(b, a);
-    vec2_t ac = vec2_sub(c, a);
-    vec2_t ap = vec2_sub(p, a);
-    float factor = 1 / (ab.x * ac.y - ab.y * ac.x);
-    float s = (ac.y * ap.x - ac.x * ap.y) * factor;
-    float t = (ab.x * ap.y - ab.y * ap.x) * factor;
-    vec3_t weights = vec3_new(1 - s - t, s, t);
-    return weights;
+
+#define SUBPIXEL_BITS 8
+#define SUBPIXEL_ONE (1 << SUBPIXEL_BITS)
+#define SUBPIXEL_HALF (SUBPIXEL_ONE / 2)
+
+typedef struct {
+    double step_x;  /* increment per pixel along x */
+    double step_y;  /* increment per pixel along y */
+    double origin;  /* biased value at the center of pixel (0, 0) */
+    double bias;    /* 0 for top and left edges, -1 for the others */
+} edge_t;
+
+static int snap_to_subpixel(float coord) {
+    return (int)floor((double)coord * SUBPIXEL_ONE + 0.5);
 }
 
-/*
- * for depth interpolation, see subsection 3.5.1 of
- * https://www.khronos.org/registry/OpenGL/specs/es/2.0/es_full_spec_2.0.pdf
- */
-static float interpolate_depth(float screen_depths[3], vec3_t weights) {
-    float depth0 = screen_depths[0] * weights.x;
-    float depth1 = screen_depths[1] * weights.y;
-    float depth2 = screen_depths[2] * weights.z;
-    return depth0 + depth1 + depth2;
+static double get_doubled_area(int fixed_x[3], int fixed_y[3]) {
+    double ab_x = (double)(fixed_x[1] - fixed_x[0]);
+    double ab_y = (double)(fixed_y[1] - fixed_y[0]);
+    double ac_x = (double)(fixed_x[2] - fixed_x[0]);
+    double ac_y = (double)(fixed_y[2] - fixed_y[0]);
+    return ab_x * ac_y - ab_y * ac_x;
+}
+
+static edge_t setup_edge(int ax, int ay, int bx, int by) {
+    double dx = (double)(bx - ax);
+    double dy = (double)(by - ay);
+    /* the interior of a counter-clockwise triangle is on the left */
+    int is_top_left = dy < 0 || (dy == 0 && dx < 0);
+    edge_t edge;
+    edge.step_x = -dy * SUBPIXEL_ONE;
+    edge.step_y = dx * SUBPIXEL_ONE;
+    edge.bias = is_top_left ? 0 : -1;
+    edge.origin = dx * (double)(SUBPIXEL_HALF - ay)
+                  - dy * (double)(SUBPIXEL_HALF - ax) + edge.bias;
+    return edge;
 }
 
 /*
@@ -425,17 +556,60 @@ static void interpolate_varyings(
     }
 }
 
+/*
+ * for screen space derivatives, see
+ * https://www.khronos.org/registry/OpenGL/specs/es/3.0/GLSL_ES_Specification_3.00.pdf
+ *
+ * the screen weights are linear in x and y, so the derivatives are exact
+ * rather than differences over a quad, with v = sum(b_i * r_i * v_i) / q
+ * and q = sum(b_i * r_i), dv/dx is sum(db_i/dx * r_i * (v_i - v)) / q,
+ * they are written after the varyings in the same layout
+ */
+static void differentiate_varyings(
+        void *src_varyings[3], void *dst_varyings,
+        int sizeof_varyings, vec3_t weights, float recip_w[3],
+        vec3_t steps_x, vec3_t steps_y) {
+    int num_floats = sizeof_varyings / sizeof(float);
+    float *src0 = (float*)src_varyings[0];
+    float *src1 = (float*)src_varyings[1];
+    float *src2 = (float*)src_varyings[2];
+    float *dst = (float*)dst_varyings;
+    float *dst_x = dst + num_floats;
+    float *dst_y = dst + num_floats * 2;
+    float normalizer = 1 / (recip_w[0] * weights.x + recip_w[1] * weights.y
+                            + recip_w[2] * weights.z);
+    float factor0 = recip_w[0] * normalizer;
+    float factor1 = recip_w[1] * normalizer;
+    float factor2 = recip_w[2] * normalizer;
+    int i;
+    for (i = 0; i < num_floats; i++) {
+        float delta0 = (src0[i] - dst[i]) * factor0;
+        float delta1 = (src1[i] - dst[i]) * factor1;
+        float delta2 = (src2[i] - dst[i]) * factor2;
+        dst_x[i] = delta0 * steps_x.x + delta1 * steps_x.y + delta2 * steps_x.z;
+        dst_y[i] = delta0 * steps_y.x + delta1 * steps_y.y + delta2 * steps_y.z;
+    }
+}
+
 static void draw_fragment(framebuffer_t *framebuffer, program_t *program,
-                          int backface, int index, float depth) {
+                          void *varyings, int backface, int index,
+                          float depth, int depth_write) {
     vec4_t color;
     int discard;
+#ifdef GRAPHICS_STATS
+    stats_t *stats = get_tile_stats(framebuffer, index % framebuffer->width,
+                                    index / framebuffer->width);
+#endif
 
     /* execute fragment shader */
     discard = 0;
-    color = program->fragment_shader(program->shader_varyings,
-                                     program->shader_uniforms,
-                                     &discard,
-                                     backface);
+    color = program->fragment_shader(varyings, program->shader_uniforms,
+                                     &discard, backface);
+#ifdef GRAPHICS_STATS
+    stats->num_shaded += 1;
+    stats->num_discarded += discard ? 1 : 0;
+    stats->num_blended += !discard && program->enable_blend ? 1 : 0;
+#endif
     if (discard) {
         return;
     }
@@ -456,20 +630,55 @@ static void draw_fragment(framebuffer_t *framebuffer, program_t *program,
     framebuffer->color_buffer[index * 4 + 0] = float_to_uchar(color.x);
     framebuffer->color_buffer[index * 4 + 1] = float_to_uchar(color.y);
     framebuffer->color_buffer[index * 4 + 2] = float_to_uchar(color.z);
-    framebuffer->depth_buffer[index] = depth;
+    if (depth_write) {
+        framebuffer->depth_buffer[index] = depth;
+    }
 }
 
-static int rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
-                              vec4_t clip_coords[3], void *varyings[3]) {
-    int width = framebuffer->width;
-    int height = framebuffer->height;
-    vec3_t ndc_coords[3];
+typedef struct {
     vec2_t screen_coords[3];
     float screen_depths[3];
     float recip_w[3];
     int backface;
     bbox_t bbox;
-    int i, x, y;
+    edge_t edges[3];
+    float recip_area;
+    float min_depth;
+    depth_mode_t depth_mode;
+    int id;  /* for visibility buffer */
+} triangle_t;
+
+static void prepare_varyings(program_t *program, triangle_t *triangle,
+                             void *varyings[3], void *shader_varyings,
+                             vec3_t weights) {
+    interpolate_varyings(varyings, shader_varyings, program->sizeof_varyings,
+                         weights, triangle->recip_w);
+    if (program->derivatives) {
+        edge_t *edges = triangle->edges;
+        float recip_area = triangle->recip_area;
+        vec3_t steps_x = vec3_new((float)edges[0].step_x * recip_area,
+                                  (float)edges[1].step_x * recip_area,
+                                  (float)edges[2].step_x * recip_area);
+        vec3_t steps_y = vec3_new((float)edges[0].step_y * recip_area,
+                                  (float)edges[1].step_y * recip_area,
+                                  (float)edges[2].step_y * recip_area);
+        differentiate_varyings(varyings, shader_varyings,
+                               program->sizeof_varyings, weights,
+                               triangle->recip_w, steps_x, steps_y);
+    }
+}
+
+static int setup_triangle(framebuffer_t *framebuffer, program_t *program,
+                          vec4_t clip_coords[3], triangle_t *triangle) {
+    int width = framebuffer->width;
+    int height = framebuffer->height;
+    vec3_t ndc_coords[3];
+    int fixed_x[3], fixed_y[3];
+    double area;
+    int i;
+
+    triangle->depth_mode = program->depth_mode;
+    triangle->id = -1;
 
     /* perspective division */
     for (i = 0; i < 3; i++) {
@@ -478,86 +687,1045 @@ static int rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
     }
 
     /* back-face culling */
-    backface = is_back_facing(ndc_coords);
-    if (backface && !program->double_sided) {
+    triangle->backface = is_back_facing(ndc_coords);
+    if (triangle->backface && !program->double_sided) {
         return 1;
     }
 
     /* reciprocals of w */
     for (i = 0; i < 3; i++) {
-        recip_w[i] = 1 / clip_coords[i].w;
+        triangle->recip_w[i] = 1 / clip_coords[i].w;
     }
 
     /* viewport mapping */
     for (i = 0; i < 3; i++) {
         vec3_t window_coord = viewport_transform(width, height, ndc_coords[i]);
-        screen_coords[i] = vec2_new(window_coord.x, window_coord.y);
-        screen_depths[i] = window_coord.z;
-    }
-
-    /* perform rasterization */
-    bbox = find_bounding_box(screen_coords, width, height);
-    for (x = bbox.min_x; x <= bbox.max_x; x++) {
-        for (y = bbox.min_y; y <= bbox.max_y; y++) {
-            vec2_t point = vec2_new((float)x + 0.5f, (float)y + 0.5f);
-            vec3_t weights = calculate_weights(screen_coords, point);
-            int weight0_okay = weights.x > -EPSILON;
-            int weight1_okay = weights.y > -EPSILON;
-            int weight2_okay = weights.z > -EPSILON;
-            if (weight0_okay && weight1_okay && weight2_okay) {
-                int index = y * width + x;
-                float depth = interpolate_depth(screen_depths, weights);
-                /* early depth testing */
-                if (depth <= framebuffer->depth_buffer[index]) {
-                    interpolate_varyings(varyings, program->shader_varyings,
-                                         program->sizeof_varyings,
-                                         weights, recip_w);
-                    draw_fragment(framebuffer, program, backface, index, depth);
+        triangle->screen_coords[i] = vec2_new(window_coord.x, window_coord.y);
+        triangle->screen_depths[i] = window_coord.z;
+    }
+    triangle->min_depth = float_min(float_min(triangle->screen_depths[0],
+                                              triangle->screen_depths[1]),
+                                    triangle->screen_depths[2]);
+
+    triangle->bbox = find_bounding_box(triangle->screen_coords, width, height);
+
+    /* edge function setup */
+    for (i = 0; i < 3; i++) {
+        fixed_x[i] = snap_to_subpixel(triangle->screen_coords[i].x);
+        fixed_y[i] = snap_to_subpixel(triangle->screen_coords[i].y);
+    }
+    area = get_doubled_area(fixed_x, fixed_y);
+    if (area > 0) {
+        triangle->edges[0] = setup_edge(fixed_x[1], fixed_y[1],
+                                        fixed_x[2], fixed_y[2]);
+        triangle->edges[1] = setup_edge(fixed_x[2], fixed_y[2],
+                                        fixed_x[0], fixed_y[0]);
+        triangle->edges[2] = setup_edge(fixed_x[0], fixed_y[0],
+                                        fixed_x[1], fixed_y[1]);
+        triangle->recip_area = (float)(1 / area);
+    } else if (area < 0) {
+        /* reverse the edges of clockwise triangles */
+        triangle->edges[0] = setup_edge(fixed_x[2], fixed_y[2],
+                                        fixed_x[1], fixed_y[1]);
+        triangle->edges[1] = setup_edge(fixed_x[0], fixed_y[0],
+                                        fixed_x[2], fixed_y[2]);
+        triangle->edges[2] = setup_edge(fixed_x[1], fixed_y[1],
+                                        fixed_x[0], fixed_y[0]);
+        triangle->recip_area = (float)(-1 / area);
+    } else {
+        /* zero-area triangles cover no pixels */
+#ifdef GRAPHICS_STATS
+        g_stats.num_degenerate += 1;
+#endif
+        triangle->bbox.max_x = triangle->bbox.min_x - 1;
+        triangle->bbox.max_y = triangle->bbox.min_y - 1;
+    }
+
+    return 0;
+}
+
+/*
+ * for hierarchical rasterization, see
+ * https://fgiesen.wordpress.com/2011/07/06/a-trip-through-the-graphics-pipeline-2011-part-6/
+ * https://www.cs.cmu.edu/afs/cs/academic/class/15869-f11/www/readings/abrash09_lrbrast.pdf
+ *
+ * the bounding box is traversed in blocks of 8x8 pixels, since the edge
+ * functions are linear, their extremes over a block are found at its
+ * corners, so a block is trivially rejected if any edge is negative at all
+ * the corners, and trivially accepted if all the edges are non-negative at
+ * all the corners, only the remaining blocks are tested pixel by pixel
+ */
+
+#define BLOCK_SIZE 8
+
+typedef enum {
+    BLOCK_OUTSIDE,
+    BLOCK_PARTIAL,
+    BLOCK_INSIDE
+} coverage_t;
+
+static coverage_t classify_block(edge_t edges[3], double values[3],
+                                 int num_steps_x, int num_steps_y) {
+    coverage_t coverage = BLOCK_INSIDE;
+    int i;
+    for (i = 0; i < 3; i++) {
+        double step_x = edges[i].step_x * (double)num_steps_x;
+        double step_y = edges[i].step_y * (double)num_steps_y;
+        double max_value = values[i] + (step_x > 0 ? step_x : 0)
+                                     + (step_y > 0 ? step_y : 0);
+        double min_value = values[i] + (step_x < 0 ? step_x : 0)
+                                     + (step_y < 0 ? step_y : 0);
+        if (max_value < 0) {
+            return BLOCK_OUTSIDE;
+        } else if (min_value < 0) {
+            coverage = BLOCK_PARTIAL;
+        }
+    }
+    return coverage;
+}
+
+/*
+ * for hierarchical depth testing, see
+ * https://www.cs.princeton.edu/courses/archive/spring01/cs598b/papers/greene93.pdf
+ * https://fgiesen.wordpress.com/2011/07/08/a-trip-through-the-graphics-pipeline-2011-part-7/
+ *
+ * the maximum depth of every block and every tile is kept alongside the
+ * depth buffer, since a fragment passes the depth test only if its depth is
+ * not greater than the stored one, triangles, tiles and blocks whose nearest
+ * depth is greater than the maximum depth can be rejected as a whole
+ *
+ * between two clears, the stored depths never increase, so the maximums
+ * are refreshed only when a block is written to, and a stale maximum is
+ * still a conservative bound, the tiles coincide with those of binned
+ * rasterization so that each one is updated by a single worker thread
+ */
+
+#define TILE_SIZE 64
+#define BLOCKS_PER_TILE (TILE_SIZE / BLOCK_SIZE)
+
+struct hiz {
+    int width, height;
+    int num_blocks_x, num_blocks_y;
+    int num_tiles_x, num_tiles_y;
+    float *block_depths;
+    float *tile_depths;
+};
+
+static struct hiz *create_hiz(int width, int height) {
+    struct hiz *hiz = (struct hiz*)malloc(sizeof(struct hiz));
+    int num_blocks, num_tiles;
+
+    hiz->width = width;
+    hiz->height = height;
+    hiz->num_blocks_x = (width + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    hiz->num_blocks_y = (height + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    hiz->num_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    hiz->num_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    num_blocks = hiz->num_blocks_x * hiz->num_blocks_y;
+    num_tiles = hiz->num_tiles_x * hiz->num_tiles_y;
+    hiz->block_depths = (float*)malloc(sizeof(float) * num_blocks);
+    hiz->tile_depths = (float*)malloc(sizeof(float) * num_tiles);
+
+    return hiz;
+}
+
+static void release_hiz(struct hiz *hiz) {
+    free(hiz->block_depths);
+    free(hiz->tile_depths);
+    free(hiz);
+}
+
+static void clear_hiz(struct hiz *hiz, float depth) {
+    int num_blocks = hiz->num_blocks_x * hiz->num_blocks_y;
+    int num_tiles = hiz->num_tiles_x * hiz->num_tiles_y;
+    int i;
+    for (i = 0; i < num_blocks; i++) {
+        hiz->block_depths[i] = depth;
+    }
+    for (i = 0; i < num_tiles; i++) {
+        hiz->tile_depths[i] = depth;
+    }
+}
+
+static void update_tile_depth(struct hiz *hiz, int tile_x, int tile_y) {
+    int start_x = tile_x * BLOCKS_PER_TILE;
+    int start_y = tile_y * BLOCKS_PER_TILE;
+    int end_x = min_integer(start_x + BLOCKS_PER_TILE, hiz->num_blocks_x);
+    int end_y = min_integer(start_y + BLOCKS_PER_TILE, hiz->num_blocks_y);
+    float max_depth = hiz->block_depths[start_y * hiz->num_blocks_x + start_x];
+    int x, y;
+    for (y = start_y; y < end_y; y++) {
+        for (x = start_x; x < end_x; x++) {
+            float depth = hiz->block_depths[y * hiz->num_blocks_x + x];
+            max_depth = float_max(max_depth, depth);
+        }
+    }
+    hiz->tile_depths[tile_y * hiz->num_tiles_x + tile_x] = max_depth;
+}
+
+static void update_block_depth(struct hiz *hiz, float *depth_buffer,
+                               int block_x, int block_y) {
+    int start_x = block_x * BLOCK_SIZE;
+    int start_y = block_y * BLOCK_SIZE;
+    int end_x = min_integer(start_x + BLOCK_SIZE, hiz->width);
+    int end_y = min_integer(start_y + BLOCK_SIZE, hiz->height);
+    int block_index = block_y * hiz->num_blocks_x + block_x;
+    float old_depth = hiz->block_depths[block_index];
+    float new_depth = depth_buffer[start_y * hiz->width + start_x];
+    int x, y;
+
+    for (y = start_y; y < end_y; y++) {
+        for (x = start_x; x < end_x; x++) {
+            new_depth = float_max(new_depth, depth_buffer[y * hiz->width + x]);
+        }
+    }
+    if (new_depth < old_depth) {
+        int tile_x = block_x / BLOCKS_PER_TILE;
+        int tile_y = block_y / BLOCKS_PER_TILE;
+        int tile_index = tile_y * hiz->num_tiles_x + tile_x;
+        hiz->block_depths[block_index] = new_depth;
+        if (old_depth == hiz->tile_depths[tile_index]) {
+            update_tile_depth(hiz, tile_x, tile_y);
+        }
+    }
+}
+
+static int is_tile_occluded(struct hiz *hiz, triangle_t *triangle,
+                            int tile_x, int tile_y) {
+    int tile_index = tile_y * hiz->num_tiles_x + tile_x;
+    return triangle->min_depth > hiz->tile_depths[tile_index];
+}
+
+static int is_block_occluded(struct hiz *hiz, triangle_t *triangle,
+                             int block_x, int block_y) {
+    int block_index = block_y * hiz->num_blocks_x + block_x;
+    return triangle->min_depth > hiz->block_depths[block_index];
+}
+
+#ifdef GRAPHICS_STATS
+
+/* framebuffers share the slots, since only one is flushed at a time */
+static void reserve_tile_stats(struct hiz *hiz) {
+    int num_tiles = hiz->num_tiles_x * hiz->num_tiles_y;
+    if (num_tiles > g_num_tile_stats) {
+        int sizeof_slots = sizeof(slot_t) * num_tiles;
+        int sizeof_added = sizeof(slot_t) * (num_tiles - g_num_tile_stats);
+        g_tile_stats = (slot_t*)realloc(g_tile_stats, sizeof_slots);
+        memset(g_tile_stats + g_num_tile_stats, 0, sizeof_added);
+        g_num_tile_stats = num_tiles;
+    }
+}
+
+static stats_t *get_tile_stats(framebuffer_t *framebuffer, int x, int y) {
+    struct hiz *hiz = framebuffer->hiz;
+    int tile_index = y / TILE_SIZE * hiz->num_tiles_x + x / TILE_SIZE;
+    return &g_tile_stats[tile_index].stats;
+}
+
+#endif
+
+static int is_triangle_occluded(struct hiz *hiz, triangle_t *triangle) {
+    bbox_t bbox = triangle->bbox;
+    int tile_x, tile_y;
+    for (tile_y = bbox.min_y / TILE_SIZE;
+         tile_y <= bbox.max_y / TILE_SIZE; tile_y++) {
+        for (tile_x = bbox.min_x / TILE_SIZE;
+             tile_x <= bbox.max_x / TILE_SIZE; tile_x++) {
+            if (!is_tile_occluded(hiz, triangle, tile_x, tile_y)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*
+ * for visibility buffer, see
+ * http://jcgt.org/published/0002/02/04/
+ * http://filmicworlds.com/blog/visibility-buffer-rendering-with-material-graphs/
+ *
+ * the triangles drawn in visibility mode are kept until the framebuffer is
+ * resolved, and only the id of the visible triangle and the barycentric
+ * weights of its 2nd and 3rd vertices are written for each pixel, varyings
+ * are interpolated and fragment shaders are run in the resolve pass, once
+ * per pixel regardless of the depth complexity
+ */
+
+struct visibility {
+    int *ids;
+    float *weights;
+    unsigned char *records;
+    int *offsets;
+    int max_sizeof_varyings;
+};
+
+static struct visibility *create_visibility(int width, int height) {
+    struct visibility *visibility;
+    int num_pixels = width * height;
+    int i;
+
+    visibility = (struct visibility*)malloc(sizeof(struct visibility));
+    visibility->ids = (int*)malloc(sizeof(int) * num_pixels);
+    visibility->weights = (float*)malloc(sizeof(float) * num_pixels * 2);
+    for (i = 0; i < num_pixels; i++) {
+        visibility->ids[i] = -1;
+    }
+    visibility->records = NULL;
+    visibility->offsets = NULL;
+    visibility->max_sizeof_varyings = 0;
+
+    return visibility;
+}
+
+static void release_visibility(struct visibility *visibility) {
+    free(visibility->ids);
+    free(visibility->weights);
+    darray_free(visibility->records);
+    darray_free(visibility->offsets);
+    free(visibility);
+}
+
+static vec3_t get_span_weights(triangle_t *triangle, span_t *span, int lane) {
+    double offset = (double)lane;
+    float weight0 = (float)(span->values[0] - span->biases[0]
+                            + span->steps[0] * offset);
+    float weight1 = (float)(span->values[1] - span->biases[1]
+                            + span->steps[1] * offset);
+    float weight2 = (float)(span->values[2] - span->biases[2]
+                            + span->steps[2] * offset);
+    vec3_t weights = vec3_new(weight0, weight1, weight2);
+    return vec3_mul(weights, triangle->recip_area);
+}
+
+/*
+ * after a depth pre-pass, the stored depth of each pixel is the minimum
+ * over all the fragments drawn to it, so the <= test of the span kernels
+ * passes exactly the fragments with the stored depth and serves as the
+ * equal test as well
+ */
+static void shade_fragment(framebuffer_t *framebuffer, program_t *program,
+                           triangle_t *triangle, void *varyings[3],
+                           void *shader_varyings, span_t *span, int lane,
+                           int index, float depth) {
+    if (triangle->depth_mode == DEPTH_ONLY) {
+        framebuffer->depth_buffer[index] = depth;
+    } else if (triangle->depth_mode == DEPTH_VISIBILITY) {
+        struct visibility *visibility = framebuffer->visibility;
+        vec3_t weights = get_span_weights(triangle, span, lane);
+        framebuffer->depth_buffer[index] = depth;
+        visibility->ids[index] = triangle->id;
+        visibility->weights[index * 2 + 0] = weights.y;
+        visibility->weights[index * 2 + 1] = weights.z;
+    } else {
+        vec3_t weights = get_span_weights(triangle, span, lane);
+        int depth_write = triangle->depth_mode == DEPTH_DEFAULT;
+        prepare_varyings(program, triangle, varyings, shader_varyings,
+                         weights);
+        draw_fragment(framebuffer, program, shader_varyings,
+                      triangle->backface, index, depth, depth_write);
+    }
+}
+
+static void rasterize_block(framebuffer_t *framebuffer, program_t *program,
+                            triangle_t *triangle, void *varyings[3],
+                            void *shader_varyings, bbox_t block,
+                            double values[3], int is_inside) {
+    edge_t *edges = triangle->edges;
+    int width = framebuffer->width;
+    int written = 0;
+    span_t span;
+    int i, x, y;
+#ifdef GRAPHICS_STATS
+    stats_t *stats = get_tile_stats(framebuffer, block.min_x, block.min_y);
+    double start_clock;
+    int covered;
+#endif
+
+    for (i = 0; i < 3; i++) {
+        span.steps[i] = edges[i].step_x;
+        span.biases[i] = edges[i].bias;
+        span.depths[i] = triangle->screen_depths[i];
+    }
+    span.recip_area = triangle->recip_area;
+
+    for (y = block.min_y; y <= block.max_y; y++) {
+        for (x = block.min_x; x <= block.max_x; x += SPAN_SIZE) {
+            int num_pixels = min_integer(block.max_x - x + 1, SPAN_SIZE);
+            float *depth_row = framebuffer->depth_buffer + y * width + x;
+            float depths[SPAN_SIZE];
+            int mask;
+
+            for (i = 0; i < 3; i++) {
+                span.values[i] = values[i]
+                                 + edges[i].step_x * (double)(x - block.min_x)
+                                 + edges[i].step_y * (double)(y - block.min_y);
+            }
+            mask = raster_test_span(&span, depth_row, num_pixels, is_inside,
+                                    depths);
+#ifdef GRAPHICS_STATS
+            covered = count_lanes(mask >> SPAN_SIZE);
+            mask &= SPAN_MASK;
+            stats->num_tested += covered;
+            stats->num_depth_rejected += covered - count_lanes(mask);
+            start_clock = mask != 0 ? platform_get_clock() : 0;
+#endif
+            if (triangle->depth_mode != DEPTH_EQUAL) {
+                written |= mask;
+            }
+            for (i = 0; mask != 0; i++, mask >>= 1) {
+                if (mask & 1) {
+                    shade_fragment(framebuffer, program, triangle, varyings,
+                                   shader_varyings, &span, i,
+                                   y * width + x + i, depths[i]);
                 }
             }
+#ifdef GRAPHICS_STATS
+            if (start_clock > 0) {
+                /* moved out of the time of the enclosing triangle */
+                double elapsed = platform_get_clock() - start_clock;
+                stats->fragment_time += elapsed;
+                stats->raster_time -= elapsed;
+            }
+#endif
         }
     }
 
-    return 0;
+    if (written) {
+        update_block_depth(framebuffer->hiz, framebuffer->depth_buffer,
+                           block.min_x / BLOCK_SIZE, block.min_y / BLOCK_SIZE);
+    }
 }
 
-void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
-    int num_vertices;
+static void rasterize_triangle(framebuffer_t *framebuffer, program_t *program,
+                               triangle_t *triangle, void *varyings[3],
+                               void *shader_varyings, bbox_t bbox) {
+    edge_t *edges = triangle->edges;
+    int start_x = bbox.min_x / BLOCK_SIZE * BLOCK_SIZE;
+    int start_y = bbox.min_y / BLOCK_SIZE * BLOCK_SIZE;
+    int i, block_x, block_y;
+#ifdef GRAPHICS_STATS
+    stats_t *stats = get_tile_stats(framebuffer, bbox.min_x, bbox.min_y);
+    double start_clock = platform_get_clock();
+#endif
+
+    for (block_y = start_y; block_y <= bbox.max_y; block_y += BLOCK_SIZE) {
+        for (block_x = start_x; block_x <= bbox.max_x; block_x += BLOCK_SIZE) {
+            double values[3];
+            coverage_t coverage;
+            bbox_t block;
+
+            if (is_block_occluded(framebuffer->hiz, triangle,
+                                  block_x / BLOCK_SIZE,
+                                  block_y / BLOCK_SIZE)) {
+                continue;
+            }
+            block.min_x = max_integer(block_x, bbox.min_x);
+            block.min_y = max_integer(block_y, bbox.min_y);
+            block.max_x = min_integer(block_x + BLOCK_SIZE - 1, bbox.max_x);
+            block.max_y = min_integer(block_y + BLOCK_SIZE - 1, bbox.max_y);
+
+            for (i = 0; i < 3; i++) {
+                values[i] = edges[i].origin
+                            + edges[i].step_x * (double)block.min_x
+                            + edges[i].step_y * (double)block.min_y;
+            }
+            coverage = classify_block(edges, values,
+                                      block.max_x - block.min_x,
+                                      block.max_y - block.min_y);
+            if (coverage != BLOCK_OUTSIDE) {
+                int is_inside = coverage == BLOCK_INSIDE;
+                rasterize_block(framebuffer, program, triangle, varyings,
+                                shader_varyings, block, values, is_inside);
+            }
+        }
+    }
+#ifdef GRAPHICS_STATS
+    stats->raster_time += platform_get_clock() - start_clock;
+#endif
+}
+
+/*
+ * for tile-based binned rasterization, see
+ * https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
+ * https://www.cs.cmu.edu/afs/cs/academic/class/15869-f11/www/readings/abrash09_lrbrast.pdf
+ *
+ * set-up triangles are recorded into the bins of all the tiles they overlap
+ * and rasterized tile by tile when the framebuffer is flushed, so that each
+ * tile is owned by exactly one worker thread and the color and depth buffers
+ * need no locking, while the fragments of every pixel are still processed
+ * in submission order
+ *
+ * the records keep their varyings but only point to their program, whose
+ * fragment shader reads the uniforms when the tiles are rasterized, so the
+ * uniforms of a program must stay unchanged from its draws until the flush
+ */
+
+struct bins {
+    int num_tiles_x, num_tiles_y;
+    int **tiles;
+    unsigned char *records;
+    int max_sizeof_varyings;
+};
+
+typedef struct {
+    program_t *program;
+    triangle_t triangle;
+} record_t;
+
+static int g_num_threads = 1;
+
+static int align_size(int size) {
+    int alignment = sizeof(double);
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+static int push_record(unsigned char **records, program_t *program,
+                       triangle_t *triangle, void *varyings[3]) {
+    int sizeof_varyings = program->sizeof_varyings;
+    int header_size = align_size(sizeof(record_t));
+    int record_size = align_size(header_size + sizeof_varyings * 3);
+    int offset = darray_size(*records);
+    record_t *record;
     int i;
 
-    /* execute vertex shader */
+    *records = (unsigned char*)darray_hold(*records, record_size, 1);
+    record = (record_t*)(*records + offset);
+    record->program = program;
+    record->triangle = *triangle;
     for (i = 0; i < 3; i++) {
-        vec4_t clip_coord = program->vertex_shader(program->shader_attribs[i],
-                                                   program->in_varyings[i],
-                                                   program->shader_uniforms);
-        program->in_coords[i] = clip_coord;
+        unsigned char *dest = *records + offset + header_size;
+        memcpy(dest + sizeof_varyings * i, varyings[i], sizeof_varyings);
     }
+    return offset;
+}
 
-    /* triangle clipping */
-    num_vertices = clip_triangle(program->sizeof_varyings,
-                                 program->in_coords, program->in_varyings,
-                                 program->out_coords, program->out_varyings);
+static record_t *get_record(unsigned char *records, int offset,
+                            void *varyings[3]) {
+    unsigned char *base = records + offset;
+    record_t *record = (record_t*)base;
+    int header_size = align_size(sizeof(record_t));
+    int sizeof_varyings = record->program->sizeof_varyings;
+    int i;
+    for (i = 0; i < 3; i++) {
+        varyings[i] = base + header_size + sizeof_varyings * i;
+    }
+    return record;
+}
 
-    /* triangle assembly */
+static struct bins *create_bins(int width, int height) {
+    struct bins *bins = (struct bins*)malloc(sizeof(struct bins));
+    int num_tiles, i;
+
+    bins->num_tiles_x = (width + TILE_SIZE - 1) / TILE_SIZE;
+    bins->num_tiles_y = (height + TILE_SIZE - 1) / TILE_SIZE;
+    num_tiles = bins->num_tiles_x * bins->num_tiles_y;
+    bins->tiles = (int**)malloc(sizeof(int*) * num_tiles);
+    for (i = 0; i < num_tiles; i++) {
+        bins->tiles[i] = NULL;
+    }
+    bins->records = NULL;
+    bins->max_sizeof_varyings = 0;
+
+    return bins;
+}
+
+static void release_bins(struct bins *bins) {
+    int num_tiles = bins->num_tiles_x * bins->num_tiles_y;
+    int i;
+    for (i = 0; i < num_tiles; i++) {
+        darray_free(bins->tiles[i]);
+    }
+    free(bins->tiles);
+    darray_free(bins->records);
+    free(bins);
+}
+
+static void bin_triangle(framebuffer_t *framebuffer, program_t *program,
+                         triangle_t *triangle, void *varyings[3]) {
+    int sizeof_varyings = program->sizeof_varyings;
+    bbox_t bbox = triangle->bbox;
+    struct bins *bins;
+    int offset;
+    int tile_x, tile_y;
+
+    if (bbox.min_x > bbox.max_x || bbox.min_y > bbox.max_y) {
+        return;
+    }
+    if (framebuffer->bins == NULL) {
+        framebuffer->bins = create_bins(framebuffer->width,
+                                        framebuffer->height);
+    }
+    bins = framebuffer->bins;
+
+    offset = push_record(&bins->records, program, triangle, varyings);
+    if (sizeof_varyings > bins->max_sizeof_varyings) {
+        bins->max_sizeof_varyings = sizeof_varyings;
+    }
+
+    for (tile_y = bbox.min_y / TILE_SIZE;
+         tile_y <= bbox.max_y / TILE_SIZE; tile_y++) {
+        for (tile_x = bbox.min_x / TILE_SIZE;
+             tile_x <= bbox.max_x / TILE_SIZE; tile_x++) {
+            int tile_index = tile_y * bins->num_tiles_x + tile_x;
+            if (!is_tile_occluded(framebuffer->hiz, triangle,
+                                  tile_x, tile_y)) {
+                darray_push(bins->tiles[tile_index], offset);
+            }
+        }
+    }
+}
+
+static void rasterize_tile(framebuffer_t *framebuffer, int tile_x, int tile_y,
+                           void *shader_varyings) {
+    struct bins *bins = framebuffer->bins;
+    int *offsets = bins->tiles[tile_y * bins->num_tiles_x + tile_x];
+    int num_offsets = darray_size(offsets);
+    int min_x = tile_x * TILE_SIZE;
+    int min_y = tile_y * TILE_SIZE;
+    int i;
+
+    for (i = 0; i < num_offsets; i++) {
+        void *varyings[3];
+        record_t *record = get_record(bins->records, offsets[i], varyings);
+        program_t *program = record->program;
+        triangle_t *triangle = &record->triangle;
+        bbox_t bbox;
+
+        if (is_tile_occluded(framebuffer->hiz, triangle, tile_x, tile_y)) {
+            continue;
+        }
+        bbox.min_x = max_integer(triangle->bbox.min_x, min_x);
+        bbox.min_y = max_integer(triangle->bbox.min_y, min_y);
+        bbox.max_x = min_integer(triangle->bbox.max_x, min_x + TILE_SIZE - 1);
+        bbox.max_y = min_integer(triangle->bbox.max_y, min_y + TILE_SIZE - 1);
+        rasterize_triangle(framebuffer, program, triangle, varyings,
+                           shader_varyings, bbox);
+    }
+}
+
+typedef void tilefunc_t(framebuffer_t *framebuffer, int tile_x, int tile_y,
+                        void *shader_varyings);
+
+typedef struct {
+    framebuffer_t *framebuffer;
+    tilefunc_t *tilefunc;
+    const char *tilename;
+    int sizeof_varyings;
+    mutex_t *mutex;
+    int next_tile;
+    int next_worker;
+} workload_t;
+
+static void process_tiles(void *workload_) {
+    workload_t *workload = (workload_t*)workload_;
+    framebuffer_t *framebuffer = workload->framebuffer;
+    struct hiz *hiz = framebuffer->hiz;
+    int num_tiles = hiz->num_tiles_x * hiz->num_tiles_y;
+    void *shader_varyings = malloc(workload->sizeof_varyings * 3);
+    int worker;
+
+    mutex_lock(workload->mutex);
+    worker = workload->next_worker;
+    workload->next_worker += 1;
+    mutex_unlock(workload->mutex);
+    trace_begin_thread(workload->tilename, worker);
+
+    while (1) {
+        int tile_index;
+        mutex_lock(workload->mutex);
+        tile_index = workload->next_tile;
+        workload->next_tile += 1;
+        mutex_unlock(workload->mutex);
+        if (tile_index >= num_tiles) {
+            break;
+        } else {
+            int tile_x = tile_index % hiz->num_tiles_x;
+            int tile_y = tile_index / hiz->num_tiles_x;
+            workload->tilefunc(framebuffer, tile_x, tile_y, shader_varyings);
+        }
+    }
+
+    trace_end_thread(worker);
+    free(shader_varyings);
+}
+
+static void dispatch_tiles(framebuffer_t *framebuffer, tilefunc_t *tilefunc,
+                           const char *tilename, int sizeof_varyings) {
+    struct hiz *hiz = framebuffer->hiz;
+    int num_tiles = hiz->num_tiles_x * hiz->num_tiles_y;
+    int num_threads = min_integer(g_num_threads, num_tiles);
+    workload_t workload;
+
+    workload.framebuffer = framebuffer;
+    workload.tilefunc = tilefunc;
+    workload.tilename = tilename;
+    workload.sizeof_varyings = sizeof_varyings;
+    workload.mutex = mutex_create();
+    workload.next_tile = 0;
+    workload.next_worker = 0;
+
+    workers_run(process_tiles, &workload, num_threads);
+    mutex_release(workload.mutex);
+}
+
+void graphics_flush(framebuffer_t *framebuffer) {
+    struct bins *bins = framebuffer->bins;
+    if (bins != NULL && darray_size(bins->records) > 0) {
+        int num_tiles = bins->num_tiles_x * bins->num_tiles_y;
+        int i;
+
+        trace_begin("graphics_flush");
+        dispatch_tiles(framebuffer, rasterize_tile, "rasterize_tile",
+                       bins->max_sizeof_varyings);
+
+        for (i = 0; i < num_tiles; i++) {
+            darray_clear(bins->tiles[i]);
+        }
+        darray_clear(bins->records);
+        trace_end();
+    }
+}
+
+static int store_visible_triangle(framebuffer_t *framebuffer,
+                                  program_t *program, triangle_t *triangle,
+                                  void *varyings[3]) {
+    struct visibility *visibility;
+    int offset;
+
+    if (framebuffer->visibility == NULL) {
+        framebuffer->visibility = create_visibility(framebuffer->width,
+                                                    framebuffer->height);
+    }
+    visibility = framebuffer->visibility;
+
+    offset = push_record(&visibility->records, program, triangle, varyings);
+    darray_push(visibility->offsets, offset);
+    if (program->sizeof_varyings > visibility->max_sizeof_varyings) {
+        visibility->max_sizeof_varyings = program->sizeof_varyings;
+    }
+    return darray_size(visibility->offsets) - 1;
+}
+
+static void resolve_tile(framebuffer_t *framebuffer, int tile_x, int tile_y,
+                         void *shader_varyings) {
+    struct visibility *visibility = framebuffer->visibility;
+    int width = framebuffer->width;
+    int min_x = tile_x * TILE_SIZE;
+    int min_y = tile_y * TILE_SIZE;
+    int max_x = min_integer(min_x + TILE_SIZE, width);
+    int max_y = min_integer(min_y + TILE_SIZE, framebuffer->height);
+    int x, y;
+#ifdef GRAPHICS_STATS
+    stats_t *stats = get_tile_stats(framebuffer, min_x, min_y);
+    double start_clock = platform_get_clock();
+#endif
+
+    for (y = min_y; y < max_y; y++) {
+        for (x = min_x; x < max_x; x++) {
+            int index = y * width + x;
+            int id = visibility->ids[index];
+            if (id >= 0) {
+                void *varyings[3];
+                int offset = visibility->offsets[id];
+                record_t *record = get_record(visibility->records, offset,
+                                              varyings);
+                program_t *program = record->program;
+                triangle_t *triangle = &record->triangle;
+                float weight1 = visibility->weights[index * 2 + 0];
+                float weight2 = visibility->weights[index * 2 + 1];
+                float weight0 = 1 - weight1 - weight2;
+                vec3_t weights = vec3_new(weight0, weight1, weight2);
+                float depth = framebuffer->depth_buffer[index];
+
+                prepare_varyings(program, triangle, varyings,
+                                 shader_varyings, weights);
+                draw_fragment(framebuffer, program, shader_varyings,
+                              triangle->backface, index, depth, 0);
+                visibility->ids[index] = -1;
+            }
+        }
+    }
+#ifdef GRAPHICS_STATS
+    stats->fragment_time += platform_get_clock() - start_clock;
+#endif
+}
+
+void graphics_resolve_visibility(framebuffer_t *framebuffer) {
+    struct visibility *visibility = framebuffer->visibility;
+    graphics_flush(framebuffer);
+    if (visibility != NULL && darray_size(visibility->offsets) > 0) {
+        trace_begin("graphics_resolve_visibility");
+        dispatch_tiles(framebuffer, resolve_tile, "resolve_tile",
+                       visibility->max_sizeof_varyings);
+        darray_clear(visibility->records);
+        darray_clear(visibility->offsets);
+        trace_end();
+    }
+}
+
+void graphics_set_num_threads(int num_threads) {
+    g_num_threads = min_integer(max_integer(num_threads, 1), MAX_THREADS);
+    workers_start(g_num_threads);
+}
+
+int graphics_get_num_threads(void) {
+    return g_num_threads;
+}
+
+void graphics_reset_stats(void) {
+#ifdef GRAPHICS_STATS
+    int i;
+    memset(&g_stats, 0, sizeof(stats_t));
+    for (i = 0; i < g_num_tile_stats; i++) {
+        memset(&g_tile_stats[i].stats, 0, sizeof(stats_t));
+    }
+#endif
+}
+
+/*
+ * the statistics add up from the last reset, so those of a frame are taken
+ * after resetting at its start, and those of a draw call as the difference
+ * around the call followed by a flush, they are all zero unless the
+ * pipeline is compiled with GRAPHICS_STATS
+ */
+stats_t graphics_get_stats(void) {
+    stats_t stats;
+#ifdef GRAPHICS_STATS
+    int i;
+    stats = g_stats;
+    for (i = 0; i < g_num_tile_stats; i++) {
+        add_stats(&stats, &g_tile_stats[i].stats);
+    }
+#else
+    memset(&stats, 0, sizeof(stats_t));
+#endif
+    return stats;
+}
+
+static void assemble_triangles(framebuffer_t *framebuffer, program_t *program,
+                               vec4_t **coords, void **varyings,
+                               int num_vertices) {
+    int i;
     for (i = 0; i < num_vertices - 2; i++) {
         int index0 = 0;
         int index1 = i + 1;
         int index2 = i + 2;
         vec4_t clip_coords[3];
-        void *varyings[3];
-        int is_culled;
+        void *triangle_varyings[3];
+        triangle_t triangle;
+        int is_culled, is_occluded;
+#ifdef GRAPHICS_STATS
+        double start_clock = platform_get_clock();
+#endif
 
-        clip_coords[0] = program->out_coords[index0];
-        clip_coords[1] = program->out_coords[index1];
-        clip_coords[2] = program->out_coords[index2];
-        varyings[0] = program->out_varyings[index0];
-        varyings[1] = program->out_varyings[index1];
-        varyings[2] = program->out_varyings[index2];
+        clip_coords[0] = *coords[index0];
+        clip_coords[1] = *coords[index1];
+        clip_coords[2] = *coords[index2];
+        triangle_varyings[0] = varyings[index0];
+        triangle_varyings[1] = varyings[index1];
+        triangle_varyings[2] = varyings[index2];
 
-        is_culled = rasterize_triangle(framebuffer, program,
-                                       clip_coords, varyings);
+        is_culled = setup_triangle(framebuffer, program,
+                                   clip_coords, &triangle);
+        is_occluded = !is_culled
+                      && is_triangle_occluded(framebuffer->hiz, &triangle);
+#ifdef GRAPHICS_STATS
+        /* the fan of a clipped triangle is planar and faces one way */
+        g_stats.num_backfacing += is_culled;
+        g_stats.num_occluded += is_occluded;
+        g_stats.clip_time += platform_get_clock() - start_clock;
+#endif
         if (is_culled) {
             break;
         }
+        if (is_occluded) {
+            continue;
+        }
+        if (triangle.depth_mode == DEPTH_VISIBILITY) {
+            triangle.id = store_visible_triangle(framebuffer, program,
+                                                 &triangle,
+                                                 triangle_varyings);
+        }
+
+        /* triangle rasterization */
+        if (g_num_threads > 1) {
+#ifdef GRAPHICS_STATS
+            start_clock = platform_get_clock();
+            bin_triangle(framebuffer, program, &triangle, triangle_varyings);
+            g_stats.raster_time += platform_get_clock() - start_clock;
+#else
+            bin_triangle(framebuffer, program, &triangle, triangle_varyings);
+#endif
+        } else {
+            rasterize_triangle(framebuffer, program, &triangle,
+                               triangle_varyings, program->shader_varyings,
+                               triangle.bbox);
+        }
+    }
+}
+
+static void clip_and_assemble(framebuffer_t *framebuffer, program_t *program) {
+    vec4_t *coords[MAX_VARYINGS];
+    int num_vertices;
+    int i;
+#ifdef GRAPHICS_STATS
+    double start_clock = platform_get_clock();
+#endif
+
+    /* triangle clipping */
+    num_vertices = clip_triangle(program->sizeof_varyings,
+                                 program->in_coords, program->in_varyings,
+                                 program->out_coords, program->out_varyings);
+#ifdef GRAPHICS_STATS
+    g_stats.num_outside += num_vertices < 3;
+    g_stats.clip_time += platform_get_clock() - start_clock;
+#endif
+
+    /* triangle assembly */
+    for (i = 0; i < num_vertices; i++) {
+        coords[i] = &program->out_coords[i];
+    }
+    assemble_triangles(framebuffer, program, coords, program->out_varyings,
+                       num_vertices);
+}
+
+void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program) {
+    int i;
+#ifdef GRAPHICS_STATS
+    double start_clock = platform_get_clock();
+    g_stats.num_triangles += 1;
+#endif
+
+    /* execute vertex shader */
+    for (i = 0; i < 3; i++) {
+        vec4_t clip_coord = program->vertex_shader(program->shader_attribs[i],
+                                                   program->in_varyings[i],
+                                                   program->shader_uniforms);
+        program->in_coords[i] = clip_coord;
+    }
+#ifdef GRAPHICS_STATS
+    g_stats.vertex_time += platform_get_clock() - start_clock;
+#endif
+
+    clip_and_assemble(framebuffer, program);
+}
+
+/*
+ * for post-transform vertex caching, see
+ * https://fgiesen.wordpress.com/2011/07/03/a-trip-through-the-graphics-pipeline-2011-part-3/
+ *
+ * the attributes of each vertex of an indexed draw are fetched from the
+ * source by the fetcher, which may decode them from a compact layout, the
+ * vertex shader is executed at most once per vertex of the draw, and the
+ * results are kept in a buffer owned by the program, the outcode of
+ * each vertex is kept as well, so that triangles outside a clipping plane
+ * are rejected and triangles inside all of them skip the clipper
+ */
+
+#define VERTEX_SHADED 0x80
+
+static void reserve_vertices(program_t *program, int num_vertices) {
+    if (num_vertices > program->max_vertices) {
+        int sizeof_varyings = program->sizeof_varyings;
+        free(program->vertex_coords);
+        free(program->vertex_codes);
+        free(program->vertex_varyings);
+        program->vertex_coords = (vec4_t*)malloc(
+            sizeof(vec4_t) * num_vertices);
+        program->vertex_codes = (unsigned char*)malloc(num_vertices);
+        program->vertex_varyings = (unsigned char*)malloc(
+            sizeof_varyings * num_vertices);
+        program->max_vertices = num_vertices;
+    }
+    memset(program->vertex_codes, 0, num_vertices);
+}
+
+static int shade_vertex(program_t *program, vertex_fetcher_t *fetcher,
+                        void *source, int index) {
+    int code = program->vertex_codes[index];
+    if (code == 0) {
+        int sizeof_varyings = program->sizeof_varyings;
+        void *attribs = program->shader_attribs[0];
+        void *varyings = program->vertex_varyings + index * sizeof_varyings;
+        vec4_t clip_coord;
+#ifdef GRAPHICS_STATS
+        double start_clock = platform_get_clock();
+#endif
+        fetcher(source, index, attribs);
+        clip_coord = program->vertex_shader(attribs, varyings,
+                                            program->shader_uniforms);
+        code = get_outside_code(clip_coord) | VERTEX_SHADED;
+        program->vertex_coords[index] = clip_coord;
+        program->vertex_codes[index] = (unsigned char)code;
+#ifdef GRAPHICS_STATS
+        g_stats.vertex_time += platform_get_clock() - start_clock;
+#endif
+    }
+    return code & ~VERTEX_SHADED;
+}
+
+static int fetch_index(void *indices, int index_size, int nth_index) {
+    if (indices == NULL) {
+        return nth_index;
+    } else if (index_size == sizeof(unsigned short)) {
+        return ((unsigned short*)indices)[nth_index];
+    } else {
+        assert(index_size == sizeof(unsigned int));
+        return (int)((unsigned int*)indices)[nth_index];
+    }
+}
+
+void graphics_draw_indexed(framebuffer_t *framebuffer, program_t *program,
+                           vertex_fetcher_t *fetcher, void *source,
+                           int num_vertices, void *indices, int index_size,
+                           int num_indices) {
+    int sizeof_varyings = program->sizeof_varyings;
+    int num_triangles;
+    int i, j;
+
+    if (indices == NULL) {
+        num_indices = num_vertices;
+    }
+    assert(num_vertices > 0 && num_indices % 3 == 0);
+    trace_begin("graphics_draw_indexed");
+    reserve_vertices(program, num_vertices);
+
+    num_triangles = num_indices / 3;
+#ifdef GRAPHICS_STATS
+    g_stats.num_triangles += num_triangles;
+#endif
+    for (i = 0; i < num_triangles; i++) {
+        vec4_t *coords[3];
+        void *varyings[3];
+        int and_code = ~0;
+        int or_code = 0;
+
+        for (j = 0; j < 3; j++) {
+            int index = fetch_index(indices, index_size, i * 3 + j);
+            int code;
+            assert(index >= 0 && index < num_vertices);
+            code = shade_vertex(program, fetcher, source, index);
+            and_code &= code;
+            or_code |= code;
+            coords[j] = &program->vertex_coords[index];
+            varyings[j] = program->vertex_varyings + index * sizeof_varyings;
+        }
+
+        if (and_code != 0) {
+            /* all the vertices are outside the same plane */
+#ifdef GRAPHICS_STATS
+            g_stats.num_outside += 1;
+#endif
+            continue;
+        } else if (or_code == 0) {
+            assemble_triangles(framebuffer, program, coords, varyings, 3);
+        } else {
+            for (j = 0; j < 3; j++) {
+                program->in_coords[j] = *coords[j];
+                memcpy(program->in_varyings[j], varyings[j], sizeof_varyings);
+            }
+            clip_and_assemble(framebuffer, program);
+        }
     }
+    trace_end();
 }
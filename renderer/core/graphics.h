@@ -7,9 +7,42 @@ typedef struct {
     int width, height;
     unsigned char *color_buffer;
     float *depth_buffer;
+    /* for hierarchical depth testing */
+    struct hiz *hiz;
+    /* for binned rasterization */
+    struct bins *bins;
+    /* for visibility buffer */
+    struct visibility *visibility;
 } framebuffer_t;
 
 typedef struct program program_t;
+typedef enum {
+    DEPTH_DEFAULT,    /* shade and write fragments passing the <= test */
+    DEPTH_ONLY,       /* write depth of fragments passing the <= test */
+    DEPTH_EQUAL,      /* shade fragments with the stored depth, no writes */
+    DEPTH_VISIBILITY  /* write depth, triangle ids and barycentrics */
+} depth_mode_t;
+typedef void vertex_fetcher_t(void *source, int index, void *attribs);
+typedef struct {
+    /* triangles */
+    int num_triangles;       /* submitted by draw calls */
+    int num_clipped;         /* not trivially accepted by the clipper */
+    int num_outside;         /* entirely outside the view frustum */
+    int num_backfacing;      /* back-face culled */
+    int num_degenerate;      /* zero area after snapping */
+    int num_occluded;        /* rejected by hierarchical depth at setup */
+    /* fragments */
+    int num_tested;          /* covered and depth tested */
+    int num_depth_rejected;  /* failing the depth test */
+    int num_shaded;          /* fragment shader invocations */
+    int num_discarded;       /* discarded by fragment shaders */
+    int num_blended;         /* blended into the color buffer */
+    /* stage timers, in seconds summed over the threads */
+    double vertex_time;      /* vertex fetching and shading */
+    double clip_time;        /* clipping, culling and triangle setup */
+    double raster_time;      /* binning, coverage and depth testing */
+    double fragment_time;    /* fragment shading and writes */
+} stats_t;
 typedef vec4_t vertex_shader_t(void *attribs, void *varyings, void *uniforms);
 typedef vec4_t fragment_shader_t(void *varyings, void *uniforms,
                                  int *discard, int backface);
@@ -28,8 +61,24 @@ program_t *program_create(
 void program_release(program_t *program);
 void *program_get_attribs(program_t *program, int nth_vertex);
 void *program_get_uniforms(program_t *program);
+void program_set_depth_mode(program_t *program, depth_mode_t depth_mode);
+void program_set_derivatives(program_t *program, int derivatives);
 
-/* graphics pipeline */
+/*
+ * graphics pipeline, with several threads the triangles are shaded when the
+ * framebuffer is flushed, so the uniforms of a program must stay unchanged
+ * from its draws until then
+ */
 void graphics_draw_triangle(framebuffer_t *framebuffer, program_t *program);
+void graphics_draw_indexed(framebuffer_t *framebuffer, program_t *program,
+                           vertex_fetcher_t *fetcher, void *source,
+                           int num_vertices, void *indices, int index_size,
+                           int num_indices);
+void graphics_flush(framebuffer_t *framebuffer);
+void graphics_resolve_visibility(framebuffer_t *framebuffer);
+void graphics_set_num_threads(int num_threads);
+int graphics_get_num_threads(void);
+void graphics_reset_stats(void);
+stats_t graphics_get_stats(void);
 
 #endif
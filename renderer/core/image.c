@@ -7,6 +7,7 @@
 #include "macro.h"
 #include "maths.h"
 #include "private.h"
+#include "trace.h"
 
 /* image creating/releasing */
 
@@ -49,14 +50,18 @@ static image_t *load_hdr_image(const char *filename);
 
 image_t *image_load(const char *filename) {
     const char *extension = private_get_extension(filename);
+    image_t *image;
+    trace_begin_file("image_load", filename);
     if (strcmp(extension, "tga") == 0) {
-        return load_tga_image(filename);
+        image = load_tga_image(filename);
     } else if (strcmp(extension, "hdr") == 0) {
-        return load_hdr_image(filename);
+        image = load_hdr_image(filename);
     } else {
         assert(0);
-        return NULL;
+        image = NULL;
     }
+    trace_end();
+    return image;
 }
 
 static void save_tga_image(image_t *image, const char *filename);
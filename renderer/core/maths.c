@@ -34,6 +34,56 @@ unsigned char float_to_uchar(float value) {
     return (unsigned char)(value * 255);
 }
 
+/*
+ * for half-precision floating-point format, see
+ * https://en.wikipedia.org/wiki/Half-precision_floating-point_format
+ */
+
+typedef union {float f; unsigned int u;} floatbits_t;
+
+float float_from_half(unsigned short value) {
+    unsigned int sign = (unsigned int)(value & 0x8000) << 16;
+    unsigned int exponent = (value >> 10) & 0x1F;
+    unsigned int mantissa = value & 0x3FF;
+    floatbits_t bits;
+    if (exponent == 0) {                    /* zero or subnormal */
+        float magnitude = (float)mantissa * (1.0f / 16777216);
+        return sign ? -magnitude : magnitude;
+    } else if (exponent == 31) {            /* infinity or nan */
+        bits.u = sign | 0x7F800000 | (mantissa << 13);
+    } else {
+        bits.u = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    return bits.f;
+}
+
+unsigned short float_to_half(float value) {
+    floatbits_t bits;
+    unsigned int sign, exponent, mantissa;
+    bits.f = value;
+    sign = (bits.u >> 16) & 0x8000;
+    exponent = (bits.u >> 23) & 0xFF;
+    mantissa = bits.u & 0x7FFFFF;
+    if (exponent == 0xFF) {                 /* infinity or nan */
+        return (unsigned short)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    } else if (exponent > 142) {            /* overflow */
+        return (unsigned short)(sign | 0x7C00);
+    } else if (exponent < 102) {            /* underflow */
+        return (unsigned short)sign;
+    } else if (exponent < 113) {            /* subnormal */
+        unsigned int shift = 126 - exponent;
+        unsigned int half;
+        mantissa |= 0x800000;
+        half = mantissa >> shift;
+        half += (mantissa >> (shift - 1)) & 1;  /* round to nearest */
+        return (unsigned short)(sign | half);
+    } else {
+        unsigned int half = ((exponent - 112) << 10) | (mantissa >> 13);
+        half += (mantissa >> 12) & 1;           /* round to nearest */
+        return (unsigned short)(sign | half);
+    }
+}
+
 float float_srgb2linear(float value) {
     return (float)pow(value, 2.2);
 }
@@ -315,6 +365,39 @@ quat_t quat_slerp(quat_t a, quat_t b, float t) {
     }
 }
 
+/*
+ * for matrix to quaternion conversion, see
+ * https://www.euclideanspace.com/maths/geometry/rotations/conversions/matrixToQuaternion/
+ */
+quat_t quat_from_mat3(mat3_t m) {
+    float trace = m.m[0][0] + m.m[1][1] + m.m[2][2];
+    if (trace > 0) {
+        float s = (float)sqrt(trace + 1) * 2;
+        return quat_new((m.m[2][1] - m.m[1][2]) / s,
+                        (m.m[0][2] - m.m[2][0]) / s,
+                        (m.m[1][0] - m.m[0][1]) / s,
+                        s / 4);
+    } else if (m.m[0][0] > m.m[1][1] && m.m[0][0] > m.m[2][2]) {
+        float s = (float)sqrt(1 + m.m[0][0] - m.m[1][1] - m.m[2][2]) * 2;
+        return quat_new(s / 4,
+                        (m.m[0][1] + m.m[1][0]) / s,
+                        (m.m[0][2] + m.m[2][0]) / s,
+                        (m.m[2][1] - m.m[1][2]) / s);
+    } else if (m.m[1][1] > m.m[2][2]) {
+        float s = (float)sqrt(1 + m.m[1][1] - m.m[0][0] - m.m[2][2]) * 2;
+        return quat_new((m.m[0][1] + m.m[1][0]) / s,
+                        s / 4,
+                        (m.m[1][2] + m.m[2][1]) / s,
+                        (m.m[0][2] - m.m[2][0]) / s);
+    } else {
+        float s = (float)sqrt(1 + m.m[2][2] - m.m[0][0] - m.m[1][1]) * 2;
+        return quat_new((m.m[0][2] + m.m[2][0]) / s,
+                        (m.m[1][2] + m.m[2][1]) / s,
+                        s / 4,
+                        (m.m[1][0] - m.m[0][1]) / s);
+    }
+}
+
 void quat_print(const char *name, quat_t q) {
     printf("quat %s =\n", name);
     printf("    %12f    %12f    %12f    %12f\n", q.x, q.y, q.z, q.w);
@@ -16,6 +16,8 @@ float float_clamp(float f, float min, float max);
 float float_saturate(float f);
 float float_from_uchar(unsigned char value);
 unsigned char float_to_uchar(float value);
+float float_from_half(unsigned short value);
+unsigned short float_to_half(float value);
 float float_srgb2linear(float value);
 float float_linear2srgb(float value);
 float float_aces(float value);
@@ -70,6 +72,7 @@ float quat_dot(quat_t a, quat_t b);
 float quat_length(quat_t q);
 quat_t quat_normalize(quat_t q);
 quat_t quat_slerp(quat_t a, quat_t b, float t);
+quat_t quat_from_mat3(mat3_t m);
 void quat_print(const char *name, quat_t q);
 
 /* mat3 related functions */
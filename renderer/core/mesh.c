@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,15 +8,95 @@
 #include "maths.h"
 #include "mesh.h"
 #include "private.h"
+#include "trace.h"
+
+typedef struct {
+    unsigned short position[3];  /* unorm16 within the bounding box */
+    unsigned short texcoord[2];  /* unorm16 within the texcoord range */
+    short normal[2];             /* octahedral snorm16 */
+    short tangent[2];            /* octahedral snorm16, handedness in lsb */
+    unsigned char joint[4];
+    unsigned char weight[4];     /* unorm8 */
+} packed_t;
 
 struct mesh {
     int num_faces;
+    int num_vertices;
     vertex_t *vertices;
+    packed_t *packed;
+    int index_size;
+    void *indices;
+    vec3_t bbox_min, bbox_max;
+    vec2_t texcoord_min, texcoord_max;
     vec3_t center;
 };
 
 /* mesh loading/releasing */
 
+/*
+ * for vertex deduplication, see
+ * https://en.wikipedia.org/wiki/Open_addressing
+ *
+ * the tangent, joint and weight of a vertex are looked up by its position
+ * index, so a vertex is identified by its (position, texcoord, normal)
+ * index triple, the triples are hashed into an open-addressing table
+ * mapping them to the unique vertices, which are referenced by 16-bit
+ * indices if there are few enough of them, or by 32-bit indices otherwise
+ */
+
+typedef struct {int position, texcoord, normal;} triple_t;
+
+static unsigned int hash_triple(triple_t triple) {
+    unsigned int hash = (unsigned int)triple.position * 73856093u;
+    hash ^= (unsigned int)triple.texcoord * 19349663u;
+    hash ^= (unsigned int)triple.normal * 83492791u;
+    return hash;
+}
+
+static int find_or_add_triple(triple_t triple, int *slots, int num_slots,
+                              triple_t **triples) {
+    unsigned int mask = (unsigned int)num_slots - 1;
+    unsigned int slot = hash_triple(triple) & mask;
+    while (1) {
+        int index = slots[slot];
+        if (index < 0) {
+            slots[slot] = darray_size(*triples);
+            darray_push(*triples, triple);
+            return slots[slot];
+        } else {
+            triple_t other = (*triples)[index];
+            if (other.position == triple.position
+                    && other.texcoord == triple.texcoord
+                    && other.normal == triple.normal) {
+                return index;
+            }
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+static void *build_indices(int *vertex_indices, int num_indices,
+                           int num_vertices, int *index_size) {
+    int i;
+    if (num_vertices <= 65536) {
+        unsigned short *indices;
+        indices = (unsigned short*)malloc(sizeof(unsigned short) * num_indices);
+        for (i = 0; i < num_indices; i++) {
+            indices[i] = (unsigned short)vertex_indices[i];
+        }
+        *index_size = sizeof(unsigned short);
+        return indices;
+    } else {
+        unsigned int *indices;
+        indices = (unsigned int*)malloc(sizeof(unsigned int) * num_indices);
+        for (i = 0; i < num_indices; i++) {
+            indices[i] = (unsigned int)vertex_indices[i];
+        }
+        *index_size = sizeof(unsigned int);
+        return indices;
+    }
+}
+
 static mesh_t *build_mesh(
         vec3_t *positions, vec2_t *texcoords, vec3_t *normals,
         vec4_t *tangents, vec4_t *joints, vec4_t *weights,
@@ -24,6 +105,11 @@ static mesh_t *build_mesh(
     vec3_t bbox_max = vec3_new(-1e6, -1e6, -1e6);
     int num_indices = darray_size(position_indices);
     int num_faces = num_indices / 3;
+    triple_t *triples = NULL;
+    int *vertex_indices;
+    int num_vertices;
+    int num_slots;
+    int *slots;
     vertex_t *vertices;
     mesh_t *mesh;
     int i;
@@ -33,11 +119,31 @@ static mesh_t *build_mesh(
     assert(darray_size(texcoord_indices) == num_indices);
     assert(darray_size(normal_indices) == num_indices);
 
-    vertices = (vertex_t*)malloc(sizeof(vertex_t) * num_indices);
+    num_slots = 1;
+    while (num_slots < num_indices * 2) {
+        num_slots *= 2;
+    }
+    slots = (int*)malloc(sizeof(int) * num_slots);
+    for (i = 0; i < num_slots; i++) {
+        slots[i] = -1;
+    }
+    vertex_indices = (int*)malloc(sizeof(int) * num_indices);
     for (i = 0; i < num_indices; i++) {
-        int position_index = position_indices[i];
-        int texcoord_index = texcoord_indices[i];
-        int normal_index = normal_indices[i];
+        triple_t triple;
+        triple.position = position_indices[i];
+        triple.texcoord = texcoord_indices[i];
+        triple.normal = normal_indices[i];
+        vertex_indices[i] = find_or_add_triple(triple, slots, num_slots,
+                                               &triples);
+    }
+    num_vertices = darray_size(triples);
+    free(slots);
+
+    vertices = (vertex_t*)malloc(sizeof(vertex_t) * num_vertices);
+    for (i = 0; i < num_vertices; i++) {
+        int position_index = triples[i].position;
+        int texcoord_index = triples[i].texcoord;
+        int normal_index = triples[i].normal;
         assert(position_index >= 0 && position_index < darray_size(positions));
         assert(texcoord_index >= 0 && texcoord_index < darray_size(texcoords));
         assert(normal_index >= 0 && normal_index < darray_size(normals));
@@ -72,11 +178,19 @@ static mesh_t *build_mesh(
         bbox_min = vec3_min(bbox_min, vertices[i].position);
         bbox_max = vec3_max(bbox_max, vertices[i].position);
     }
+    darray_free(triples);
 
     mesh = (mesh_t*)malloc(sizeof(mesh_t));
     mesh->num_faces = num_faces;
+    mesh->num_vertices = num_vertices;
     mesh->vertices = vertices;
+    mesh->packed = NULL;
+    mesh->indices = build_indices(vertex_indices, num_indices, num_vertices,
+                                  &mesh->index_size);
+    mesh->bbox_min = bbox_min;
+    mesh->bbox_max = bbox_max;
     mesh->center = vec3_div(vec3_add(bbox_min, bbox_max), 2);
+    free(vertex_indices);
 
     return mesh;
 }
@@ -172,27 +286,237 @@ static mesh_t *load_obj(const char *filename) {
 
 mesh_t *mesh_load(const char *filename) {
     const char *extension = private_get_extension(filename);
+    mesh_t *mesh;
+    trace_begin_file("mesh_load", filename);
     if (strcmp(extension, "obj") == 0) {
-        return load_obj(filename);
+        mesh = load_obj(filename);
     } else {
         assert(0);
-        return NULL;
+        mesh = NULL;
     }
+    trace_end();
+    return mesh;
 }
 
 void mesh_release(mesh_t *mesh) {
     free(mesh->vertices);
+    free(mesh->packed);
+    free(mesh->indices);
     free(mesh);
 }
 
+/*
+ * for vertex quantization, see
+ * http://jcgt.org/published/0003/02/01/
+ *
+ * a packed vertex takes 26 bytes instead of 80, the position and the
+ * texcoord are quantized within the ranges spanned by the mesh, which is
+ * finer than half floats for texcoords near one, the normal and the
+ * tangent are octahedral-encoded, the handedness of the tangent frame is
+ * kept in the lowest bit of the tangent, and the weights are rounded so
+ * that they still sum to one, meshes with more than 256 joints are left
+ * unpacked
+ */
+
+static unsigned short quantize_unorm16(float value, float min, float max) {
+    float ratio = max > min ? (value - min) / (max - min) : 0;
+    return (unsigned short)(float_saturate(ratio) * 65535 + 0.5f);
+}
+
+static float dequantize_unorm16(unsigned short value, float min, float max) {
+    return min + (max - min) * ((float)value / 65535);
+}
+
+static short quantize_snorm16(float value) {
+    float scaled = float_clamp(value, -1, 1) * 32767;
+    return (short)(scaled < 0 ? scaled - 0.5f : scaled + 0.5f);
+}
+
+static float sign_nonzero(float value) {
+    return value < 0 ? -1.0f : 1.0f;
+}
+
+static void encode_octahedral(vec3_t v, short encoded[2]) {
+    float sum = (float)(fabs(v.x) + fabs(v.y) + fabs(v.z));
+    float x = sum > 0 ? v.x / sum : 0;
+    float y = sum > 0 ? v.y / sum : 0;
+    if (v.z < 0) {
+        float folded_x = (1 - (float)fabs(y)) * sign_nonzero(x);
+        float folded_y = (1 - (float)fabs(x)) * sign_nonzero(y);
+        x = folded_x;
+        y = folded_y;
+    }
+    encoded[0] = quantize_snorm16(x);
+    encoded[1] = quantize_snorm16(y);
+}
+
+static vec3_t decode_octahedral(const short encoded[2]) {
+    float x = (float)encoded[0] / 32767;
+    float y = (float)encoded[1] / 32767;
+    float z = 1 - (float)fabs(x) - (float)fabs(y);
+    if (z < 0) {
+        float unfolded_x = (1 - (float)fabs(y)) * sign_nonzero(x);
+        float unfolded_y = (1 - (float)fabs(x)) * sign_nonzero(y);
+        x = unfolded_x;
+        y = unfolded_y;
+    }
+    return vec3_normalize(vec3_new(x, y, z));
+}
+
+static void quantize_weights(vec4_t weight, unsigned char quantized[4]) {
+    float weights[4];
+    int largest = 0;
+    int sum = 0;
+    int i;
+
+    weights[0] = weight.x;
+    weights[1] = weight.y;
+    weights[2] = weight.z;
+    weights[3] = weight.w;
+    for (i = 0; i < 4; i++) {
+        quantized[i] = (unsigned char)(float_saturate(weights[i]) * 255 + 0.5f);
+        sum += quantized[i];
+        if (weights[i] > weights[largest]) {
+            largest = i;
+        }
+    }
+    if (sum > 0) {
+        int adjusted = quantized[largest] + 255 - sum;
+        quantized[largest] = (unsigned char)(adjusted < 0 ? 0 : adjusted);
+    }
+}
+
+static void pack_vertex(mesh_t *mesh, vertex_t *vertex, packed_t *packed) {
+    vec3_t min = mesh->bbox_min;
+    vec3_t max = mesh->bbox_max;
+    vec2_t uv_min = mesh->texcoord_min;
+    vec2_t uv_max = mesh->texcoord_max;
+    vec3_t tangent = vec3_from_vec4(vertex->tangent);
+
+    packed->position[0] = quantize_unorm16(vertex->position.x, min.x, max.x);
+    packed->position[1] = quantize_unorm16(vertex->position.y, min.y, max.y);
+    packed->position[2] = quantize_unorm16(vertex->position.z, min.z, max.z);
+    packed->texcoord[0] = quantize_unorm16(vertex->texcoord.x,
+                                           uv_min.x, uv_max.x);
+    packed->texcoord[1] = quantize_unorm16(vertex->texcoord.y,
+                                           uv_min.y, uv_max.y);
+    encode_octahedral(vertex->normal, packed->normal);
+    encode_octahedral(tangent, packed->tangent);
+    packed->tangent[1] = (short)(packed->tangent[1] & ~1);
+    if (vertex->tangent.w < 0) {
+        packed->tangent[1] = (short)(packed->tangent[1] | 1);
+    }
+    packed->joint[0] = (unsigned char)vertex->joint.x;
+    packed->joint[1] = (unsigned char)vertex->joint.y;
+    packed->joint[2] = (unsigned char)vertex->joint.z;
+    packed->joint[3] = (unsigned char)vertex->joint.w;
+    quantize_weights(vertex->weight, packed->weight);
+}
+
+static vertex_t unpack_vertex(mesh_t *mesh, packed_t *packed) {
+    vec3_t min = mesh->bbox_min;
+    vec3_t max = mesh->bbox_max;
+    vec2_t uv_min = mesh->texcoord_min;
+    vec2_t uv_max = mesh->texcoord_max;
+    vertex_t vertex;
+    float handedness = (packed->tangent[1] & 1) ? -1.0f : 1.0f;
+
+    vertex.position.x = dequantize_unorm16(packed->position[0], min.x, max.x);
+    vertex.position.y = dequantize_unorm16(packed->position[1], min.y, max.y);
+    vertex.position.z = dequantize_unorm16(packed->position[2], min.z, max.z);
+    vertex.texcoord.x = dequantize_unorm16(packed->texcoord[0],
+                                           uv_min.x, uv_max.x);
+    vertex.texcoord.y = dequantize_unorm16(packed->texcoord[1],
+                                           uv_min.y, uv_max.y);
+    vertex.normal = decode_octahedral(packed->normal);
+    vertex.tangent = vec4_from_vec3(decode_octahedral(packed->tangent),
+                                    handedness);
+    vertex.joint = vec4_new(packed->joint[0], packed->joint[1],
+                            packed->joint[2], packed->joint[3]);
+    vertex.weight = vec4_new(float_from_uchar(packed->weight[0]),
+                             float_from_uchar(packed->weight[1]),
+                             float_from_uchar(packed->weight[2]),
+                             float_from_uchar(packed->weight[3]));
+    return vertex;
+}
+
+static int is_packable(vertex_t *vertex) {
+    vec4_t joint = vertex->joint;
+    return joint.x >= 0 && joint.x <= 255 && joint.y >= 0 && joint.y <= 255
+           && joint.z >= 0 && joint.z <= 255 && joint.w >= 0 && joint.w <= 255;
+}
+
+void mesh_pack_vertices(mesh_t *mesh) {
+    int num_vertices = mesh->num_vertices;
+    packed_t *packed;
+    int i;
+
+    if (mesh->packed != NULL) {
+        return;
+    }
+    for (i = 0; i < num_vertices; i++) {
+        if (!is_packable(&mesh->vertices[i])) {
+            return;
+        }
+    }
+    mesh->texcoord_min = vec2_new(+1e6, +1e6);
+    mesh->texcoord_max = vec2_new(-1e6, -1e6);
+    for (i = 0; i < num_vertices; i++) {
+        vec2_t texcoord = mesh->vertices[i].texcoord;
+        mesh->texcoord_min = vec2_min(mesh->texcoord_min, texcoord);
+        mesh->texcoord_max = vec2_max(mesh->texcoord_max, texcoord);
+    }
+    packed = (packed_t*)malloc(sizeof(packed_t) * num_vertices);
+    for (i = 0; i < num_vertices; i++) {
+        pack_vertex(mesh, &mesh->vertices[i], &packed[i]);
+    }
+    free(mesh->vertices);
+    mesh->vertices = NULL;
+    mesh->packed = packed;
+}
+
+int mesh_is_packed(mesh_t *mesh) {
+    return mesh->packed != NULL;
+}
+
 /* vertex retrieving */
 
 int mesh_get_num_faces(mesh_t *mesh) {
     return mesh->num_faces;
 }
 
-vertex_t *mesh_get_vertices(mesh_t *mesh) {
-    return mesh->vertices;
+int mesh_get_num_vertices(mesh_t *mesh) {
+    return mesh->num_vertices;
+}
+
+vertex_t mesh_get_vertex(mesh_t *mesh, int nth_vertex) {
+    assert(nth_vertex >= 0 && nth_vertex < mesh->num_vertices);
+    if (mesh->packed) {
+        return unpack_vertex(mesh, &mesh->packed[nth_vertex]);
+    } else {
+        return mesh->vertices[nth_vertex];
+    }
+}
+
+void *mesh_get_indices(mesh_t *mesh) {
+    return mesh->indices;
+}
+
+int mesh_get_index_size(mesh_t *mesh) {
+    return mesh->index_size;
+}
+
+vertex_t mesh_get_face_vertex(mesh_t *mesh, int nth_face, int nth_vertex) {
+    int nth_index = nth_face * 3 + nth_vertex;
+    int index;
+    assert(nth_face >= 0 && nth_face < mesh->num_faces);
+    assert(nth_vertex >= 0 && nth_vertex < 3);
+    if (mesh->index_size == sizeof(unsigned short)) {
+        index = ((unsigned short*)mesh->indices)[nth_index];
+    } else {
+        index = (int)((unsigned int*)mesh->indices)[nth_index];
+    }
+    return mesh_get_vertex(mesh, index);
 }
 
 vec3_t mesh_get_center(mesh_t *mesh) {
@@ -18,9 +18,17 @@ typedef struct {
 mesh_t *mesh_load(const char *filename);
 void mesh_release(mesh_t *mesh);
 
+/* vertex packing */
+void mesh_pack_vertices(mesh_t *mesh);
+int mesh_is_packed(mesh_t *mesh);
+
 /* vertex retrieving */
 int mesh_get_num_faces(mesh_t *mesh);
-vertex_t *mesh_get_vertices(mesh_t *mesh);
+int mesh_get_num_vertices(mesh_t *mesh);
+vertex_t mesh_get_vertex(mesh_t *mesh, int nth_vertex);
+void *mesh_get_indices(mesh_t *mesh);
+int mesh_get_index_size(mesh_t *mesh);
+vertex_t mesh_get_face_vertex(mesh_t *mesh, int nth_face, int nth_vertex);
 vec3_t mesh_get_center(mesh_t *mesh);
 
 #endif
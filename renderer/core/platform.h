@@ -4,6 +4,10 @@
 #include "graphics.h"
 
 typedef struct window window_t;
+typedef struct thread thread_t;
+typedef struct mutex mutex_t;
+typedef struct condition condition_t;
+typedef struct threadlocal threadlocal_t;
 typedef enum {KEY_A, KEY_D, KEY_S, KEY_W, KEY_SPACE, KEY_NUM} keycode_t;
 typedef enum {BUTTON_L, BUTTON_R, BUTTON_NUM} button_t;
 typedef struct {
@@ -11,6 +15,7 @@ typedef struct {
     void (*button_callback)(window_t *window, button_t button, int pressed);
     void (*scroll_callback)(window_t *window, float offset);
 } callbacks_t;
+typedef void threadfunc_t(void *userdata);
 
 /* platform initialization */
 void platform_initialize(void);
@@ -31,7 +36,26 @@ int input_button_pressed(window_t *window, button_t button);
 void input_query_cursor(window_t *window, float *xpos, float *ypos);
 void input_set_callbacks(window_t *window, callbacks_t callbacks);
 
+/* thread related functions */
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata);
+void thread_join(thread_t *thread);
+mutex_t *mutex_create(void);
+void mutex_release(mutex_t *mutex);
+void mutex_lock(mutex_t *mutex);
+void mutex_unlock(mutex_t *mutex);
+condition_t *condition_create(void);
+void condition_release(condition_t *condition);
+void condition_wait(condition_t *condition, mutex_t *mutex);
+void condition_signal(condition_t *condition);
+void condition_broadcast(condition_t *condition);
+threadlocal_t *threadlocal_create(void);
+void threadlocal_release(threadlocal_t *threadlocal);
+void threadlocal_set(threadlocal_t *threadlocal, void *value);
+void *threadlocal_get(threadlocal_t *threadlocal);
+
 /* misc platform functions */
 float platform_get_time(void);
+double platform_get_clock(void);
+int platform_get_num_cores(void);
 
 #endif
@@ -0,0 +1,262 @@
+#include <assert.h>
+#include <string.h>
+#include "raster.h"
+
+/*
+ * for simd rasterization, see
+ * https://fgiesen.wordpress.com/2013/02/10/optimizing-the-basic-rasterizer/
+ * https://software.intel.com/sites/landingpage/IntrinsicsGuide/
+ *
+ * a span is a horizontal run of up to 8 pixels, the kernels evaluate the
+ * edge functions, interpolate the depth and perform the early depth test
+ * for all of its pixels at once, and return a lane mask of the fragments
+ * that survive, the edge functions are evaluated in double lanes so that
+ * the coverage is exactly the same as that of the scalar kernel
+ */
+
+#if defined(__x86_64__) || defined(__i386__) \
+    || defined(_M_X64) || defined(_M_IX86)
+#define RASTER_X86
+#include <emmintrin.h>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+#ifdef GRAPHICS_STATS
+#define MERGE_LANES(coverage, passed)                                       \
+    (((coverage) & (passed)) | ((coverage) << SPAN_SIZE))
+#else
+#define MERGE_LANES(coverage, passed) ((coverage) & (passed))
+#endif
+
+typedef int kernel_t(span_t *span, float *depth_buffer, int is_inside,
+                     float depths[SPAN_SIZE]);
+
+static int test_span_scalar(span_t *span, float *depth_buffer, int is_inside,
+                            float depths[SPAN_SIZE]) {
+    int coverage = 0;
+    int passed = 0;
+    int i;
+    for (i = 0; i < SPAN_SIZE; i++) {
+        double value0 = span->values[0] + span->steps[0] * (double)i;
+        double value1 = span->values[1] + span->steps[1] * (double)i;
+        double value2 = span->values[2] + span->steps[2] * (double)i;
+        if (is_inside || (value0 >= 0 && value1 >= 0 && value2 >= 0)) {
+            float weight0 = (float)(value0 - span->biases[0]);
+            float weight1 = (float)(value1 - span->biases[1]);
+            float weight2 = (float)(value2 - span->biases[2]);
+            float depth0 = span->depths[0] * (weight0 * span->recip_area);
+            float depth1 = span->depths[1] * (weight1 * span->recip_area);
+            float depth2 = span->depths[2] * (weight2 * span->recip_area);
+            float depth = depth0 + depth1 + depth2;
+            coverage |= 1 << i;
+            if (depth <= depth_buffer[i]) {
+                depths[i] = depth;
+                passed |= 1 << i;
+            }
+        }
+    }
+    return MERGE_LANES(coverage, passed);
+}
+
+#ifdef RASTER_X86
+
+TARGET_SSE2
+static int test_span_sse2(span_t *span, float *depth_buffer, int is_inside,
+                          float depths[SPAN_SIZE]) {
+    __m128d zero = _mm_setzero_pd();
+    __m128d lo_offsets = _mm_set_pd(1, 0);
+    __m128d hi_offsets = _mm_set_pd(3, 2);
+    __m128 recip_area = _mm_set1_ps(span->recip_area);
+    int mask = 0;
+    int i, j;
+
+    for (i = 0; i < SPAN_SIZE; i += 4) {
+        __m128d lo_values[3], hi_values[3];
+        __m128 depth = _mm_setzero_ps();
+        int coverage = 0xF;
+        int passed;
+
+        for (j = 0; j < 3; j++) {
+            double value = span->values[j] + span->steps[j] * (double)i;
+            __m128d base = _mm_set1_pd(value);
+            __m128d step = _mm_set1_pd(span->steps[j]);
+            lo_values[j] = _mm_add_pd(base, _mm_mul_pd(step, lo_offsets));
+            hi_values[j] = _mm_add_pd(base, _mm_mul_pd(step, hi_offsets));
+            if (!is_inside) {
+                int lo_bits = _mm_movemask_pd(_mm_cmpge_pd(lo_values[j], zero));
+                int hi_bits = _mm_movemask_pd(_mm_cmpge_pd(hi_values[j], zero));
+                coverage &= lo_bits | (hi_bits << 2);
+            }
+        }
+        if (coverage == 0) {
+            continue;
+        }
+
+        for (j = 0; j < 3; j++) {
+            __m128d bias = _mm_set1_pd(span->biases[j]);
+            __m128 lo_weight = _mm_cvtpd_ps(_mm_sub_pd(lo_values[j], bias));
+            __m128 hi_weight = _mm_cvtpd_ps(_mm_sub_pd(hi_values[j], bias));
+            __m128 weight = _mm_movelh_ps(lo_weight, hi_weight);
+            weight = _mm_mul_ps(weight, recip_area);
+            weight = _mm_mul_ps(_mm_set1_ps(span->depths[j]), weight);
+            depth = _mm_add_ps(depth, weight);
+        }
+        passed = _mm_movemask_ps(_mm_cmple_ps(depth,
+                                              _mm_loadu_ps(depth_buffer + i)));
+        _mm_storeu_ps(depths + i, depth);
+        mask |= MERGE_LANES(coverage, passed) << i;
+    }
+
+    return mask;
+}
+
+TARGET_AVX2
+static int test_span_avx2(span_t *span, float *depth_buffer, int is_inside,
+                          float depths[SPAN_SIZE]) {
+    __m256d zero = _mm256_setzero_pd();
+    __m256d lo_offsets = _mm256_set_pd(3, 2, 1, 0);
+    __m256d hi_offsets = _mm256_set_pd(7, 6, 5, 4);
+    __m256 recip_area = _mm256_set1_ps(span->recip_area);
+    __m256d lo_values[3], hi_values[3];
+    __m256 depth = _mm256_setzero_ps();
+    int coverage = 0xFF;
+    int passed;
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        __m256d base = _mm256_set1_pd(span->values[i]);
+        __m256d step = _mm256_set1_pd(span->steps[i]);
+        lo_values[i] = _mm256_add_pd(base, _mm256_mul_pd(step, lo_offsets));
+        hi_values[i] = _mm256_add_pd(base, _mm256_mul_pd(step, hi_offsets));
+        if (!is_inside) {
+            __m256d lo_mask = _mm256_cmp_pd(lo_values[i], zero, _CMP_GE_OQ);
+            __m256d hi_mask = _mm256_cmp_pd(hi_values[i], zero, _CMP_GE_OQ);
+            int lo_bits = _mm256_movemask_pd(lo_mask);
+            int hi_bits = _mm256_movemask_pd(hi_mask);
+            coverage &= lo_bits | (hi_bits << 4);
+        }
+    }
+    if (coverage == 0) {
+        return 0;
+    }
+
+    for (i = 0; i < 3; i++) {
+        __m256d bias = _mm256_set1_pd(span->biases[i]);
+        __m128 lo_weight = _mm256_cvtpd_ps(_mm256_sub_pd(lo_values[i], bias));
+        __m128 hi_weight = _mm256_cvtpd_ps(_mm256_sub_pd(hi_values[i], bias));
+        __m256 weight = _mm256_castps128_ps256(lo_weight);
+        weight = _mm256_insertf128_ps(weight, hi_weight, 1);
+        weight = _mm256_mul_ps(weight, recip_area);
+        weight = _mm256_mul_ps(_mm256_set1_ps(span->depths[i]), weight);
+        depth = _mm256_add_ps(depth, weight);
+    }
+    passed = _mm256_movemask_ps(_mm256_cmp_ps(depth,
+                                              _mm256_loadu_ps(depth_buffer),
+                                              _CMP_LE_OQ));
+    _mm256_storeu_ps(depths, depth);
+
+    return MERGE_LANES(coverage, passed);
+}
+
+/*
+ * for cpu feature detection, see
+ * https://gcc.gnu.org/onlinedocs/gcc/x86-Built-in-Functions.html
+ * https://docs.microsoft.com/en-us/cpp/intrinsics/cpuid-cpuidex
+ */
+
+#if defined(_MSC_VER)
+
+static int cpu_supports_sse2(void) {
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] >> 26) & 1;
+}
+
+static int cpu_supports_avx2(void) {
+    int info[4];
+    int os_saves_ymm;
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return 0;
+    }
+    __cpuid(info, 1);
+    if (((info[2] >> 27) & 1) == 0 || ((info[2] >> 28) & 1) == 0) {
+        return 0;  /* no osxsave or no avx */
+    }
+    os_saves_ymm = (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return os_saves_ymm && ((info[1] >> 5) & 1);
+}
+
+#else
+
+static int cpu_supports_sse2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static int cpu_supports_avx2(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif
+
+#endif
+
+static kernel_t *g_kernel = NULL;
+static const char *g_kernel_name = NULL;
+
+/* called from a single thread before any span is tested */
+void raster_select_kernel(void) {
+    if (g_kernel != NULL) {
+        return;
+    }
+#ifdef RASTER_X86
+    if (cpu_supports_avx2()) {
+        g_kernel_name = "avx2";
+        g_kernel = test_span_avx2;
+        return;
+    } else if (cpu_supports_sse2()) {
+        g_kernel_name = "sse2";
+        g_kernel = test_span_sse2;
+        return;
+    }
+#endif
+    g_kernel_name = "scalar";
+    g_kernel = test_span_scalar;
+}
+
+const char *raster_get_kernel(void) {
+    assert(g_kernel != NULL);
+    return g_kernel_name;
+}
+
+int raster_test_span(span_t *span, float *depth_buffer, int num_pixels,
+                     int is_inside, float depths[SPAN_SIZE]) {
+    assert(g_kernel != NULL);
+    if (num_pixels < SPAN_SIZE) {
+        /* pad partial spans so that the kernels never read past the row */
+        float padded[SPAN_SIZE];
+        int valid = (1 << num_pixels) - 1;
+#ifdef GRAPHICS_STATS
+        valid |= valid << SPAN_SIZE;
+#endif
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, depth_buffer, sizeof(float) * num_pixels);
+        return g_kernel(span, padded, is_inside, depths) & valid;
+    } else {
+        return g_kernel(span, depth_buffer, is_inside, depths);
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef RASTER_H
+#define RASTER_H
+
+#define SPAN_SIZE 8
+#define SPAN_MASK ((1 << SPAN_SIZE) - 1)
+
+typedef struct {
+    double values[3];   /* biased edge values at the first pixel */
+    double steps[3];    /* edge increments per pixel along x */
+    double biases[3];   /* edge biases of the top-left fill rule */
+    float depths[3];    /* screen depths of the vertices */
+    float recip_area;
+} span_t;
+
+/*
+ * coverage and depth kernels, with GRAPHICS_STATS defined, the lanes covered
+ * by the triangle are returned as well, shifted left by SPAN_SIZE
+ */
+int raster_test_span(span_t *span, float *depth_buffer, int num_pixels,
+                     int is_inside, float depths[SPAN_SIZE]);
+void raster_select_kernel(void);
+const char *raster_get_kernel(void);
+
+#endif
@@ -14,20 +14,25 @@ scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
     scene->background = vec4_from_vec3(background, 1);
     scene->skybox = skybox;
     scene->models = models;
+    scene->animations = NULL;
     scene->ambient_intensity = ambient_intensity;
     scene->punctual_intensity = punctual_intensity;
     if (shadow_width > 0 && shadow_height > 0) {
         scene->shadow_buffer = framebuffer_create(shadow_width, shadow_height);
-        scene->shadow_map = texture_create(shadow_width, shadow_height);
+        scene->shadow_map = texture_from_depthbuffer(scene->shadow_buffer);
     } else {
         scene->shadow_buffer = NULL;
         scene->shadow_map = NULL;
     }
+    scene->depth_prepass = 0;
+    scene->visibility_buffer = 0;
+    scene->texture_filter = FILTER_NEAREST;
     return scene;
 }
 
 void scene_release(scene_t *scene) {
     int num_models = darray_size(scene->models);
+    int num_animations = darray_size(scene->animations);
     int i;
     if (scene->skybox) {
         model_t *skybox = scene->skybox;
@@ -38,11 +43,15 @@ void scene_release(scene_t *scene) {
         model->release(model);
     }
     darray_free(scene->models);
-    if (scene->shadow_buffer) {
-        framebuffer_release(scene->shadow_buffer);
+    for (i = 0; i < num_animations; i++) {
+        animation_release(scene->animations[i]);
     }
+    darray_free(scene->animations);
     if (scene->shadow_map) {
         texture_release(scene->shadow_map);
     }
+    if (scene->shadow_buffer) {
+        framebuffer_release(scene->shadow_buffer);
+    }
     free(scene);
 }
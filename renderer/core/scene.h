@@ -20,6 +20,7 @@ typedef struct {
     float punctual_intensity;
     texture_t *shadow_map;
     int layer_view;
+    filter_t texture_filter;
 } perframe_t;
 
 typedef struct model {
@@ -28,10 +29,14 @@ typedef struct model {
     mat4_t transform;
     /* for animation */
     skeleton_t *skeleton;
+    animation_t *animation;  /* shared by the models of a character */
     int attached;
+    skinned_t *skinned;  /* NULL if not skinned */
     /* for sorting */
     int opaque;
     float distance;
+    /* for depth pre-pass and visibility buffer */
+    int alpha_tested;
     /* polymorphism */
     void (*update)(struct model *model, perframe_t *perframe);
     void (*draw)(struct model *model, framebuffer_t *framebuffer,
@@ -43,12 +48,17 @@ typedef struct {
     vec4_t background;
     model_t *skybox;
     model_t **models;
+    animation_t **animations;
     /* light intensity */
     float ambient_intensity;
     float punctual_intensity;
     /* shadow mapping */
     framebuffer_t *shadow_buffer;
     texture_t *shadow_map;
+    /* render paths */
+    int depth_prepass;
+    int visibility_buffer;
+    filter_t texture_filter;
 } scene_t;
 
 scene_t *scene_create(vec3_t background, model_t *skybox, model_t **models,
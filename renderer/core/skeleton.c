@@ -3,16 +3,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "darray.h"
 #include "macro.h"
 #include "maths.h"
+#include "mesh.h"
+#include "platform.h"
 #include "private.h"
 #include "skeleton.h"
+#include "workers.h"
 
 /*
  * for skeletal animation, see
  * https://people.rennes.inria.fr/Ludovic.Hoyet/teaching/IMO/05_IMO2016_Skinning.pdf
  */
 
+typedef struct {
+    float start_time;
+    float bucket_rate;  /* buckets per unit of time */
+    int num_buckets;
+    int *bucket_keys;   /* last key at or before the start of each bucket */
+} timeline_t;
+
 typedef struct {
     int joint_index;
     int parent_index;
@@ -21,31 +32,85 @@ typedef struct {
     int num_translations;
     float *translation_times;
     vec3_t *translation_values;
+    timeline_t translation_timeline;
     /* rotations */
     int num_rotations;
     float *rotation_times;
     quat_t *rotation_values;
+    timeline_t rotation_timeline;
     /* scales */
     int num_scales;
     float *scale_times;
     vec3_t *scale_values;
-    /* interpolated */
-    mat4_t transform;
+    timeline_t scale_timeline;
 } joint_t;
 
+typedef struct {
+    quat_t real;  /* rotation */
+    quat_t dual;  /* half of the translation times the rotation */
+} dualquat_t;
+
 struct skeleton {
     float min_time;
     float max_time;
     int num_joints;
     joint_t *joints;
+};
+
+struct animation {
+    skeleton_t *skeleton;
+    float time_offset;
+    /* sampled poses, one array per field */
+    vec3_t *translations;
+    quat_t *rotations;
+    vec3_t *scales;
+    mat4_t *transforms;
     /* cached result */
     mat4_t *joint_matrices;
-    mat3_t *normal_matrices;
+    mat3_t *normal_matrices;  /* of the scale matrices with dual quats */
+    mat3_t *scale_matrices;
+    dualquat_t *dual_quats;
+    int scaled;               /* if any joint has a scale matrix */
     float last_time;
+    /* for vertex skinning */
+    skinning_t skinning;
 };
 
 /* skeleton loading/releasing */
 
+/*
+ * the time range of a channel is divided into as many buckets as it has
+ * keys, and each bucket remembers the last key at or before its start,
+ * so that a lookup jumps to the right bucket in constant time and then
+ * binary searches the few keys inside it, the keys are not resampled so
+ * the sampled poses are exactly the same as those of a linear scan
+ */
+static timeline_t build_timeline(float *times, int num_keys) {
+    timeline_t timeline;
+    timeline.start_time = num_keys > 0 ? times[0] : 0;
+    timeline.bucket_rate = 0;
+    timeline.num_buckets = 0;
+    timeline.bucket_keys = NULL;
+    if (num_keys > 1 && times[num_keys - 1] > times[0]) {
+        float duration = times[num_keys - 1] - times[0];
+        int num_buckets = num_keys;
+        int key = 0;
+        int i;
+
+        timeline.bucket_rate = (float)num_buckets / duration;
+        timeline.num_buckets = num_buckets;
+        timeline.bucket_keys = (int*)malloc(sizeof(int) * (num_buckets + 1));
+        for (i = 0; i <= num_buckets; i++) {
+            float bucket_time = times[0] + (float)i / timeline.bucket_rate;
+            while (key < num_keys - 1 && times[key + 1] <= bucket_time) {
+                key += 1;
+            }
+            timeline.bucket_keys[i] = key;
+        }
+    }
+    return timeline;
+}
+
 static void read_inverse_bind(FILE *file, joint_t *joint) {
     char line[LINE_SIZE];
     int items;
@@ -85,6 +150,8 @@ static void read_translations(FILE *file, joint_t *joint) {
         joint->translation_times = NULL;
         joint->translation_values = NULL;
     }
+    joint->translation_timeline = build_timeline(joint->translation_times,
+                                                 joint->num_translations);
     UNUSED_VAR(items);
 }
 
@@ -111,6 +178,8 @@ static void read_rotations(FILE *file, joint_t *joint) {
         joint->rotation_times = NULL;
         joint->rotation_values = NULL;
     }
+    joint->rotation_timeline = build_timeline(joint->rotation_times,
+                                              joint->num_rotations);
     UNUSED_VAR(items);
 }
 
@@ -136,6 +205,8 @@ static void read_scales(FILE *file, joint_t *joint) {
         joint->scale_times = NULL;
         joint->scale_values = NULL;
     }
+    joint->scale_timeline = build_timeline(joint->scale_times,
+                                           joint->num_scales);
     UNUSED_VAR(items);
 }
 
@@ -157,16 +228,6 @@ static joint_t load_joint(FILE *file) {
     return joint;
 }
 
-static void initialize_cache(skeleton_t *skeleton) {
-    int joint_matrix_size = sizeof(mat4_t) * skeleton->num_joints;
-    int normal_matrix_size = sizeof(mat3_t) * skeleton->num_joints;
-    skeleton->joint_matrices = (mat4_t*)malloc(joint_matrix_size);
-    skeleton->normal_matrices = (mat3_t*)malloc(normal_matrix_size);
-    memset(skeleton->joint_matrices, 0, joint_matrix_size);
-    memset(skeleton->normal_matrices, 0, normal_matrix_size);
-    skeleton->last_time = -1;
-}
-
 static skeleton_t *load_ani(const char *filename) {
     skeleton_t *skeleton;
     FILE *file;
@@ -188,13 +249,12 @@ static skeleton_t *load_ani(const char *filename) {
     for (i = 0; i < skeleton->num_joints; i++) {
         joint_t joint = load_joint(file);
         assert(joint.joint_index == i);
+        assert(joint.parent_index < i);  /* parents are updated first */
         skeleton->joints[i] = joint;
     }
 
     fclose(file);
 
-    initialize_cache(skeleton);
-
     UNUSED_VAR(items);
     return skeleton;
 }
@@ -219,15 +279,91 @@ void skeleton_release(skeleton_t *skeleton) {
         free(joint->rotation_values);
         free(joint->scale_times);
         free(joint->scale_values);
+        free(joint->translation_timeline.bucket_keys);
+        free(joint->rotation_timeline.bucket_keys);
+        free(joint->scale_timeline.bucket_keys);
     }
     free(skeleton->joints);
-    free(skeleton->joint_matrices);
-    free(skeleton->normal_matrices);
     free(skeleton);
 }
 
+/* animation creating/releasing */
+
+animation_t *animation_create(skeleton_t *skeleton, float time_offset) {
+    int num_joints = skeleton->num_joints;
+    int joint_matrix_size = sizeof(mat4_t) * num_joints;
+    int normal_matrix_size = sizeof(mat3_t) * num_joints;
+    int scale_matrix_size = sizeof(mat3_t) * num_joints;
+    int dual_quat_size = sizeof(dualquat_t) * num_joints;
+    animation_t *animation;
+
+    animation = (animation_t*)malloc(sizeof(animation_t));
+    animation->skeleton = skeleton;
+    animation->time_offset = time_offset;
+    animation->translations = (vec3_t*)malloc(sizeof(vec3_t) * num_joints);
+    animation->rotations = (quat_t*)malloc(sizeof(quat_t) * num_joints);
+    animation->scales = (vec3_t*)malloc(sizeof(vec3_t) * num_joints);
+    animation->transforms = (mat4_t*)malloc(sizeof(mat4_t) * num_joints);
+    animation->joint_matrices = (mat4_t*)malloc(joint_matrix_size);
+    animation->normal_matrices = (mat3_t*)malloc(normal_matrix_size);
+    animation->scale_matrices = (mat3_t*)malloc(scale_matrix_size);
+    animation->dual_quats = (dualquat_t*)malloc(dual_quat_size);
+    memset(animation->joint_matrices, 0, joint_matrix_size);
+    memset(animation->normal_matrices, 0, normal_matrix_size);
+    memset(animation->scale_matrices, 0, scale_matrix_size);
+    memset(animation->dual_quats, 0, dual_quat_size);
+    animation->scaled = 0;
+    animation->last_time = -1;
+    animation->skinning = SKINNING_LINEAR;
+
+    return animation;
+}
+
+void animation_release(animation_t *animation) {
+    free(animation->translations);
+    free(animation->rotations);
+    free(animation->scales);
+    free(animation->transforms);
+    free(animation->joint_matrices);
+    free(animation->normal_matrices);
+    free(animation->scale_matrices);
+    free(animation->dual_quats);
+    free(animation);
+}
+
 /* joint updating/retrieving */
 
+static int search_key(timeline_t *timeline, float *times, int num_keys,
+                      float frame_time) {
+    int bucket = (int)((frame_time - timeline->start_time)
+                       * timeline->bucket_rate);
+    int low, high;
+
+    assert(frame_time > times[0] && frame_time < times[num_keys - 1]);
+    bucket = bucket < 0 ? 0 : bucket;
+    bucket = bucket >= timeline->num_buckets ? timeline->num_buckets - 1
+                                             : bucket;
+    low = timeline->bucket_keys[bucket];
+    high = timeline->bucket_keys[bucket + 1];
+    /* tolerate a bucket off by one due to rounding */
+    while (low > 0 && times[low] > frame_time) {
+        low -= 1;
+    }
+    while (high < num_keys - 2 && times[high + 1] <= frame_time) {
+        high += 1;
+    }
+    /* find the last key at or before the frame time */
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (times[middle] <= frame_time) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
 static vec3_t get_translation(joint_t *joint, float frame_time) {
     int num_translations = joint->num_translations;
     float *translation_times = joint->translation_times;
@@ -240,19 +376,14 @@ static vec3_t get_translation(joint_t *joint, float frame_time) {
     } else if (frame_time >= translation_times[num_translations - 1]) {
         return translation_values[num_translations - 1];
     } else {
-        int i;
-        for (i = 0; i < num_translations - 1; i++) {
-            float curr_time = translation_times[i];
-            float next_time = translation_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                vec3_t curr_translation = translation_values[i];
-                vec3_t next_translation = translation_values[i + 1];
-                return vec3_lerp(curr_translation, next_translation, t);
-            }
-        }
-        assert(0);
-        return vec3_new(0, 0, 0);
+        int i = search_key(&joint->translation_timeline, translation_times,
+                           num_translations, frame_time);
+        float curr_time = translation_times[i];
+        float next_time = translation_times[i + 1];
+        float t = (frame_time - curr_time) / (next_time - curr_time);
+        vec3_t curr_translation = translation_values[i];
+        vec3_t next_translation = translation_values[i + 1];
+        return vec3_lerp(curr_translation, next_translation, t);
     }
 }
 
@@ -268,19 +399,14 @@ static quat_t get_rotation(joint_t *joint, float frame_time) {
     } else if (frame_time >= rotation_times[num_rotations - 1]) {
         return rotation_values[num_rotations - 1];
     } else {
-        int i;
-        for (i = 0; i < num_rotations - 1; i++) {
-            float curr_time = rotation_times[i];
-            float next_time = rotation_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                quat_t curr_rotation = rotation_values[i];
-                quat_t next_rotation = rotation_values[i + 1];
-                return quat_slerp(curr_rotation, next_rotation, t);
-            }
-        }
-        assert(0);
-        return quat_new(0, 0, 0, 1);
+        int i = search_key(&joint->rotation_timeline, rotation_times,
+                           num_rotations, frame_time);
+        float curr_time = rotation_times[i];
+        float next_time = rotation_times[i + 1];
+        float t = (frame_time - curr_time) / (next_time - curr_time);
+        quat_t curr_rotation = rotation_values[i];
+        quat_t next_rotation = rotation_values[i + 1];
+        return quat_slerp(curr_rotation, next_rotation, t);
     }
 }
 
@@ -296,54 +422,414 @@ static vec3_t get_scale(joint_t *joint, float frame_time) {
     } else if (frame_time >= scale_times[num_scales - 1]) {
         return scale_values[num_scales - 1];
     } else {
-        int i;
-        for (i = 0; i < num_scales - 1; i++) {
-            float curr_time = scale_times[i];
-            float next_time = scale_times[i + 1];
-            if (frame_time >= curr_time && frame_time < next_time) {
-                float t = (frame_time - curr_time) / (next_time - curr_time);
-                vec3_t curr_scale = scale_values[i];
-                vec3_t next_scale = scale_values[i + 1];
-                return vec3_lerp(curr_scale, next_scale, t);
+        int i = search_key(&joint->scale_timeline, scale_times,
+                           num_scales, frame_time);
+        float curr_time = scale_times[i];
+        float next_time = scale_times[i + 1];
+        float t = (frame_time - curr_time) / (next_time - curr_time);
+        vec3_t curr_scale = scale_values[i];
+        vec3_t next_scale = scale_values[i + 1];
+        return vec3_lerp(curr_scale, next_scale, t);
+    }
+}
+
+/*
+ * for dual quaternion skinning, see
+ * http://www.cs.utah.edu/~ladislav/kavan07skinning/kavan07skinning.pdf
+ *
+ * a joint matrix is split into a rigid transform, which is converted to a
+ * unit dual quaternion, and a scale matrix applied before it, which may
+ * also shear, the dual quaternions are blended linearly and normalized,
+ * which preserves the volume around the joints where linear blend skinning
+ * collapses, and normals are rotated by the blended rotation
+ *
+ * the scale matrices cannot be represented by dual quaternions, so they
+ * are blended linearly and applied to the vertex first, as in section 4.2
+ * of the paper, this pass is skipped if no joint of a pose has a scale
+ *
+ * for polar decomposition, see
+ * https://en.wikipedia.org/wiki/Polar_decomposition
+ */
+
+#define MAX_POLAR_ITERATIONS 16
+#define MAX_SCALE_ERROR 1e-4f  /* off the identity, to apply the scales */
+
+static quat_t quat_mul(quat_t a, quat_t b) {
+    return quat_new(a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y,
+                    a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x,
+                    a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w,
+                    a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z);
+}
+
+/*
+ * the rotation is found by averaging the matrix with its inverse transpose
+ * until it is orthogonal, mirroring matrices are negated first so that it
+ * is a proper rotation, and singular ones have no rotation at all
+ */
+static mat3_t get_polar_rotation(mat3_t m) {
+    vec3_t row0 = vec3_new(m.m[0][0], m.m[0][1], m.m[0][2]);
+    vec3_t row1 = vec3_new(m.m[1][0], m.m[1][1], m.m[1][2]);
+    vec3_t row2 = vec3_new(m.m[2][0], m.m[2][1], m.m[2][2]);
+    float determinant = vec3_dot(vec3_cross(row0, row1), row2);
+    mat3_t rotation = m;
+    int i, r, c;
+
+    if ((float)fabs(determinant) < EPSILON * EPSILON) {
+        return mat3_identity();
+    }
+    for (i = 0; i < MAX_POLAR_ITERATIONS; i++) {
+        mat3_t inverse_transpose = mat3_inverse_transpose(rotation);
+        float max_change = 0;
+        for (r = 0; r < 3; r++) {
+            for (c = 0; c < 3; c++) {
+                float value = rotation.m[r][c];
+                float average = (value + inverse_transpose.m[r][c]) * 0.5f;
+                float change = (float)fabs(average - value);
+                max_change = change > max_change ? change : max_change;
+                rotation.m[r][c] = average;
+            }
+        }
+        if (max_change < EPSILON) {
+            break;
+        }
+    }
+    if (determinant < 0) {
+        for (r = 0; r < 3; r++) {
+            for (c = 0; c < 3; c++) {
+                rotation.m[r][c] = -rotation.m[r][c];
             }
         }
-        assert(0);
-        return vec3_new(1, 1, 1);
     }
+    return rotation;
 }
 
-void skeleton_update_joints(skeleton_t *skeleton, float frame_time) {
+static int is_identity(mat3_t m) {
+    int r, c;
+    for (r = 0; r < 3; r++) {
+        for (c = 0; c < 3; c++) {
+            float expected = r == c ? 1.0f : 0.0f;
+            if ((float)fabs(m.m[r][c] - expected) > MAX_SCALE_ERROR) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static dualquat_t dualquat_from_rigid(mat3_t rotation, vec3_t offset) {
+    quat_t translation = quat_new(offset.x, offset.y, offset.z, 0);
+    dualquat_t dq;
+
+    dq.real = quat_normalize(quat_from_mat3(rotation));
+    dq.dual = quat_mul(translation, dq.real);
+    dq.dual = quat_new(dq.dual.x * 0.5f, dq.dual.y * 0.5f,
+                       dq.dual.z * 0.5f, dq.dual.w * 0.5f);
+    return dq;
+}
+
+/*
+ * the joints are updated in passes over arrays of one field each, the
+ * channels are sampled first, then the local transforms are composed,
+ * which is independent per joint and can be vectorized by the compiler,
+ * and only the concatenation with the parents is sequential
+ */
+void animation_update_joints(animation_t *animation, float frame_time) {
+    skeleton_t *skeleton = animation->skeleton;
+    frame_time += animation->time_offset;
     frame_time = (float)fmod(frame_time, skeleton->max_time);
-    if (frame_time != skeleton->last_time) {
+    if (frame_time < 0) {
+        frame_time += skeleton->max_time;
+    }
+    if (frame_time != animation->last_time) {
+        int num_joints = skeleton->num_joints;
+        joint_t *joints = skeleton->joints;
+        vec3_t *translations = animation->translations;
+        quat_t *rotations = animation->rotations;
+        vec3_t *scales = animation->scales;
+        mat4_t *transforms = animation->transforms;
+        int scaled = 0;
         int i;
-        for (i = 0; i < skeleton->num_joints; i++) {
-            joint_t *joint = &skeleton->joints[i];
-            vec3_t translation = get_translation(joint, frame_time);
-            quat_t rotation = get_rotation(joint, frame_time);
-            vec3_t scale = get_scale(joint, frame_time);
-            mat4_t joint_matrix;
-            mat3_t normal_matrix;
-
-            joint->transform = mat4_from_trs(translation, rotation, scale);
-            if (joint->parent_index >= 0) {
-                joint_t *parent = &skeleton->joints[joint->parent_index];
-                joint->transform = mat4_mul_mat4(parent->transform,
-                                                 joint->transform);
+
+        for (i = 0; i < num_joints; i++) {
+            translations[i] = get_translation(&joints[i], frame_time);
+            rotations[i] = get_rotation(&joints[i], frame_time);
+            scales[i] = get_scale(&joints[i], frame_time);
+        }
+
+        for (i = 0; i < num_joints; i++) {
+            mat4_t rotation = mat4_from_quat(rotations[i]);
+            mat4_t transform;
+            int r;
+            for (r = 0; r < 3; r++) {
+                transform.m[r][0] = rotation.m[r][0] * scales[i].x;
+                transform.m[r][1] = rotation.m[r][1] * scales[i].y;
+                transform.m[r][2] = rotation.m[r][2] * scales[i].z;
+            }
+            transform.m[0][3] = translations[i].x;
+            transform.m[1][3] = translations[i].y;
+            transform.m[2][3] = translations[i].z;
+            transform.m[3][0] = 0;
+            transform.m[3][1] = 0;
+            transform.m[3][2] = 0;
+            transform.m[3][3] = 1;
+            transforms[i] = transform;
+        }
+
+        for (i = 0; i < num_joints; i++) {
+            int parent_index = joints[i].parent_index;
+            if (parent_index >= 0) {
+                transforms[i] = mat4_mul_mat4(transforms[parent_index],
+                                              transforms[i]);
+            }
+        }
+
+        for (i = 0; i < num_joints; i++) {
+            mat4_t joint_matrix = mat4_mul_mat4(transforms[i],
+                                                joints[i].inverse_bind);
+            animation->joint_matrices[i] = joint_matrix;
+            if (animation->skinning == SKINNING_DUAL_QUATERNION) {
+                mat3_t matrix = mat3_from_mat4(joint_matrix);
+                mat3_t rotation = get_polar_rotation(matrix);
+                mat3_t scale = mat3_mul_mat3(mat3_transpose(rotation), matrix);
+                vec3_t offset = vec3_new(joint_matrix.m[0][3],
+                                         joint_matrix.m[1][3],
+                                         joint_matrix.m[2][3]);
+                animation->dual_quats[i] = dualquat_from_rigid(rotation,
+                                                               offset);
+                animation->scale_matrices[i] = scale;
+                animation->normal_matrices[i] = mat3_inverse_transpose(scale);
+                if (!is_identity(scale)) {
+                    scaled = 1;
+                }
+            } else {
+                mat3_t normal_matrix;
+                normal_matrix = mat3_from_mat4(joint_matrix);
+                normal_matrix = mat3_inverse_transpose(normal_matrix);
+                animation->normal_matrices[i] = normal_matrix;
             }
+        }
+        animation->scaled = scaled;
+        animation->last_time = frame_time;
+    }
+}
+
+/*
+ * the instances of a batch share nothing but their read-only skeletons,
+ * so they are handed out one at a time to the worker threads
+ */
 
-            joint_matrix = mat4_mul_mat4(joint->transform, joint->inverse_bind);
-            normal_matrix = mat3_inverse_transpose(mat3_from_mat4(joint_matrix));
-            skeleton->joint_matrices[i] = joint_matrix;
-            skeleton->normal_matrices[i] = normal_matrix;
+typedef struct {
+    animation_t **animations;
+    int num_animations;
+    float frame_time;
+    mutex_t *mutex;
+    int next_animation;
+} batch_t;
+
+static void update_animations(void *userdata) {
+    batch_t *batch = (batch_t*)userdata;
+    while (1) {
+        int index;
+
+        mutex_lock(batch->mutex);
+        index = batch->next_animation++;
+        mutex_unlock(batch->mutex);
+        if (index >= batch->num_animations) {
+            break;
         }
-        skeleton->last_time = frame_time;
+
+        animation_update_joints(batch->animations[index], batch->frame_time);
+    }
+}
+
+void animation_update_batch(animation_t **animations, int num_animations,
+                            float frame_time, int num_threads) {
+    batch_t batch;
+
+    if (num_animations == 0) {
+        return;
+    }
+
+    batch.animations = animations;
+    batch.num_animations = num_animations;
+    batch.frame_time = frame_time;
+    batch.mutex = mutex_create();
+    batch.next_animation = 0;
+
+    if (num_threads > num_animations) {
+        num_threads = num_animations;
     }
+    workers_run(update_animations, &batch, num_threads);
+    mutex_release(batch.mutex);
+}
+
+mat4_t *animation_get_joint_matrices(animation_t *animation) {
+    return animation->joint_matrices;
 }
 
-mat4_t *skeleton_get_joint_matrices(skeleton_t *skeleton) {
-    return skeleton->joint_matrices;
+mat3_t *animation_get_normal_matrices(animation_t *animation) {
+    return animation->normal_matrices;
+}
+
+/* vertex skinning */
+
+void animation_set_skinning(animation_t *animation, skinning_t skinning) {
+    if (skinning != animation->skinning) {
+        animation->skinning = skinning;
+        animation->last_time = -1;  /* force the joints to be updated */
+    }
+}
+
+static void skin_linear(animation_t *animation, vertex_t *vertex,
+                        skinned_t *skinned) {
+    mat4_t *joint_matrices = animation->joint_matrices;
+    mat3_t *normal_matrices = animation->normal_matrices;
+    int joint0 = (int)vertex->joint.x;
+    int joint1 = (int)vertex->joint.y;
+    int joint2 = (int)vertex->joint.z;
+    int joint3 = (int)vertex->joint.w;
+    mat4_t skin_matrices[4];
+    mat3_t skin_n_matrices[4];
+    mat4_t skin_matrix;
+    mat3_t skin_n_matrix;
+    vec4_t position;
+    vec3_t tangent;
+
+    skin_matrices[0] = joint_matrices[joint0];
+    skin_matrices[1] = joint_matrices[joint1];
+    skin_matrices[2] = joint_matrices[joint2];
+    skin_matrices[3] = joint_matrices[joint3];
+    skin_n_matrices[0] = normal_matrices[joint0];
+    skin_n_matrices[1] = normal_matrices[joint1];
+    skin_n_matrices[2] = normal_matrices[joint2];
+    skin_n_matrices[3] = normal_matrices[joint3];
+    skin_matrix = mat4_combine(skin_matrices, vertex->weight);
+    skin_n_matrix = mat3_combine(skin_n_matrices, vertex->weight);
+
+    position = vec4_from_vec3(vertex->position, 1);
+    position = mat4_mul_vec4(skin_matrix, position);
+    tangent = vec3_from_vec4(vertex->tangent);
+    tangent = mat3_mul_vec3(mat3_from_mat4(skin_matrix), tangent);
+    skinned->position = vec3_from_vec4(position);
+    skinned->normal = mat3_mul_vec3(skin_n_matrix, vertex->normal);
+    skinned->tangent = vec4_from_vec3(tangent, vertex->tangent.w);
+}
+
+static vec3_t rotate_vector(quat_t q, vec3_t v) {
+    vec3_t axis = vec3_new(q.x, q.y, q.z);
+    vec3_t t = vec3_mul(vec3_cross(axis, v), 2);
+    return vec3_add(vec3_add(v, vec3_mul(t, q.w)), vec3_cross(axis, t));
+}
+
+static void skin_dual_quaternion(animation_t *animation, vertex_t *vertex,
+                                 skinned_t *skinned) {
+    dualquat_t *dual_quats = animation->dual_quats;
+    float weights[4];
+    int joints[4];
+    quat_t pivot, real, dual;
+    vec3_t real_xyz, dual_xyz, translation;
+    vec3_t position, normal, tangent;
+    float length;
+    int i;
+
+    joints[0] = (int)vertex->joint.x;
+    joints[1] = (int)vertex->joint.y;
+    joints[2] = (int)vertex->joint.z;
+    joints[3] = (int)vertex->joint.w;
+    weights[0] = vertex->weight.x;
+    weights[1] = vertex->weight.y;
+    weights[2] = vertex->weight.z;
+    weights[3] = vertex->weight.w;
+
+    /* blend in the hemisphere of the first joint for the shortest path */
+    pivot = dual_quats[joints[0]].real;
+    real = quat_new(0, 0, 0, 0);
+    dual = quat_new(0, 0, 0, 0);
+    for (i = 0; i < 4; i++) {
+        dualquat_t dq = dual_quats[joints[i]];
+        float weight = weights[i];
+        if (quat_dot(dq.real, pivot) < 0) {
+            weight = -weight;
+        }
+        real.x += dq.real.x * weight;
+        real.y += dq.real.y * weight;
+        real.z += dq.real.z * weight;
+        real.w += dq.real.w * weight;
+        dual.x += dq.dual.x * weight;
+        dual.y += dq.dual.y * weight;
+        dual.z += dq.dual.z * weight;
+        dual.w += dq.dual.w * weight;
+    }
+
+    length = quat_length(real);
+    if (length < EPSILON) {
+        /* collapse unweighted vertices as linear blend skinning does */
+        skinned->position = vec3_new(0, 0, 0);
+        skinned->normal = vec3_new(0, 0, 0);
+        skinned->tangent = vec4_new(0, 0, 0, vertex->tangent.w);
+        return;
+    }
+    real = quat_new(real.x / length, real.y / length,
+                    real.z / length, real.w / length);
+    dual = quat_new(dual.x / length, dual.y / length,
+                    dual.z / length, dual.w / length);
+
+    /* translation = 2 * dual * conjugate(real) */
+    real_xyz = vec3_new(real.x, real.y, real.z);
+    dual_xyz = vec3_new(dual.x, dual.y, dual.z);
+    translation = vec3_sub(vec3_mul(dual_xyz, real.w),
+                           vec3_mul(real_xyz, dual.w));
+    translation = vec3_add(translation, vec3_cross(real_xyz, dual_xyz));
+    translation = vec3_mul(translation, 2);
+
+    position = vertex->position;
+    normal = vertex->normal;
+    tangent = vec3_from_vec4(vertex->tangent);
+    if (animation->scaled) {
+        mat3_t scale_matrices[4];
+        mat3_t scale_n_matrices[4];
+        mat3_t scale_matrix, scale_n_matrix;
+        for (i = 0; i < 4; i++) {
+            scale_matrices[i] = animation->scale_matrices[joints[i]];
+            scale_n_matrices[i] = animation->normal_matrices[joints[i]];
+        }
+        scale_matrix = mat3_combine(scale_matrices, vertex->weight);
+        scale_n_matrix = mat3_combine(scale_n_matrices, vertex->weight);
+        position = mat3_mul_vec3(scale_matrix, position);
+        normal = mat3_mul_vec3(scale_n_matrix, normal);
+        tangent = mat3_mul_vec3(scale_matrix, tangent);
+    }
+
+    tangent = rotate_vector(real, tangent);
+    skinned->position = vec3_add(rotate_vector(real, position), translation);
+    skinned->normal = rotate_vector(real, normal);
+    skinned->tangent = vec4_from_vec3(tangent, vertex->tangent.w);
 }
 
-mat3_t *skeleton_get_normal_matrices(skeleton_t *skeleton) {
-    return skeleton->normal_matrices;
+/*
+ * the vertices are skinned into the space of the model once per frame,
+ * so that the shadow pass and the main pass can draw them as a static
+ * mesh, the vertices in [begin, end) are skinned, so that a mesh can be
+ * split into ranges that are skinned in parallel
+ */
+void animation_skin_vertices(animation_t *animation, mesh_t *mesh,
+                             int begin, int end, skinned_t *skinned) {
+    int num_joints = animation->skeleton->num_joints;
+    int i;
+
+    assert(begin >= 0 && begin <= end);
+    assert(end <= mesh_get_num_vertices(mesh));
+    for (i = begin; i < end; i++) {
+        vertex_t vertex = mesh_get_vertex(mesh, i);
+        assert(vertex.joint.x >= 0 && vertex.joint.x < num_joints);
+        assert(vertex.joint.y >= 0 && vertex.joint.y < num_joints);
+        assert(vertex.joint.z >= 0 && vertex.joint.z < num_joints);
+        assert(vertex.joint.w >= 0 && vertex.joint.w < num_joints);
+        if (animation->skinning == SKINNING_DUAL_QUATERNION) {
+            skin_dual_quaternion(animation, &vertex, &skinned[i]);
+        } else {
+            skin_linear(animation, &vertex, &skinned[i]);
+        }
+    }
+    UNUSED_VAR(num_joints);
 }
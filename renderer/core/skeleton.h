@@ -2,16 +2,39 @@
 #define SKELETON_H
 
 #include "maths.h"
+#include "mesh.h"
 
 typedef struct skeleton skeleton_t;
+typedef struct animation animation_t;
+typedef enum {
+    SKINNING_LINEAR,
+    SKINNING_DUAL_QUATERNION
+} skinning_t;
+
+typedef struct {
+    vec3_t position;
+    vec3_t normal;
+    vec4_t tangent;
+} skinned_t;
 
 /* skeleton loading/releasing */
 skeleton_t *skeleton_load(const char *filename);
 void skeleton_release(skeleton_t *skeleton);
 
+/* animation creating/releasing */
+animation_t *animation_create(skeleton_t *skeleton, float time_offset);
+void animation_release(animation_t *animation);
+
 /* joint updating/retrieving */
-void skeleton_update_joints(skeleton_t *skeleton, float frame_time);
-mat4_t *skeleton_get_joint_matrices(skeleton_t *skeleton);
-mat3_t *skeleton_get_normal_matrices(skeleton_t *skeleton);
+void animation_update_joints(animation_t *animation, float frame_time);
+void animation_update_batch(animation_t **animations, int num_animations,
+                            float frame_time, int num_threads);
+mat4_t *animation_get_joint_matrices(animation_t *animation);
+mat3_t *animation_get_normal_matrices(animation_t *animation);
+
+/* vertex skinning */
+void animation_set_skinning(animation_t *animation, skinning_t skinning);
+void animation_skin_vertices(animation_t *animation, mesh_t *mesh,
+                             int begin, int end, skinned_t *skinned);
 
 #endif
@@ -1,16 +1,1016 @@
 #include <assert.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "graphics.h"
 #include "image.h"
+#include "macro.h"
 #include "maths.h"
 #include "texture.h"
+#include "workers.h"
+
+/* texel encoding/decoding */
+
+/*
+ * for shared exponent texel format, see
+ * https://registry.khronos.org/OpenGL/extensions/EXT/EXT_texture_shared_exponent.txt
+ *
+ * the texels are stored in the most compact format that fits the usage
+ * and the channels of the image, and are decoded on every fetch, ldr
+ * images keep their bytes, srgb bytes are decoded through a lookup table
+ * of 256 entries, and hdr images use a shared exponent for rgb or half
+ * floats when there is an alpha channel
+ */
+
+#define RGB9E5_MAX 65408.0f
+
+static float g_srgb_table[256];
+static float g_exponent_table[32];
+static int g_tables_ready = 0;
+
+static void initialize_tables(void) {
+    if (!g_tables_ready) {
+        int i;
+        for (i = 0; i < 256; i++) {
+            float value = float_from_uchar((unsigned char)i);
+            g_srgb_table[i] = float_srgb2linear(value);
+        }
+        for (i = 0; i < 32; i++) {
+            g_exponent_table[i] = (float)ldexp(1, i - 15 - 9);
+        }
+        g_tables_ready = 1;
+    }
+}
+
+static int get_texel_size(storage_t storage) {
+    switch (storage) {
+        case STORAGE_RGBA32F:
+            return 16;
+        case STORAGE_RGBA16F:
+            return 8;
+        case STORAGE_RGB9E5:
+        case STORAGE_RGBA8:
+        case STORAGE_R32F:
+            return 4;
+        case STORAGE_RG8:
+            return 2;
+        case STORAGE_R8:
+            return 1;
+        default:
+            assert(0);
+            return 0;
+    }
+}
+
+static int is_compressed(storage_t storage) {
+    return storage == STORAGE_BC1 || storage == STORAGE_BC4
+           || storage == STORAGE_BC5 || storage == STORAGE_BC7;
+}
+
+static int get_buffer_size(storage_t storage, int width, int height) {
+    if (is_compressed(storage)) {
+        int num_blocks = ((width + 3) / 4) * ((height + 3) / 4);
+        int block_size = storage == STORAGE_BC1 || storage == STORAGE_BC4
+                         ? 8 : 16;
+        return num_blocks * block_size;
+    } else {
+        return get_texel_size(storage) * width * height;
+    }
+}
+
+/*
+ * for swizzled texture layouts, see
+ * https://fgiesen.wordpress.com/2011/01/17/texture-tiling-and-swizzling/
+ *
+ * in the tiled layout, the texels of each 4x4 tile are stored together
+ * and the tiles are stored in row-major order, so that the texels near a
+ * fetch are likely to be in the same cache line whatever the direction
+ * of the access, the width and height are padded to multiples of 4, and
+ * the blocks of compressed textures are laid out as the tiles are
+ */
+
+static int align_to_tile(int size) {
+    return (size + 3) / 4 * 4;
+}
+
+static int get_texel_index(texture_t *texture, int row, int col) {
+    if (texture->layout == LAYOUT_TILED) {
+        int num_tiles_x = (texture->width + 3) >> 2;
+        int tile_index = (row >> 2) * num_tiles_x + (col >> 2);
+        return (tile_index << 4) | ((row & 3) << 2) | (col & 3);
+    } else {
+        return row * texture->width + col;
+    }
+}
+
+static unsigned int encode_rgb9e5(vec4_t texel) {
+    float r = float_clamp(texel.x, 0, RGB9E5_MAX);
+    float g = float_clamp(texel.y, 0, RGB9E5_MAX);
+    float b = float_clamp(texel.z, 0, RGB9E5_MAX);
+    float max_channel = float_max(r, float_max(g, b));
+    int exponent, max_value;
+    float scale;
+
+    if (max_channel <= 0) {
+        return 0;
+    }
+    frexp(max_channel, &exponent);  /* floor(log2(max_channel)) + 1 */
+    exponent = exponent + 15 < 0 ? 0 : exponent + 15;
+    scale = g_exponent_table[exponent];
+    max_value = (int)floor(max_channel / scale + 0.5f);
+    if (max_value == 512) {
+        exponent += 1;
+        scale = g_exponent_table[exponent];
+    }
+    return (unsigned int)floor(r / scale + 0.5f)
+           | (unsigned int)floor(g / scale + 0.5f) << 9
+           | (unsigned int)floor(b / scale + 0.5f) << 18
+           | (unsigned int)exponent << 27;
+}
+
+static void store_texel(texture_t *texture, int index, vec4_t texel) {
+    void *buffer = texture->buffer;
+    if (texture->srgb) {
+        texel.x = float_linear2srgb(texel.x);
+        texel.y = float_linear2srgb(texel.y);
+        texel.z = float_linear2srgb(texel.z);
+    }
+    switch (texture->storage) {
+        case STORAGE_RGBA32F:
+            ((vec4_t*)buffer)[index] = texel;
+            break;
+        case STORAGE_RGBA16F: {
+            unsigned short *halfs = (unsigned short*)buffer + index * 4;
+            halfs[0] = float_to_half(texel.x);
+            halfs[1] = float_to_half(texel.y);
+            halfs[2] = float_to_half(texel.z);
+            halfs[3] = float_to_half(texel.w);
+            break;
+        }
+        case STORAGE_RGB9E5:
+            ((unsigned int*)buffer)[index] = encode_rgb9e5(texel);
+            break;
+        case STORAGE_RGBA8: {
+            unsigned char *bytes = (unsigned char*)buffer + index * 4;
+            bytes[0] = float_to_uchar(float_saturate(texel.x));
+            bytes[1] = float_to_uchar(float_saturate(texel.y));
+            bytes[2] = float_to_uchar(float_saturate(texel.z));
+            bytes[3] = float_to_uchar(float_saturate(texel.w));
+            break;
+        }
+        case STORAGE_RG8: {
+            unsigned char *bytes = (unsigned char*)buffer + index * 2;
+            bytes[0] = float_to_uchar(float_saturate(texel.x));
+            bytes[1] = float_to_uchar(float_saturate(texel.w));
+            break;
+        }
+        case STORAGE_R8: {
+            unsigned char *bytes = (unsigned char*)buffer + index;
+            bytes[0] = float_to_uchar(float_saturate(texel.x));
+            break;
+        }
+        case STORAGE_R32F:
+            ((float*)buffer)[index] = texel.x;
+            break;
+        default:
+            assert(0);
+            break;
+    }
+}
+
+/* block compression */
+
+/*
+ * for block compression formats, see
+ * https://docs.microsoft.com/en-us/windows/win32/direct3d11/texture-block-compression-in-direct3d-11
+ * https://docs.microsoft.com/en-us/windows/win32/direct3d11/bc7-format
+ *
+ * the texels are grouped into blocks of 4x4 that are encoded once when a
+ * texture is compressed, and a fetch decodes only the texel it needs from
+ * its block, bc1 stores opaque rgb, bc4 a single channel, bc5 two single
+ * channel blocks, and bc7 uses mode 6, a single subset of rgba with 16
+ * levels, which is the mode of bc7 that fits smooth color best, or mode 5,
+ * which has 4 levels of rgb and 4 levels of alpha with endpoints and
+ * indices of its own, for the blocks whose alpha mode 6 cannot follow
+ *
+ * alpha is weighted above color when the modes are compared, since alpha
+ * tested materials lose or gain coverage from small errors in alpha, and
+ * the texels with an alpha of 0 or 255 keep it exact, while the others do
+ * not reach it, since it is where the coverage of most materials changes
+ */
+
+#define ALPHA_WEIGHT 16
+
+static const int g_bc7_weights[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64,
+};
+
+static const int g_bc7_coarse_weights[4] = {0, 21, 43, 64};
+
+static int read_bits(const unsigned char *data, int offset, int count) {
+    int byte = offset >> 3;
+    int shift = offset & 7;
+    int value = data[byte] >> shift;
+    assert(count <= 8);
+    if (shift + count > 8) {
+        value |= data[byte + 1] << (8 - shift);
+    }
+    return value & ((1 << count) - 1);
+}
+
+static void write_bits(unsigned char *data, int *offset, int value,
+                       int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        int bit = *offset + i;
+        data[bit >> 3] |= (unsigned char)(((value >> i) & 1) << (bit & 7));
+    }
+    *offset += count;
+}
+
+static int get_block_index(texture_t *texture, int row, int col) {
+    int blocks_per_row = (texture->width + 3) / 4;
+    return (row / 4) * blocks_per_row + col / 4;
+}
+
+static void decode_bc1(const unsigned char *block, int index,
+                       unsigned char texel[4]) {
+    int color0 = block[0] | block[1] << 8;
+    int color1 = block[2] | block[3] << 8;
+    int selector = read_bits(block + 4, index * 2, 2);
+    int endpoints[2][3];
+    int i;
+
+    endpoints[0][0] = ((color0 >> 11) << 3) | (color0 >> 13);
+    endpoints[0][1] = (((color0 >> 5) & 0x3F) << 2) | ((color0 >> 9) & 0x3);
+    endpoints[0][2] = ((color0 & 0x1F) << 3) | ((color0 >> 2) & 0x7);
+    endpoints[1][0] = ((color1 >> 11) << 3) | (color1 >> 13);
+    endpoints[1][1] = (((color1 >> 5) & 0x3F) << 2) | ((color1 >> 9) & 0x3);
+    endpoints[1][2] = ((color1 & 0x1F) << 3) | ((color1 >> 2) & 0x7);
+
+    texel[3] = 255;
+    for (i = 0; i < 3; i++) {
+        int value0 = endpoints[0][i];
+        int value1 = endpoints[1][i];
+        int value;
+        if (selector < 2) {
+            value = endpoints[selector][i];
+        } else if (color0 > color1) {
+            value = selector == 2 ? (2 * value0 + value1) / 3
+                                  : (value0 + 2 * value1) / 3;
+        } else if (selector == 2) {
+            value = (value0 + value1) / 2;
+        } else {
+            value = 0;
+            texel[3] = 0;
+        }
+        texel[i] = (unsigned char)value;
+    }
+}
+
+static unsigned char decode_bc4(const unsigned char *block, int index) {
+    int value0 = block[0];
+    int value1 = block[1];
+    int selector = read_bits(block + 2, index * 3, 3);
+    if (selector < 2) {
+        return block[selector];
+    } else if (value0 > value1) {
+        return (unsigned char)(((8 - selector) * value0
+                                + (selector - 1) * value1) / 7);
+    } else if (selector < 6) {
+        return (unsigned char)(((6 - selector) * value0
+                                + (selector - 1) * value1) / 5);
+    } else {
+        return selector == 6 ? 0 : 255;
+    }
+}
+
+static int get_bc7_mode(const unsigned char *block) {
+    if (read_bits(block, 0, 6) == 0x20) {
+        return 5;
+    } else {
+        assert(read_bits(block, 0, 7) == 0x40);
+        return 6;
+    }
+}
+
+static int interpolate_bc7(int value0, int value1, int weight) {
+    return ((64 - weight) * value0 + weight * value1 + 32) >> 6;
+}
+
+static void decode_bc7(const unsigned char *block, int index,
+                       unsigned char texel[4]) {
+    int i;
+    if (get_bc7_mode(block) == 6) {
+        int pbit0 = read_bits(block, 63, 1);
+        int pbit1 = read_bits(block, 64, 1);
+        int offset = index == 0 ? 65 : 65 + 3 + (index - 1) * 4;
+        int selector = read_bits(block, offset, index == 0 ? 3 : 4);
+        int weight = g_bc7_weights[selector];
+        for (i = 0; i < 4; i++) {
+            int value0 = read_bits(block, 7 + i * 14, 7) << 1 | pbit0;
+            int value1 = read_bits(block, 7 + i * 14 + 7, 7) << 1 | pbit1;
+            texel[i] = (unsigned char)interpolate_bc7(value0, value1, weight);
+        }
+    } else {
+        int color_offset = index == 0 ? 66 : 66 + 1 + (index - 1) * 2;
+        int alpha_offset = index == 0 ? 97 : 97 + 1 + (index - 1) * 2;
+        int color_selector = read_bits(block, color_offset, index ? 2 : 1);
+        int alpha_selector = read_bits(block, alpha_offset, index ? 2 : 1);
+        int color_weight = g_bc7_coarse_weights[color_selector];
+        int alpha_weight = g_bc7_coarse_weights[alpha_selector];
+        for (i = 0; i < 3; i++) {
+            int value0 = read_bits(block, 8 + i * 14, 7);
+            int value1 = read_bits(block, 8 + i * 14 + 7, 7);
+            value0 = value0 << 1 | value0 >> 6;
+            value1 = value1 << 1 | value1 >> 6;
+            texel[i] = (unsigned char)interpolate_bc7(value0, value1,
+                                                      color_weight);
+        }
+        texel[3] = (unsigned char)interpolate_bc7(read_bits(block, 50, 8),
+                                                  read_bits(block, 58, 8),
+                                                  alpha_weight);
+    }
+}
+
+static void decode_block_texel(storage_t storage, unsigned char *block,
+                               int index, unsigned char texel[4]) {
+    if (storage == STORAGE_BC1) {
+        decode_bc1(block, index, texel);
+    } else if (storage == STORAGE_BC4) {
+        texel[0] = decode_bc4(block, index);
+    } else if (storage == STORAGE_BC5) {
+        texel[0] = decode_bc4(block, index);
+        texel[1] = decode_bc4(block + 8, index);
+    } else {
+        decode_bc7(block, index, texel);
+    }
+}
+
+/*
+ * the endpoints of a block are found along the principal axis of its
+ * texels, which is approximated with a few steps of power iteration on
+ * the covariance matrix, and every texel then picks the closest of the
+ * levels between the quantized endpoints
+ */
+static void find_endpoints(unsigned char texels[16][4], int channels,
+                           float endpoints[2][4]) {
+    float mean[4] = {0, 0, 0, 0};
+    float covariance[4][4];
+    float axis[4] = {1, 1, 1, 1};
+    float min_proj = 0;
+    float max_proj = 0;
+    int i, j, k;
+
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < channels; j++) {
+            mean[j] += texels[i][j] / 16.0f;
+        }
+    }
+    memset(covariance, 0, sizeof(covariance));
+    for (i = 0; i < 16; i++) {
+        for (j = 0; j < channels; j++) {
+            for (k = 0; k < channels; k++) {
+                float dj = texels[i][j] - mean[j];
+                float dk = texels[i][k] - mean[k];
+                covariance[j][k] += dj * dk;
+            }
+        }
+    }
+    for (i = 0; i < 8; i++) {
+        float product[4] = {0, 0, 0, 0};
+        float length = 0;
+        for (j = 0; j < channels; j++) {
+            for (k = 0; k < channels; k++) {
+                product[j] += covariance[j][k] * axis[k];
+            }
+            length = float_max(length, (float)fabs(product[j]));
+        }
+        if (length < EPSILON) {
+            break;  /* a flat block, keep the current axis */
+        }
+        for (j = 0; j < channels; j++) {
+            axis[j] = product[j] / length;
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        float projection = 0;
+        float length = 0;
+        for (j = 0; j < channels; j++) {
+            projection += (texels[i][j] - mean[j]) * axis[j];
+            length += axis[j] * axis[j];
+        }
+        projection /= length;
+        min_proj = i == 0 ? projection : float_min(min_proj, projection);
+        max_proj = i == 0 ? projection : float_max(max_proj, projection);
+    }
+    for (j = 0; j < channels; j++) {
+        endpoints[0][j] = float_clamp(mean[j] + axis[j] * min_proj, 0, 255);
+        endpoints[1][j] = float_clamp(mean[j] + axis[j] * max_proj, 0, 255);
+    }
+}
+
+static int get_distance(const unsigned char *a, const unsigned char *b,
+                        int channels) {
+    int distance = 0;
+    int i;
+    for (i = 0; i < channels; i++) {
+        int delta = a[i] - b[i];
+        distance += delta * delta;
+    }
+    return distance;
+}
+
+static int select_level(const unsigned char *texel,
+                        unsigned char levels[][4], int num_levels,
+                        int channels) {
+    int best_level = 0;
+    int best_distance = get_distance(texel, levels[0], channels);
+    int i;
+    for (i = 1; i < num_levels; i++) {
+        int distance = get_distance(texel, levels[i], channels);
+        if (distance < best_distance) {
+            best_level = i;
+            best_distance = distance;
+        }
+    }
+    return best_level;
+}
+
+static int is_alpha_flipped(int source, int decoded) {
+    return (source == 0) != (decoded == 0)
+           || (source == 255) != (decoded == 255);
+}
+
+/* falls back to the closest level if every level flips the alpha */
+static int select_alpha_level(int alpha, unsigned char levels[4][4]) {
+    int best_level = -1;
+    int best_distance = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        int delta = levels[i][0] - alpha;
+        if (!is_alpha_flipped(alpha, levels[i][0])
+                && (best_level < 0 || delta * delta < best_distance)) {
+            best_level = i;
+            best_distance = delta * delta;
+        }
+    }
+    if (best_level < 0) {
+        unsigned char texel[4];
+        texel[0] = (unsigned char)alpha;
+        best_level = select_level(texel, levels, 4, 1);
+    }
+    return best_level;
+}
+
+static int encode_rgb565(const float color[4]) {
+    int r = (int)(color[0] * 31 / 255 + 0.5f);
+    int g = (int)(color[1] * 63 / 255 + 0.5f);
+    int b = (int)(color[2] * 31 / 255 + 0.5f);
+    return r << 11 | g << 5 | b;
+}
+
+static void encode_bc1(unsigned char texels[16][4], float endpoints[2][4],
+                       unsigned char *block) {
+    unsigned char levels[4][4];
+    int color0 = encode_rgb565(endpoints[0]);
+    int color1 = encode_rgb565(endpoints[1]);
+    int offset = 0;
+    int i;
+
+    if (color0 < color1) {
+        int color = color0;
+        color0 = color1;
+        color1 = color;
+    }
+    memset(block, 0, 8);
+    block[0] = (unsigned char)(color0 & 0xFF);
+    block[1] = (unsigned char)(color0 >> 8);
+    block[2] = (unsigned char)(color1 & 0xFF);
+    block[3] = (unsigned char)(color1 >> 8);
+    if (color0 == color1) {
+        return;  /* all texels select the first endpoint */
+    }
+    /* build the levels by decoding the first texel with each selector */
+    for (i = 0; i < 4; i++) {
+        block[4] = (unsigned char)i;
+        decode_bc1(block, 0, levels[i]);
+    }
+    block[4] = 0;
+    for (i = 0; i < 16; i++) {
+        int level = select_level(texels[i], levels, 4, 3);
+        write_bits(block + 4, &offset, level, 2);
+    }
+}
+
+static void encode_bc4(unsigned char texels[16][4], int channel,
+                       unsigned char *block) {
+    unsigned char levels[8][4];
+    unsigned char values[16][4];
+    int value0 = 0;
+    int value1 = 255;
+    int offset = 0;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        values[i][0] = texels[i][channel];
+        value0 = values[i][0] > value0 ? values[i][0] : value0;
+        value1 = values[i][0] < value1 ? values[i][0] : value1;
+    }
+    memset(block, 0, 8);
+    block[0] = (unsigned char)value0;
+    block[1] = (unsigned char)value1;
+    if (value0 == value1) {
+        return;  /* all texels select the first endpoint */
+    }
+    /* build the levels by decoding the first texel with each selector */
+    for (i = 0; i < 8; i++) {
+        block[2] = (unsigned char)i;
+        levels[i][0] = decode_bc4(block, 0);
+    }
+    block[2] = 0;
+    for (i = 0; i < 16; i++) {
+        int level = select_level(values[i], levels, 8, 1);
+        write_bits(block + 2, &offset, level, 3);
+    }
+}
+
+static int quantize_endpoint(const float endpoint[4], int values[4]) {
+    int alpha = (int)(endpoint[3] + 0.5f);
+    int best_pbit = 0;
+    int best_error = -1;
+    int pbit, i;
+    for (pbit = 0; pbit < 2; pbit++) {
+        int error = 0;
+        if ((alpha == 0 && pbit == 1) || (alpha == 255 && pbit == 0)) {
+            continue;  /* only one of the p-bits keeps the alpha exact */
+        }
+        for (i = 0; i < 4; i++) {
+            int value = (int)((endpoint[i] - (float)pbit) / 2 + 0.5f);
+            int delta;
+            value = value < 0 ? 0 : (value > 127 ? 127 : value);
+            delta = (value << 1 | pbit) - (int)(endpoint[i] + 0.5f);
+            error += delta * delta;
+        }
+        if (best_error < 0 || error < best_error) {
+            best_pbit = pbit;
+            best_error = error;
+        }
+    }
+    for (i = 0; i < 4; i++) {
+        int value = (int)((endpoint[i] - (float)best_pbit) / 2 + 0.5f);
+        values[i] = value < 0 ? 0 : (value > 127 ? 127 : value);
+    }
+    return best_pbit;
+}
+
+static void encode_bc7(unsigned char texels[16][4], float endpoints[2][4],
+                       unsigned char *block) {
+    unsigned char levels[16][4];
+    int selectors[16];
+    int values[2][4];
+    int pbits[2];
+    int offset = 0;
+    int i, j;
+
+    pbits[0] = quantize_endpoint(endpoints[0], values[0]);
+    pbits[1] = quantize_endpoint(endpoints[1], values[1]);
+    for (i = 0; i < 16; i++) {
+        int weight = g_bc7_weights[i];
+        for (j = 0; j < 4; j++) {
+            int value0 = values[0][j] << 1 | pbits[0];
+            int value1 = values[1][j] << 1 | pbits[1];
+            levels[i][j] = (unsigned char)interpolate_bc7(value0, value1,
+                                                          weight);
+        }
+    }
+    for (i = 0; i < 16; i++) {
+        selectors[i] = select_level(texels[i], levels, 16, 4);
+    }
+    if (selectors[0] >= 8) {
+        /* the anchor selector has an implicit zero as its highest bit */
+        for (j = 0; j < 4; j++) {
+            int value = values[0][j];
+            values[0][j] = values[1][j];
+            values[1][j] = value;
+        }
+        j = pbits[0];
+        pbits[0] = pbits[1];
+        pbits[1] = j;
+        for (i = 0; i < 16; i++) {
+            selectors[i] = 15 - selectors[i];
+        }
+    }
+
+    memset(block, 0, 16);
+    write_bits(block, &offset, 0x40, 7);
+    for (j = 0; j < 4; j++) {
+        write_bits(block, &offset, values[0][j], 7);
+        write_bits(block, &offset, values[1][j], 7);
+    }
+    write_bits(block, &offset, pbits[0], 1);
+    write_bits(block, &offset, pbits[1], 1);
+    for (i = 0; i < 16; i++) {
+        write_bits(block, &offset, selectors[i], i == 0 ? 3 : 4);
+    }
+    assert(offset == 128);
+}
+
+/* the alpha endpoints are the extremes of the block, so they are exact */
+static void encode_bc7_mode5(unsigned char texels[16][4],
+                             float endpoints[2][4], unsigned char *block) {
+    unsigned char colors[4][4];
+    unsigned char alphas[4][4];
+    int color_selectors[16];
+    int alpha_selectors[16];
+    int values[2][4];
+    int offset = 0;
+    int i, j;
+
+    for (j = 0; j < 3; j++) {
+        values[0][j] = (int)(endpoints[0][j] * 127 / 255 + 0.5f);
+        values[1][j] = (int)(endpoints[1][j] * 127 / 255 + 0.5f);
+    }
+    values[0][3] = 255;
+    values[1][3] = 0;
+    for (i = 0; i < 16; i++) {
+        values[0][3] = texels[i][3] < values[0][3] ? texels[i][3]
+                                                   : values[0][3];
+        values[1][3] = texels[i][3] > values[1][3] ? texels[i][3]
+                                                   : values[1][3];
+    }
+    for (i = 0; i < 4; i++) {
+        int weight = g_bc7_coarse_weights[i];
+        for (j = 0; j < 3; j++) {
+            int value0 = values[0][j] << 1 | values[0][j] >> 6;
+            int value1 = values[1][j] << 1 | values[1][j] >> 6;
+            colors[i][j] = (unsigned char)interpolate_bc7(value0, value1,
+                                                          weight);
+        }
+        alphas[i][0] = (unsigned char)interpolate_bc7(values[0][3],
+                                                      values[1][3], weight);
+    }
+    for (i = 0; i < 16; i++) {
+        color_selectors[i] = select_level(texels[i], colors, 4, 3);
+        alpha_selectors[i] = select_alpha_level(texels[i][3], alphas);
+    }
+    /* the anchor selectors have an implicit zero as their highest bit */
+    if (color_selectors[0] >= 2) {
+        for (j = 0; j < 3; j++) {
+            int value = values[0][j];
+            values[0][j] = values[1][j];
+            values[1][j] = value;
+        }
+        for (i = 0; i < 16; i++) {
+            color_selectors[i] = 3 - color_selectors[i];
+        }
+    }
+    if (alpha_selectors[0] >= 2) {
+        int value = values[0][3];
+        values[0][3] = values[1][3];
+        values[1][3] = value;
+        for (i = 0; i < 16; i++) {
+            alpha_selectors[i] = 3 - alpha_selectors[i];
+        }
+    }
+
+    memset(block, 0, 16);
+    write_bits(block, &offset, 0x20, 6);
+    write_bits(block, &offset, 0, 2);  /* no channel rotation */
+    for (j = 0; j < 3; j++) {
+        write_bits(block, &offset, values[0][j], 7);
+        write_bits(block, &offset, values[1][j], 7);
+    }
+    write_bits(block, &offset, values[0][3], 8);
+    write_bits(block, &offset, values[1][3], 8);
+    for (i = 0; i < 16; i++) {
+        write_bits(block, &offset, color_selectors[i], i == 0 ? 1 : 2);
+    }
+    for (i = 0; i < 16; i++) {
+        write_bits(block, &offset, alpha_selectors[i], i == 0 ? 1 : 2);
+    }
+    assert(offset == 128);
+}
+
+/*
+ * for endpoint refinement, see
+ * https://fgiesen.wordpress.com/2022/11/08/whats-that-magic-computation-in-stb__refineblock/
+ *
+ * once every texel has selected a level, the endpoints that minimize the
+ * squared error for these selections are solved by least squares, and
+ * the block is encoded again as long as the error keeps decreasing
+ */
+
+static void get_block_weights(storage_t storage, unsigned char *block,
+                              float weights[16]) {
+    int i;
+    for (i = 0; i < 16; i++) {
+        if (storage == STORAGE_BC1) {
+            static const float bc1_weights[4] = {0, 1, 1 / 3.0f, 2 / 3.0f};
+            weights[i] = bc1_weights[read_bits(block + 4, i * 2, 2)];
+        } else if (get_bc7_mode(block) == 6) {
+            int offset = i == 0 ? 65 : 65 + 3 + (i - 1) * 4;
+            int selector = read_bits(block, offset, i == 0 ? 3 : 4);
+            weights[i] = g_bc7_weights[selector] / 64.0f;
+        } else {
+            int offset = i == 0 ? 66 : 66 + 1 + (i - 1) * 2;
+            int selector = read_bits(block, offset, i == 0 ? 1 : 2);
+            weights[i] = g_bc7_coarse_weights[selector] / 64.0f;
+        }
+    }
+}
+
+static int refine_endpoints(unsigned char texels[16][4], int channels,
+                            float weights[16], float endpoints[2][4]) {
+    float a = 0, b = 0, c = 0;
+    float sums0[4] = {0, 0, 0, 0};
+    float sums1[4] = {0, 0, 0, 0};
+    float determinant;
+    int i, j;
+
+    for (i = 0; i < 16; i++) {
+        float weight0 = 1 - weights[i];
+        float weight1 = weights[i];
+        a += weight0 * weight0;
+        b += weight0 * weight1;
+        c += weight1 * weight1;
+        for (j = 0; j < channels; j++) {
+            sums0[j] += weight0 * texels[i][j];
+            sums1[j] += weight1 * texels[i][j];
+        }
+    }
+    determinant = a * c - b * b;
+    if (determinant < EPSILON) {
+        return 0;  /* all texels selected the same level */
+    }
+    for (j = 0; j < channels; j++) {
+        float endpoint0 = (c * sums0[j] - b * sums1[j]) / determinant;
+        float endpoint1 = (a * sums1[j] - b * sums0[j]) / determinant;
+        endpoints[0][j] = float_clamp(endpoint0, 0, 255);
+        endpoints[1][j] = float_clamp(endpoint1, 0, 255);
+    }
+    return 1;
+}
+
+static int get_block_error(storage_t storage, unsigned char *block,
+                           unsigned char texels[16][4]) {
+    int error = 0;
+    int i;
+    for (i = 0; i < 16; i++) {
+        unsigned char decoded[4];
+        decode_block_texel(storage, block, i, decoded);
+        error += get_distance(decoded, texels[i], 3);
+        if (storage == STORAGE_BC7) {
+            int delta = decoded[3] - texels[i][3];
+            error += delta * delta * ALPHA_WEIGHT;
+            if (is_alpha_flipped(texels[i][3], decoded[3])) {
+                error += 255 * 255 * ALPHA_WEIGHT;
+            }
+        }
+    }
+    return error;
+}
+
+static void encode_endpoints(storage_t storage, int mode,
+                             unsigned char texels[16][4],
+                             float endpoints[2][4], unsigned char *block) {
+    if (storage == STORAGE_BC1) {
+        encode_bc1(texels, endpoints, block);
+    } else if (mode == 5) {
+        encode_bc7_mode5(texels, endpoints, block);
+    } else {
+        encode_bc7(texels, endpoints, block);
+    }
+}
+
+/* the mode only applies to bc7, the error of the block is returned */
+static int encode_refined(storage_t storage, int mode,
+                          unsigned char texels[16][4], unsigned char *block) {
+    int channels = storage == STORAGE_BC1 || mode == 5 ? 3 : 4;
+    int block_size = storage == STORAGE_BC1 ? 8 : 16;
+    float endpoints[2][4];
+    float weights[16];
+    int error;
+    int i;
+
+    find_endpoints(texels, channels, endpoints);
+    encode_endpoints(storage, mode, texels, endpoints, block);
+    error = get_block_error(storage, block, texels);
+    for (i = 0; i < 2 && error > 0; i++) {
+        unsigned char refined[16];
+        int refined_error;
+        get_block_weights(storage, block, weights);
+        if (!refine_endpoints(texels, channels, weights, endpoints)) {
+            break;
+        }
+        encode_endpoints(storage, mode, texels, endpoints, refined);
+        refined_error = get_block_error(storage, refined, texels);
+        if (refined_error >= error) {
+            break;
+        }
+        memcpy(block, refined, block_size);
+        error = refined_error;
+    }
+    return error;
+}
+
+static void encode_block(storage_t storage, unsigned char texels[16][4],
+                         unsigned char *block) {
+    int error = encode_refined(storage, 6, texels, block);
+    if (storage == STORAGE_BC7 && error > 0) {
+        unsigned char separate[16];
+        if (encode_refined(storage, 5, texels, separate) < error) {
+            memcpy(block, separate, 16);
+        }
+    }
+}
+
+static float decode_unorm8(texture_t *texture, unsigned char value) {
+    return texture->srgb ? g_srgb_table[value] : float_from_uchar(value);
+}
+
+static vec4_t fetch_block_texel(texture_t *texture, int row, int col) {
+    unsigned char *buffer = (unsigned char*)texture->buffer;
+    int block_index = get_block_index(texture, row, col);
+    int index = (row % 4) * 4 + col % 4;
+    unsigned char bytes[4];
+    vec4_t texel;
+    switch (texture->storage) {
+        case STORAGE_BC1:
+            decode_bc1(buffer + block_index * 8, index, bytes);
+            texel.x = decode_unorm8(texture, bytes[0]);
+            texel.y = decode_unorm8(texture, bytes[1]);
+            texel.z = decode_unorm8(texture, bytes[2]);
+            texel.w = float_from_uchar(bytes[3]);
+            break;
+        case STORAGE_BC4:               /* luminance */
+            bytes[0] = decode_bc4(buffer + block_index * 8, index);
+            texel.x = texel.y = texel.z = decode_unorm8(texture, bytes[0]);
+            texel.w = 1;
+            break;
+        case STORAGE_BC5:               /* luminance and alpha */
+            bytes[0] = decode_bc4(buffer + block_index * 16, index);
+            bytes[1] = decode_bc4(buffer + block_index * 16 + 8, index);
+            texel.x = texel.y = texel.z = decode_unorm8(texture, bytes[0]);
+            texel.w = float_from_uchar(bytes[1]);
+            break;
+        case STORAGE_BC7:
+            decode_bc7(buffer + block_index * 16, index, bytes);
+            texel.x = decode_unorm8(texture, bytes[0]);
+            texel.y = decode_unorm8(texture, bytes[1]);
+            texel.z = decode_unorm8(texture, bytes[2]);
+            texel.w = float_from_uchar(bytes[3]);
+            break;
+        default:
+            assert(0);
+            texel = vec4_new(0, 0, 0, 0);
+            break;
+    }
+    return texel;
+}
+
+static vec4_t decode_texel(texture_t *texture, void *buffer, int index) {
+    vec4_t texel;
+    switch (texture->storage) {
+        case STORAGE_RGBA32F:
+            texel = ((vec4_t*)buffer)[index];
+            break;
+        case STORAGE_RGBA16F: {
+            unsigned short *halfs = (unsigned short*)buffer + index * 4;
+            texel.x = float_from_half(halfs[0]);
+            texel.y = float_from_half(halfs[1]);
+            texel.z = float_from_half(halfs[2]);
+            texel.w = float_from_half(halfs[3]);
+            break;
+        }
+        case STORAGE_RGB9E5: {
+            unsigned int packed = ((unsigned int*)buffer)[index];
+            float scale = g_exponent_table[packed >> 27];
+            texel.x = (float)(packed & 0x1FF) * scale;
+            texel.y = (float)((packed >> 9) & 0x1FF) * scale;
+            texel.z = (float)((packed >> 18) & 0x1FF) * scale;
+            texel.w = 1;
+            break;
+        }
+        case STORAGE_RGBA8: {
+            unsigned char *bytes = (unsigned char*)buffer + index * 4;
+            texel.x = decode_unorm8(texture, bytes[0]);
+            texel.y = decode_unorm8(texture, bytes[1]);
+            texel.z = decode_unorm8(texture, bytes[2]);
+            texel.w = float_from_uchar(bytes[3]);
+            break;
+        }
+        case STORAGE_RG8: {             /* luminance and alpha */
+            unsigned char *bytes = (unsigned char*)buffer + index * 2;
+            texel.x = texel.y = texel.z = decode_unorm8(texture, bytes[0]);
+            texel.w = float_from_uchar(bytes[1]);
+            break;
+        }
+        case STORAGE_R8: {              /* luminance */
+            unsigned char *bytes = (unsigned char*)buffer + index;
+            texel.x = texel.y = texel.z = decode_unorm8(texture, bytes[0]);
+            texel.w = 1;
+            break;
+        }
+        case STORAGE_R32F:              /* depth */
+            texel.x = texel.y = texel.z = ((float*)buffer)[index];
+            texel.w = 1;
+            break;
+        default:
+            assert(0);
+            texel = vec4_new(0, 0, 0, 0);
+            break;
+    }
+    return texel;
+}
+
+/* virtual texturing */
+
+/*
+ * for virtual texturing, see
+ * https://silverspaceship.com/src/svt/
+ * https://www.mrelusive.com/publications/papers/Software-Virtual-Textures.pdf
+ *
+ * the levels of a virtual texture that are larger than a page are split
+ * into pages of 128x128 texels which are written to a page file and made
+ * resident on demand, a fetch from a page that is not resident requests
+ * it and falls back to the next coarser level, down to the levels that
+ * fit in a single page and are always resident
+ *
+ * the requested pages are loaded between frames into a pool of bounded
+ * size, evicting the least recently used pages, the texels of the pages
+ * only change between frames, and the fetches of each thread flag the
+ * pages in a row of their own, without locking, the rows are merged into
+ * the frame stamps and requests of the pages between frames
+ */
+
+#define PAGE_SIZE 128
+
+typedef struct {
+    unsigned char *texels;  /* NULL if not resident */
+    int size;               /* of the texels in bytes */
+    long offset;            /* of the texels in the page file */
+    int last_used;          /* frame of the last fetch */
+    int requested;
+} page_t;
+
+struct pagetable {
+    int num_pages_x, num_pages_y;
+    page_t *pages;
+    texture_t *coarser;
+    unsigned char *fetched;  /* a row of flags per thread */
+    struct pagetable *next;
+};
+
+static FILE *g_page_file = NULL;
+static struct pagetable *g_pagetables = NULL;
+static pagestats_t g_page_stats = {0, 0, 0, 0, 0, 0};
+static int g_page_budget = 16 * 1024 * 1024;
+static int g_frame = 0;
+
+static vec4_t fetch_texel(texture_t *texture, int row, int col);
+
+static vec4_t fetch_page_texel(texture_t *texture, int row, int col) {
+    struct pagetable *pagetable = texture->pagetable;
+    int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+    int page_index = (row / PAGE_SIZE) * pagetable->num_pages_x
+                     + col / PAGE_SIZE;
+    unsigned char *texels = pagetable->pages[page_index].texels;
+    unsigned char *fetched = &pagetable->fetched[workers_get_index()
+                                                 * num_pages + page_index];
+
+    if (!*fetched) {
+        *fetched = 1;  /* checked first, so the line is dirtied once */
+    }
+    if (texels != NULL) {
+        int index = (row % PAGE_SIZE) * PAGE_SIZE + col % PAGE_SIZE;
+        return decode_texel(texture, texels, index);
+    } else {
+        texture_t *coarser = pagetable->coarser;
+        int coarser_row = row / 2 < coarser->height ? row / 2
+                                                     : coarser->height - 1;
+        int coarser_col = col / 2 < coarser->width ? col / 2
+                                                   : coarser->width - 1;
+        return fetch_texel(coarser, coarser_row, coarser_col);
+    }
+}
+
+static vec4_t fetch_texel(texture_t *texture, int row, int col) {
+    if (texture->pagetable != NULL) {
+        return fetch_page_texel(texture, row, col);
+    } else if (is_compressed(texture->storage)) {
+        return fetch_block_texel(texture, row, col);
+    } else {
+        int index = get_texel_index(texture, row, col);
+        return decode_texel(texture, texture->buffer, index);
+    }
+}
 
 /* texture related functions */
 
-texture_t *texture_create(int width, int height) {
-    int buffer_size = sizeof(vec4_t) * width * height;
+static texture_t *create_texture(int width, int height, storage_t storage) {
+    int buffer_size = get_buffer_size(storage, width, height);
     texture_t *texture;
 
     assert(width > 0 && height > 0);
@@ -18,44 +1018,82 @@ texture_t *texture_create(int width, int height) {
     texture = (texture_t*)malloc(sizeof(texture_t));
     texture->width = width;
     texture->height = height;
-    texture->buffer = (vec4_t*)malloc(buffer_size);
+    texture->storage = storage;
+    texture->srgb = 0;
+    texture->layout = LAYOUT_LINEAR;
+    texture->buffer = malloc(buffer_size);
     memset(texture->buffer, 0, buffer_size);
+    texture->num_mipmaps = 0;
+    texture->mipmaps = NULL;
+    texture->pagetable = NULL;
+    texture->framebuffer = NULL;
 
     return texture;
 }
 
+texture_t *texture_create(int width, int height) {
+    return create_texture(width, height, STORAGE_RGBA32F);
+}
+
+static void release_pagetable(struct pagetable *pagetable);
+
 void texture_release(texture_t *texture) {
-    free(texture->buffer);
+    int i;
+    if (texture->pagetable != NULL) {
+        release_pagetable(texture->pagetable);
+    }
+    for (i = 0; i < texture->num_mipmaps; i++) {
+        texture_release(texture->mipmaps[i]);
+    }
+    free(texture->mipmaps);
+    if (texture->framebuffer == NULL) {
+        free(texture->buffer);
+    }
     free(texture);
 }
 
+static storage_t select_storage(image_t *image, usage_t usage) {
+    int channels = image->channels;
+    if (image->format == FORMAT_LDR
+            || usage == USAGE_LDR_COLOR || usage == USAGE_LDR_DATA) {
+        if (channels == 1) {
+            return STORAGE_R8;
+        } else if (channels == 2) {
+            return STORAGE_RG8;
+        } else {
+            return STORAGE_RGBA8;
+        }
+    } else {
+        if (channels == 1 || channels == 3) {
+            return STORAGE_RGB9E5;
+        } else {
+            return STORAGE_RGBA16F;
+        }
+    }
+}
+
 static void ldr_image_to_texture(image_t *image, texture_t *texture) {
     int num_pixels = image->width * image->height;
+    unsigned char *bytes = (unsigned char*)texture->buffer;
     int i;
 
-    for (i = 0; i < num_pixels; i++) {
-        unsigned char *pixel = &image->ldr_buffer[i * image->channels];
-        vec4_t texel = {0, 0, 0, 1};
-        if (image->channels == 1) {             /* GL_LUMINANCE */
-            texel.x = texel.y = texel.z = float_from_uchar(pixel[0]);
-        } else if (image->channels == 2) {      /* GL_LUMINANCE_ALPHA */
-            texel.x = texel.y = texel.z = float_from_uchar(pixel[0]);
-            texel.w = float_from_uchar(pixel[1]);
-        } else if (image->channels == 3) {      /* GL_RGB */
-            texel.x = float_from_uchar(pixel[0]);
-            texel.y = float_from_uchar(pixel[1]);
-            texel.z = float_from_uchar(pixel[2]);
-        } else {                                /* GL_RGBA */
-            texel.x = float_from_uchar(pixel[0]);
-            texel.y = float_from_uchar(pixel[1]);
-            texel.z = float_from_uchar(pixel[2]);
-            texel.w = float_from_uchar(pixel[3]);
+    if (image->channels == 3) {                 /* GL_RGB */
+        for (i = 0; i < num_pixels; i++) {
+            unsigned char *pixel = &image->ldr_buffer[i * 3];
+            bytes[i * 4 + 0] = pixel[0];
+            bytes[i * 4 + 1] = pixel[1];
+            bytes[i * 4 + 2] = pixel[2];
+            bytes[i * 4 + 3] = 255;
         }
-        texture->buffer[i] = texel;
+    } else {                                    /* the same layout */
+        int buffer_size = get_texel_size(texture->storage) * num_pixels;
+        assert(image->channels * num_pixels == buffer_size);
+        memcpy(bytes, image->ldr_buffer, buffer_size);
     }
 }
 
-static void hdr_image_to_texture(image_t *image, texture_t *texture) {
+static void hdr_image_to_texture(image_t *image, texture_t *texture,
+                                 usage_t usage) {
     int num_pixels = image->width * image->height;
     int i;
 
@@ -77,93 +1115,214 @@ static void hdr_image_to_texture(image_t *image, texture_t *texture) {
             texel.z = pixel[2];
             texel.w = pixel[3];
         }
-        texture->buffer[i] = texel;
+        if (usage == USAGE_LDR_COLOR) {         /* linear to srgb */
+            texel.x = float_linear2srgb(float_aces(texel.x));
+            texel.y = float_linear2srgb(float_aces(texel.y));
+            texel.z = float_linear2srgb(float_aces(texel.z));
+        }
+        store_texel(texture, i, texel);
     }
 }
 
-static void srgb_to_linear(texture_t *texture) {
-    int num_pixels = texture->width * texture->height;
-    int i;
+texture_t *texture_from_image(image_t *image, usage_t usage) {
+    texture_t *texture;
 
-    for (i = 0; i < num_pixels; i++) {
-        vec4_t *pixel = &texture->buffer[i];
-        pixel->x = float_srgb2linear(pixel->x);
-        pixel->y = float_srgb2linear(pixel->y);
-        pixel->z = float_srgb2linear(pixel->z);
+    initialize_tables();
+    texture = create_texture(image->width, image->height,
+                             select_storage(image, usage));
+    if (image->format == FORMAT_LDR) {
+        ldr_image_to_texture(image, texture);
+        texture->srgb = usage == USAGE_HDR_COLOR;
+    } else {
+        hdr_image_to_texture(image, texture, usage);
     }
+
+    return texture;
 }
 
-static void linear_to_srgb(texture_t *texture) {
-    int num_pixels = texture->width * texture->height;
-    int i;
+texture_t *texture_from_file(const char *filename, usage_t usage) {
+    image_t *image = image_load(filename);
+    texture_t *texture = texture_from_image(image, usage);
+    image_release(image);
+    return texture;
+}
 
-    for (i = 0; i < num_pixels; i++) {
-        vec4_t *pixel = &texture->buffer[i];
-        pixel->x = float_linear2srgb(float_aces(pixel->x));
-        pixel->y = float_linear2srgb(float_aces(pixel->y));
-        pixel->z = float_linear2srgb(float_aces(pixel->z));
-    }
+/*
+ * render targets are textures that share the buffer of a framebuffer
+ * attachment, so that they can be sampled after the framebuffer is flushed
+ * without copying it, they must be released before the framebuffer
+ */
+static texture_t *create_target(framebuffer_t *framebuffer, storage_t storage,
+                                void *buffer) {
+    texture_t *texture = (texture_t*)malloc(sizeof(texture_t));
+    texture->width = framebuffer->width;
+    texture->height = framebuffer->height;
+    texture->storage = storage;
+    texture->srgb = 0;
+    texture->layout = LAYOUT_LINEAR;
+    texture->buffer = buffer;
+    texture->num_mipmaps = 0;
+    texture->mipmaps = NULL;
+    texture->pagetable = NULL;
+    texture->framebuffer = framebuffer;
+    return texture;
 }
 
-texture_t *texture_from_file(const char *filename, usage_t usage) {
-    texture_t *texture;
-    image_t *image;
+texture_t *texture_from_colorbuffer(framebuffer_t *framebuffer) {
+    return create_target(framebuffer, STORAGE_RGBA8,
+                         framebuffer->color_buffer);
+}
 
-    image = image_load(filename);
-    texture = texture_create(image->width, image->height);
-    if (image->format == FORMAT_LDR) {
-        ldr_image_to_texture(image, texture);
-        if (usage == USAGE_HDR_COLOR) {
-            srgb_to_linear(texture);
-        }
+texture_t *texture_from_depthbuffer(framebuffer_t *framebuffer) {
+    return create_target(framebuffer, STORAGE_R32F,
+                         framebuffer->depth_buffer);
+}
+
+/*
+ * compress an ldr texture and its mipmaps in place, single channel
+ * textures use bc4, luminance and alpha use bc5, rgba uses bc1 if it is
+ * opaque and bc7 otherwise, the root mean square errors of the channels
+ * of the top level are returned in units of the source bytes, in the order
+ * of the source channels, and zero for the channels it lacks
+ */
+vec4_t texture_compress(texture_t *texture) {
+    int width = texture->width;
+    int height = texture->height;
+    unsigned char *source = (unsigned char*)texture->buffer;
+    int channels = get_texel_size(texture->storage);
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    int block_size;
+    unsigned char *buffer;
+    storage_t storage;
+    double errors[4] = {0, 0, 0, 0};
+    double num_texels = (double)width * height;
+    int x, y, i, j;
+
+    assert(texture->framebuffer == NULL);
+    assert(texture->storage == STORAGE_R8 || texture->storage == STORAGE_RG8
+           || texture->storage == STORAGE_RGBA8);
+    if (channels == 1) {
+        storage = STORAGE_BC4;
+    } else if (channels == 2) {
+        storage = STORAGE_BC5;
     } else {
-        hdr_image_to_texture(image, texture);
-        if (usage == USAGE_LDR_COLOR) {
-            linear_to_srgb(texture);
+        storage = STORAGE_BC1;
+        for (y = 0; y < height && storage == STORAGE_BC1; y++) {
+            for (x = 0; x < width; x++) {
+                int index = get_texel_index(texture, y, x);
+                if (source[index * 4 + 3] != 255) {
+                    storage = STORAGE_BC7;
+                    break;
+                }
+            }
         }
     }
-    image_release(image);
+    block_size = storage == STORAGE_BC1 || storage == STORAGE_BC4 ? 8 : 16;
+    buffer = (unsigned char*)malloc(get_buffer_size(storage, width, height));
 
-    return texture;
-}
+    for (y = 0; y < blocks_y; y++) {
+        for (x = 0; x < blocks_x; x++) {
+            unsigned char *block = buffer + (y * blocks_x + x) * block_size;
+            unsigned char texels[16][4];
+            memset(texels, 0, sizeof(texels));
+            for (i = 0; i < 16; i++) {
+                /* replicate the edges into the blocks that overhang */
+                int row = y * 4 + i / 4 < height ? y * 4 + i / 4 : height - 1;
+                int col = x * 4 + i % 4 < width ? x * 4 + i % 4 : width - 1;
+                int index = get_texel_index(texture, row, col);
+                memcpy(texels[i], &source[index * channels], channels);
+            }
 
-void texture_from_colorbuffer(texture_t *texture, framebuffer_t *framebuffer) {
-    int num_pixels = texture->width * texture->height;
-    int i;
+            if (storage == STORAGE_BC4) {
+                encode_bc4(texels, 0, block);
+            } else if (storage == STORAGE_BC5) {
+                encode_bc4(texels, 0, block);
+                encode_bc4(texels, 1, block + 8);
+            } else {
+                encode_block(storage, texels, block);
+            }
 
-    assert(texture->width == framebuffer->width);
-    assert(texture->height == framebuffer->height);
+            for (i = 0; i < 16; i++) {
+                if (y * 4 + i / 4 < height && x * 4 + i % 4 < width) {
+                    unsigned char decoded[4];
+                    decode_block_texel(storage, block, i, decoded);
+                    for (j = 0; j < channels; j++) {
+                        int delta = decoded[j] - texels[i][j];
+                        errors[j] += delta * delta;
+                    }
+                }
+            }
+        }
+    }
 
-    for (i = 0; i < num_pixels; i++) {
-        unsigned char *color = &framebuffer->color_buffer[i * 4];
-        float r = float_from_uchar(color[0]);
-        float g = float_from_uchar(color[1]);
-        float b = float_from_uchar(color[2]);
-        float a = float_from_uchar(color[3]);
-        texture->buffer[i] = vec4_new(r, g, b, a);
+    free(texture->buffer);
+    texture->buffer = buffer;
+    texture->storage = storage;
+    texture->layout = LAYOUT_TILED;
+    for (i = 0; i < texture->num_mipmaps; i++) {
+        texture_compress(texture->mipmaps[i]);
     }
+    return vec4_new((float)sqrt(errors[0] / num_texels),
+                    (float)sqrt(errors[1] / num_texels),
+                    (float)sqrt(errors[2] / num_texels),
+                    (float)sqrt(errors[3] / num_texels));
 }
 
-void texture_from_depthbuffer(texture_t *texture, framebuffer_t *framebuffer) {
-    int num_pixels = texture->width * texture->height;
+/*
+ * swizzle the texels of a texture and its mipmaps in place, compressed
+ * textures and virtual levels are left as they are since their blocks
+ * and pages are already tiled
+ */
+void texture_set_layout(texture_t *texture, layout_t layout) {
     int i;
+    assert(texture->framebuffer == NULL);
+    if (!is_compressed(texture->storage) && texture->pagetable == NULL
+            && texture->layout != layout) {
+        int texel_size = get_texel_size(texture->storage);
+        int width = texture->width;
+        int height = texture->height;
+        unsigned char *source = (unsigned char*)texture->buffer;
+        texture_t target = *texture;
+        int buffer_size, row, col;
 
-    assert(texture->width == framebuffer->width);
-    assert(texture->height == framebuffer->height);
-
-    for (i = 0; i < num_pixels; i++) {
-        float depth = framebuffer->depth_buffer[i];
-        texture->buffer[i] = vec4_new(depth, depth, depth, 1);
+        if (layout == LAYOUT_TILED) {
+            width = align_to_tile(width);
+            height = align_to_tile(height);
+        }
+        buffer_size = get_buffer_size(texture->storage, width, height);
+        target.layout = layout;
+        target.buffer = malloc(buffer_size);
+        memset(target.buffer, 0, buffer_size);
+        for (row = 0; row < texture->height; row++) {
+            for (col = 0; col < texture->width; col++) {
+                int src_index = get_texel_index(texture, row, col);
+                int dst_index = get_texel_index(&target, row, col);
+                memcpy((unsigned char*)target.buffer + dst_index * texel_size,
+                       source + src_index * texel_size, texel_size);
+            }
+        }
+        free(texture->buffer);
+        texture->buffer = target.buffer;
+        texture->layout = layout;
+    }
+    for (i = 0; i < texture->num_mipmaps; i++) {
+        texture_set_layout(texture->mipmaps[i], layout);
     }
 }
 
+vec4_t texture_fetch(texture_t *texture, int row, int col) {
+    assert(row >= 0 && row < texture->height);
+    assert(col >= 0 && col < texture->width);
+    return fetch_texel(texture, row, col);
+}
+
 vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord) {
     float u = texcoord.x - (float)floor(texcoord.x);
     float v = texcoord.y - (float)floor(texcoord.y);
     int c = (int)((texture->width - 1) * u);
     int r = (int)((texture->height - 1) * v);
-    int index = r * texture->width + c;
-    return texture->buffer[index];
+    return fetch_texel(texture, r, c);
 }
 
 vec4_t texture_clamp_sample(texture_t *texture, vec2_t texcoord) {
@@ -171,14 +1330,385 @@ vec4_t texture_clamp_sample(texture_t *texture, vec2_t texcoord) {
     float v = float_saturate(texcoord.y);
     int c = (int)((texture->width - 1) * u);
     int r = (int)((texture->height - 1) * v);
-    int index = r * texture->width + c;
-    return texture->buffer[index];
+    return fetch_texel(texture, r, c);
 }
 
 vec4_t texture_sample(texture_t *texture, vec2_t texcoord) {
     return texture_repeat_sample(texture, texcoord);
 }
 
+/* mipmapping */
+
+/*
+ * for mipmapping and texture filtering, see subsection 3.7.7 of
+ * https://www.khronos.org/registry/OpenGL/specs/es/2.0/es_full_spec_2.0.pdf
+ * http://number-none.com/product/Mipmapping,%20Part%201/index.html
+ *
+ * each mipmap is a box filtered half of the previous level, the texels are
+ * averaged after they are decoded, so that srgb colors are averaged in
+ * linear space and encoded again when stored, the level of detail is the
+ * log2 of the longest screen space derivative of the texcoord in texels,
+ * bilinear filtering samples the nearest level and trilinear filtering
+ * blends the two levels around the level of detail
+ */
+
+static texture_t *downsample_texture(texture_t *source) {
+    int width = source->width > 1 ? source->width / 2 : 1;
+    int height = source->height > 1 ? source->height / 2 : 1;
+    texture_t *target = create_texture(width, height, source->storage);
+    int r, c;
+
+    target->srgb = source->srgb;
+    for (r = 0; r < height; r++) {
+        for (c = 0; c < width; c++) {
+            int r0 = r * 2;
+            int c0 = c * 2;
+            int r1 = r0 + 1 < source->height ? r0 + 1 : r0;
+            int c1 = c0 + 1 < source->width ? c0 + 1 : c0;
+            vec4_t texel = fetch_texel(source, r0, c0);
+            texel = vec4_add(texel, fetch_texel(source, r0, c1));
+            texel = vec4_add(texel, fetch_texel(source, r1, c0));
+            texel = vec4_add(texel, fetch_texel(source, r1, c1));
+            store_texel(target, r * width + c, vec4_mul(texel, 0.25f));
+        }
+    }
+    return target;
+}
+
+void texture_generate_mipmaps(texture_t *texture) {
+    int size = texture->width > texture->height
+               ? texture->width : texture->height;
+    texture_t *level = texture;
+    int num_mipmaps = 0;
+    int i;
+
+    assert(!is_compressed(texture->storage));
+    assert(texture->layout == LAYOUT_LINEAR);
+    assert(texture->framebuffer == NULL);
+    assert(texture->num_mipmaps == 0);
+    while (size > 1) {
+        size /= 2;
+        num_mipmaps += 1;
+    }
+    if (num_mipmaps > 0) {
+        int sizeof_mipmaps = sizeof(texture_t*) * num_mipmaps;
+        texture->mipmaps = (texture_t**)malloc(sizeof_mipmaps);
+        for (i = 0; i < num_mipmaps; i++) {
+            level = downsample_texture(level);
+            texture->mipmaps[i] = level;
+        }
+        texture->num_mipmaps = num_mipmaps;
+    }
+}
+
+float texture_get_lod(texture_t *texture, vec2_t ddx, vec2_t ddy) {
+    float width = (float)texture->width;
+    float height = (float)texture->height;
+    float length_x = vec2_length(vec2_new(ddx.x * width, ddx.y * height));
+    float length_y = vec2_length(vec2_new(ddy.x * width, ddy.y * height));
+    float rho = float_max(length_x, length_y);
+    return rho > 0 ? (float)(log(rho) / log(2)) : 0;
+}
+
+static int wrap_integer(int value, int size) {
+    int wrapped = value % size;
+    return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+static vec4_t sample_nearest(texture_t *level, vec2_t texcoord) {
+    float u = texcoord.x - (float)floor(texcoord.x);
+    float v = texcoord.y - (float)floor(texcoord.y);
+    int c = (int)(u * (float)level->width);
+    int r = (int)(v * (float)level->height);
+    c = c < level->width ? c : level->width - 1;
+    r = r < level->height ? r : level->height - 1;
+    return fetch_texel(level, r, c);
+}
+
+static vec4_t sample_bilinear(texture_t *level, vec2_t texcoord) {
+    float u = texcoord.x - (float)floor(texcoord.x);
+    float v = texcoord.y - (float)floor(texcoord.y);
+    float x = u * (float)level->width - 0.5f;
+    float y = v * (float)level->height - 0.5f;
+    float x0 = (float)floor(x);
+    float y0 = (float)floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    int c0 = wrap_integer((int)x0, level->width);
+    int r0 = wrap_integer((int)y0, level->height);
+    int c1 = wrap_integer((int)x0 + 1, level->width);
+    int r1 = wrap_integer((int)y0 + 1, level->height);
+    vec4_t top = vec4_lerp(fetch_texel(level, r0, c0),
+                           fetch_texel(level, r0, c1), fx);
+    vec4_t bottom = vec4_lerp(fetch_texel(level, r1, c0),
+                              fetch_texel(level, r1, c1), fx);
+    return vec4_lerp(top, bottom, fy);
+}
+
+static texture_t *get_level(texture_t *texture, int level) {
+    return level == 0 ? texture : texture->mipmaps[level - 1];
+}
+
+vec4_t texture_sample_lod(texture_t *texture, vec2_t texcoord, float lod,
+                          filter_t filter) {
+    float max_lod = (float)texture->num_mipmaps;
+    lod = float_clamp(lod, 0, max_lod);
+    if (filter == FILTER_TRILINEAR && lod < max_lod) {
+        int level = (int)lod;
+        float weight = lod - (float)level;
+        vec4_t sample = sample_bilinear(get_level(texture, level), texcoord);
+        if (weight > 0) {
+            /* magnified textures only touch the top level */
+            texture_t *next = get_level(texture, level + 1);
+            sample = vec4_lerp(sample, sample_bilinear(next, texcoord), weight);
+        }
+        return sample;
+    } else if (filter == FILTER_TRILINEAR) {
+        return sample_bilinear(get_level(texture, texture->num_mipmaps),
+                               texcoord);
+    } else {
+        texture_t *level = get_level(texture, (int)(lod + 0.5f));
+        if (filter == FILTER_BILINEAR) {
+            return sample_bilinear(level, texcoord);
+        } else {
+            return sample_nearest(level, texcoord);
+        }
+    }
+}
+
+vec4_t texture_sample_grad(texture_t *texture, vec2_t texcoord,
+                           vec2_t ddx, vec2_t ddy, filter_t filter) {
+    float lod = texture_get_lod(texture, ddx, ddy);
+    return texture_sample_lod(texture, texcoord, lod, filter);
+}
+
+/* page management */
+
+static void split_into_pages(texture_t *level, texture_t *coarser) {
+    int texel_size = get_texel_size(level->storage);
+    int sizeof_page = texel_size * PAGE_SIZE * PAGE_SIZE;
+    unsigned char *buffer = (unsigned char*)level->buffer;
+    struct pagetable *pagetable;
+    unsigned char *texels;
+    int num_pages, x, y, r;
+
+    pagetable = (struct pagetable*)malloc(sizeof(struct pagetable));
+    pagetable->num_pages_x = (level->width + PAGE_SIZE - 1) / PAGE_SIZE;
+    pagetable->num_pages_y = (level->height + PAGE_SIZE - 1) / PAGE_SIZE;
+    num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+    pagetable->pages = (page_t*)malloc(sizeof(page_t) * num_pages);
+    pagetable->coarser = coarser;
+    pagetable->fetched = (unsigned char*)malloc(MAX_THREADS * num_pages);
+    memset(pagetable->fetched, 0, MAX_THREADS * num_pages);
+
+    if (g_page_file == NULL) {
+        g_page_file = tmpfile();
+        assert(g_page_file != NULL);
+    }
+    fseek(g_page_file, 0, SEEK_END);
+    texels = (unsigned char*)malloc(sizeof_page);
+    for (y = 0; y < pagetable->num_pages_y; y++) {
+        for (x = 0; x < pagetable->num_pages_x; x++) {
+            page_t *page = &pagetable->pages[y * pagetable->num_pages_x + x];
+            int col = x * PAGE_SIZE;
+            int num_cols = level->width - col < PAGE_SIZE
+                           ? level->width - col : PAGE_SIZE;
+            memset(texels, 0, sizeof_page);
+            for (r = 0; r < PAGE_SIZE && y * PAGE_SIZE + r < level->height;
+                 r++) {
+                int row = y * PAGE_SIZE + r;
+                int index = row * level->width + col;
+                memcpy(texels + r * PAGE_SIZE * texel_size,
+                       buffer + index * texel_size, num_cols * texel_size);
+            }
+            page->texels = NULL;
+            page->size = sizeof_page;
+            page->offset = ftell(g_page_file);
+            page->last_used = -1;
+            page->requested = 0;
+            fwrite(texels, 1, sizeof_page, g_page_file);
+        }
+    }
+    free(texels);
+
+    free(level->buffer);
+    level->buffer = NULL;
+    level->pagetable = pagetable;
+    pagetable->next = g_pagetables;
+    g_pagetables = pagetable;
+}
+
+static void release_pagetable(struct pagetable *pagetable) {
+    int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+    struct pagetable **link = &g_pagetables;
+    int i;
+    for (i = 0; i < num_pages; i++) {
+        page_t *page = &pagetable->pages[i];
+        if (page->texels != NULL) {
+            g_page_stats.num_resident -= 1;
+            g_page_stats.resident_bytes -= page->size;
+            free(page->texels);
+        }
+    }
+    while (*link != pagetable) {
+        link = &(*link)->next;
+    }
+    *link = pagetable->next;
+    free(pagetable->fetched);
+    free(pagetable->pages);
+    free(pagetable);
+    if (g_pagetables == NULL && g_page_file != NULL) {
+        fclose(g_page_file);
+        g_page_file = NULL;
+    }
+}
+
+/*
+ * make the levels of a texture that are larger than a page virtual, the
+ * mipmaps are generated first if needed, so that every level falls back
+ * to a coarser one
+ */
+void texture_make_virtual(texture_t *texture) {
+    int i;
+    assert(!is_compressed(texture->storage));
+    assert(texture->layout == LAYOUT_LINEAR);
+    if (texture->num_mipmaps == 0) {
+        texture_generate_mipmaps(texture);
+    }
+    for (i = 0; i < texture->num_mipmaps; i++) {
+        texture_t *level = get_level(texture, i);
+        if (level->width > PAGE_SIZE || level->height > PAGE_SIZE) {
+            split_into_pages(level, get_level(texture, i + 1));
+        }
+    }
+}
+
+static page_t *find_lru_page(void) {
+    struct pagetable *pagetable;
+    page_t *lru_page = NULL;
+    for (pagetable = g_pagetables; pagetable; pagetable = pagetable->next) {
+        int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+        int i;
+        for (i = 0; i < num_pages; i++) {
+            page_t *page = &pagetable->pages[i];
+            /* the pages of the last frame are likely to be fetched again */
+            if (page->texels != NULL && page->last_used < g_frame) {
+                if (lru_page == NULL || page->last_used < lru_page->last_used) {
+                    lru_page = page;
+                }
+            }
+        }
+    }
+    return lru_page;
+}
+
+static int load_page(page_t *page) {
+    while (g_page_stats.resident_bytes + page->size > g_page_budget) {
+        page_t *lru_page = find_lru_page();
+        if (lru_page == NULL) {
+            return 0;
+        }
+        free(lru_page->texels);
+        lru_page->texels = NULL;
+        g_page_stats.num_evictions += 1;
+        g_page_stats.num_resident -= 1;
+        g_page_stats.resident_bytes -= lru_page->size;
+    }
+    page->texels = (unsigned char*)malloc(page->size);
+    fseek(g_page_file, page->offset, SEEK_SET);
+    if (fread(page->texels, 1, page->size, g_page_file) != (size_t)page->size) {
+        assert(0);
+    }
+    g_page_stats.num_loads += 1;
+    g_page_stats.num_resident += 1;
+    g_page_stats.resident_bytes += page->size;
+    return 1;
+}
+
+/* merge and clear the flags of the threads into the pages */
+static void merge_fetched(struct pagetable *pagetable) {
+    int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+    int t, i;
+    for (t = 0; t < MAX_THREADS; t++) {
+        unsigned char *fetched = &pagetable->fetched[t * num_pages];
+        for (i = 0; i < num_pages; i++) {
+            if (fetched[i]) {
+                page_t *page = &pagetable->pages[i];
+                page->last_used = g_frame;
+                if (page->texels == NULL) {
+                    page->requested = 1;
+                }
+                fetched[i] = 0;
+            }
+        }
+    }
+}
+
+/*
+ * count the pages fetched during the last frame and load the requested
+ * ones, must be called between frames, coarser levels are split later
+ * and come first in the list, so that they are loaded first
+ */
+void texture_update_pages(void) {
+    struct pagetable *pagetable;
+    int pool_full = 0;
+    for (pagetable = g_pagetables; pagetable; pagetable = pagetable->next) {
+        merge_fetched(pagetable);
+    }
+    for (pagetable = g_pagetables; pagetable; pagetable = pagetable->next) {
+        int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+        int i;
+        for (i = 0; i < num_pages; i++) {
+            page_t *page = &pagetable->pages[i];
+            if (page->last_used == g_frame) {
+                if (page->texels != NULL) {
+                    g_page_stats.num_hits += 1;
+                } else {
+                    g_page_stats.num_misses += 1;
+                }
+            }
+            if (page->requested && !pool_full) {
+                if (load_page(page)) {
+                    page->requested = 0;
+                } else {
+                    pool_full = 1;
+                }
+            }
+        }
+    }
+    g_frame += 1;
+}
+
+void texture_set_page_budget(int page_budget) {
+    g_page_budget = page_budget;
+}
+
+/* evict every resident page and drop the requests, between frames */
+void texture_evict_pages(void) {
+    struct pagetable *pagetable;
+    for (pagetable = g_pagetables; pagetable; pagetable = pagetable->next) {
+        int num_pages = pagetable->num_pages_x * pagetable->num_pages_y;
+        int i;
+        for (i = 0; i < num_pages; i++) {
+            page_t *page = &pagetable->pages[i];
+            if (page->texels != NULL) {
+                free(page->texels);
+                page->texels = NULL;
+                g_page_stats.num_evictions += 1;
+                g_page_stats.num_resident -= 1;
+                g_page_stats.resident_bytes -= page->size;
+            }
+            page->last_used = -1;
+            page->requested = 0;
+        }
+        memset(pagetable->fetched, 0, MAX_THREADS * num_pages);
+    }
+}
+
+pagestats_t texture_get_page_stats(void) {
+    return g_page_stats;
+}
+
 /* cubemap related functions */
 
 cubemap_t *cubemap_from_files(const char *positive_x, const char *negative_x,
@@ -254,6 +1784,13 @@ static int select_cubemap_face(vec3_t direction, vec2_t *texcoord) {
     return face_index;
 }
 
+void cubemap_set_layout(cubemap_t *cubemap, layout_t layout) {
+    int i;
+    for (i = 0; i < 6; i++) {
+        texture_set_layout(cubemap->faces[i], layout);
+    }
+}
+
 vec4_t cubemap_repeat_sample(cubemap_t *cubemap, vec3_t direction) {
     vec2_t texcoord;
     int face_index = select_cubemap_face(direction, &texcoord);
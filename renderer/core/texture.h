@@ -2,6 +2,7 @@
 #define TEXTURE_H
 
 #include "graphics.h"
+#include "image.h"
 #include "maths.h"
 
 typedef enum {
@@ -11,11 +12,55 @@ typedef enum {
     USAGE_HDR_DATA
 } usage_t;
 
-typedef struct {
+typedef enum {
+    STORAGE_RGBA32F,
+    STORAGE_RGBA16F,
+    STORAGE_RGB9E5,
+    STORAGE_RGBA8,
+    STORAGE_RG8,
+    STORAGE_R8,
+    STORAGE_R32F,
+    STORAGE_BC1,
+    STORAGE_BC4,
+    STORAGE_BC5,
+    STORAGE_BC7
+} storage_t;
+
+typedef enum {
+    LAYOUT_LINEAR,
+    LAYOUT_TILED
+} layout_t;
+
+typedef enum {
+    FILTER_NEAREST,
+    FILTER_BILINEAR,
+    FILTER_TRILINEAR
+} filter_t;
+
+typedef struct texture {
     int width, height;
-    vec4_t *buffer;
+    storage_t storage;
+    int srgb;  /* color channels are decoded from srgb on fetch */
+    layout_t layout;
+    void *buffer;
+    /* for mipmapping */
+    int num_mipmaps;
+    struct texture **mipmaps;  /* halved successively, NULL if none */
+    /* for virtual texturing */
+    struct pagetable *pagetable;  /* NULL if the texels are resident */
+    /* for render targets */
+    framebuffer_t *framebuffer;  /* owner of the buffer, NULL if none */
 } texture_t;
 
+typedef struct {
+    int num_hits;        /* resident pages fetched, once per frame */
+    int num_misses;      /* missing pages fetched, once per frame */
+    int num_loads;
+    int num_evictions;
+    int num_resident;
+    int resident_bytes;
+} pagestats_t;
+
 typedef struct {
     texture_t *faces[6];
 } cubemap_t;
@@ -24,11 +69,28 @@ typedef struct {
 texture_t *texture_create(int width, int height);
 void texture_release(texture_t *texture);
 texture_t *texture_from_file(const char *filename, usage_t usage);
-void texture_from_colorbuffer(texture_t *texture, framebuffer_t *framebuffer);
-void texture_from_depthbuffer(texture_t *texture, framebuffer_t *framebuffer);
+texture_t *texture_from_image(image_t *image, usage_t usage);
+texture_t *texture_from_colorbuffer(framebuffer_t *framebuffer);
+texture_t *texture_from_depthbuffer(framebuffer_t *framebuffer);
+vec4_t texture_fetch(texture_t *texture, int row, int col);
+vec4_t texture_compress(texture_t *texture);
+void texture_set_layout(texture_t *texture, layout_t layout);
+void texture_generate_mipmaps(texture_t *texture);
+float texture_get_lod(texture_t *texture, vec2_t ddx, vec2_t ddy);
 vec4_t texture_repeat_sample(texture_t *texture, vec2_t texcoord);
 vec4_t texture_clamp_sample(texture_t *texture, vec2_t texcoord);
 vec4_t texture_sample(texture_t *texture, vec2_t texcoord);
+vec4_t texture_sample_lod(texture_t *texture, vec2_t texcoord, float lod,
+                          filter_t filter);
+vec4_t texture_sample_grad(texture_t *texture, vec2_t texcoord,
+                           vec2_t ddx, vec2_t ddy, filter_t filter);
+
+/* page management */
+void texture_make_virtual(texture_t *texture);
+void texture_update_pages(void);
+void texture_set_page_budget(int page_budget);
+void texture_evict_pages(void);
+pagestats_t texture_get_page_stats(void);
 
 /* cubemap related functions */
 cubemap_t *cubemap_from_files(const char *positive_x, const char *negative_x,
@@ -36,6 +98,7 @@ cubemap_t *cubemap_from_files(const char *positive_x, const char *negative_x,
                               const char *positive_z, const char *negative_z,
                               usage_t usage);
 void cubemap_release(cubemap_t *cubemap);
+void cubemap_set_layout(cubemap_t *cubemap, layout_t layout);
 vec4_t cubemap_repeat_sample(cubemap_t *cubemap, vec3_t direction);
 vec4_t cubemap_clamp_sample(cubemap_t *cubemap, vec3_t direction);
 vec4_t cubemap_sample(cubemap_t *cubemap, vec3_t direction);
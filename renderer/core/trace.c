@@ -0,0 +1,168 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "darray.h"
+#include "platform.h"
+#include "trace.h"
+
+/*
+ * for the trace event format, see
+ * https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nSsKchNAySU/
+ * https://perfetto.dev/docs/
+ *
+ * while recording, the markers push begin and end events with the time in
+ * microseconds since the start, and the events are written as json when
+ * the recording stops, so that the file can be opened in perfetto or in
+ * chrome://tracing, the markers do nothing otherwise
+ *
+ * each thread has its own track, 0 for the main thread and the worker
+ * index for the others, the names of the markers must be string literals,
+ * while the file names are copied
+ */
+
+typedef struct {
+    const char *name;
+    char *filename;
+    int thread;
+    char phase;
+    double time;
+} event_t;
+
+static char *g_filename = NULL;
+static mutex_t *g_mutex = NULL;
+static event_t *g_events = NULL;
+static double g_start_time = 0;
+
+static char *duplicate_string(const char *source) {
+    char *target = (char*)malloc(strlen(source) + 1);
+    strcpy(target, source);
+    return target;
+}
+
+void trace_start(const char *filename) {
+    assert(g_mutex == NULL);
+    g_filename = duplicate_string(filename);
+    g_start_time = platform_get_clock();
+    g_mutex = mutex_create();
+}
+
+static void push_event(const char *name, const char *filename, int thread,
+                       char phase) {
+    event_t event;
+    event.name = name;
+    event.filename = filename ? duplicate_string(filename) : NULL;
+    event.thread = thread;
+    event.phase = phase;
+    mutex_lock(g_mutex);
+    /* timed under the lock, so that the events are in time order */
+    event.time = (platform_get_clock() - g_start_time) * 1000000;
+    darray_push(g_events, event);
+    mutex_unlock(g_mutex);
+}
+
+void trace_begin(const char *name) {
+    if (g_mutex != NULL) {
+        push_event(name, NULL, 0, 'B');
+    }
+}
+
+void trace_begin_file(const char *name, const char *filename) {
+    if (g_mutex != NULL) {
+        push_event(name, filename, 0, 'B');
+    }
+}
+
+void trace_end(void) {
+    if (g_mutex != NULL) {
+        push_event(NULL, NULL, 0, 'E');
+    }
+}
+
+void trace_begin_thread(const char *name, int thread) {
+    if (g_mutex != NULL) {
+        push_event(name, NULL, thread, 'B');
+    }
+}
+
+void trace_end_thread(int thread) {
+    if (g_mutex != NULL) {
+        push_event(NULL, NULL, thread, 'E');
+    }
+}
+
+static void write_string(FILE *file, const char *string) {
+    fputc('"', file);
+    for (; *string != '\0'; string++) {
+        if (*string == '"' || *string == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*string, file);
+    }
+    fputc('"', file);
+}
+
+static void write_events(FILE *file) {
+    int num_events = darray_size(g_events);
+    int num_threads = 1;
+    int i;
+
+    for (i = 0; i < num_events; i++) {
+        if (g_events[i].thread + 1 > num_threads) {
+            num_threads = g_events[i].thread + 1;
+        }
+    }
+
+    /* the thread names come first, followed by the events */
+    fprintf(file, "{\"traceEvents\": [\n");
+    for (i = 0; i < num_threads; i++) {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", "
+                      "\"pid\": 1, \"tid\": %d, ", i > 0 ? ",\n" : "", i);
+        if (i == 0) {
+            fprintf(file, "\"args\": {\"name\": \"main\"}}");
+        } else {
+            fprintf(file, "\"args\": {\"name\": \"worker %d\"}}", i);
+        }
+    }
+    for (i = 0; i < num_events; i++) {
+        event_t *event = &g_events[i];
+        fprintf(file, ",\n{");
+        if (event->name != NULL) {
+            fprintf(file, "\"name\": ");
+            write_string(file, event->name);
+            fprintf(file, ", ");
+        }
+        fprintf(file, "\"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d",
+                event->phase, event->time, event->thread);
+        if (event->filename != NULL) {
+            fprintf(file, ", \"args\": {\"file\": ");
+            write_string(file, event->filename);
+            fprintf(file, "}");
+        }
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n],\n\"displayTimeUnit\": \"ms\"}\n");
+}
+
+void trace_stop(void) {
+    if (g_mutex != NULL) {
+        int num_events = darray_size(g_events);
+        FILE *file;
+        int i;
+
+        file = fopen(g_filename, "wb");
+        assert(file != NULL);
+        write_events(file);
+        fclose(file);
+
+        for (i = 0; i < num_events; i++) {
+            free(g_events[i].filename);
+        }
+        darray_free(g_events);
+        mutex_release(g_mutex);
+        free(g_filename);
+        g_events = NULL;
+        g_mutex = NULL;
+        g_filename = NULL;
+    }
+}
@@ -0,0 +1,15 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* trace recording */
+void trace_start(const char *filename);
+void trace_stop(void);
+
+/* scoped markers */
+void trace_begin(const char *name);
+void trace_begin_file(const char *name, const char *filename);
+void trace_end(void);
+void trace_begin_thread(const char *name, int thread);
+void trace_end_thread(int thread);
+
+#endif
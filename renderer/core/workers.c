@@ -0,0 +1,155 @@
+#include <assert.h>
+#include <stddef.h>
+#include "darray.h"
+#include "platform.h"
+#include "workers.h"
+
+/*
+ * for thread pools, see
+ * https://en.wikipedia.org/wiki/Thread_pool
+ *
+ * the worker threads are created once and sleep between runs, a run wakes
+ * as many of them as it needs and the calling thread works alongside them,
+ * the work function is expected to share its work out, for example by
+ * handing out items under a mutex, and the run returns once every thread
+ * taking part has returned from it, so runs never overlap
+ *
+ * each worker has an index from 1, and the calling thread has 0, so that
+ * the work function can keep per-thread records and leave them unlocked
+ */
+
+typedef struct {
+    thread_t **threads;
+    threadlocal_t *index;         /* points into the indices below */
+    int indices[MAX_THREADS];
+    mutex_t *mutex;
+    condition_t *wake_condition;  /* a run started or the workers stop */
+    condition_t *done_condition;  /* the last worker of a run returned */
+    threadfunc_t *workfunc;
+    void *userdata;
+    int generation;               /* incremented by every run */
+    int num_joining;              /* workers yet to join the run */
+    int num_running;              /* workers yet to return from the run */
+    int stopping;
+} workers_t;
+
+static workers_t g_workers;
+
+static void worker_entry(void *userdata) {
+    int generation = 0;
+    threadlocal_set(g_workers.index, userdata);
+    mutex_lock(g_workers.mutex);
+    while (1) {
+        while (!g_workers.stopping && g_workers.generation == generation) {
+            condition_wait(g_workers.wake_condition, g_workers.mutex);
+        }
+        if (g_workers.stopping) {
+            break;
+        }
+        generation = g_workers.generation;
+        if (g_workers.num_joining > 0) {
+            threadfunc_t *workfunc = g_workers.workfunc;
+            void *workdata = g_workers.userdata;
+            g_workers.num_joining -= 1;
+            mutex_unlock(g_workers.mutex);
+            workfunc(workdata);
+            mutex_lock(g_workers.mutex);
+            g_workers.num_running -= 1;
+            if (g_workers.num_running == 0) {
+                condition_signal(g_workers.done_condition);
+            }
+        }
+    }
+    mutex_unlock(g_workers.mutex);
+}
+
+/* the calling thread counts as one of the threads */
+void workers_start(int num_threads) {
+    int i;
+    assert(num_threads <= MAX_THREADS);
+    if (g_workers.mutex != NULL) {
+        if (darray_size(g_workers.threads) + 1 == num_threads) {
+            return;
+        }
+        workers_stop();
+    }
+
+    g_workers.index = threadlocal_create();
+    g_workers.mutex = mutex_create();
+    g_workers.wake_condition = condition_create();
+    g_workers.done_condition = condition_create();
+    g_workers.generation = 0;
+    g_workers.stopping = 0;
+    for (i = 1; i < num_threads; i++) {
+        thread_t *thread;
+        g_workers.indices[i] = i;
+        thread = thread_create(worker_entry, &g_workers.indices[i]);
+        darray_push(g_workers.threads, thread);
+    }
+}
+
+void workers_stop(void) {
+    if (g_workers.mutex != NULL) {
+        int num_threads = darray_size(g_workers.threads);
+        int i;
+
+        mutex_lock(g_workers.mutex);
+        g_workers.stopping = 1;
+        condition_broadcast(g_workers.wake_condition);
+        mutex_unlock(g_workers.mutex);
+        for (i = 0; i < num_threads; i++) {
+            thread_join(g_workers.threads[i]);
+        }
+
+        darray_free(g_workers.threads);
+        condition_release(g_workers.done_condition);
+        condition_release(g_workers.wake_condition);
+        mutex_release(g_workers.mutex);
+        threadlocal_release(g_workers.index);
+        g_workers.threads = NULL;
+        g_workers.mutex = NULL;
+    }
+}
+
+/* the index of the calling thread, valid from the work function */
+int workers_get_index(void) {
+    if (g_workers.mutex != NULL) {
+        int *index = (int*)threadlocal_get(g_workers.index);
+        return index != NULL ? *index : 0;
+    } else {
+        return 0;
+    }
+}
+
+/*
+ * run the work function on up to the given number of threads, including
+ * the calling one, must not be called from the work function itself
+ */
+void workers_run(threadfunc_t *workfunc, void *userdata, int num_threads) {
+    int num_workers = darray_size(g_workers.threads);
+    if (num_workers > num_threads - 1) {
+        num_workers = num_threads - 1;
+    }
+
+    if (num_workers > 0) {
+        mutex_lock(g_workers.mutex);
+        assert(g_workers.num_running == 0);
+        g_workers.workfunc = workfunc;
+        g_workers.userdata = userdata;
+        g_workers.num_joining = num_workers;
+        g_workers.num_running = num_workers;
+        g_workers.generation += 1;
+        condition_broadcast(g_workers.wake_condition);
+        mutex_unlock(g_workers.mutex);
+
+        workfunc(userdata);
+
+        mutex_lock(g_workers.mutex);
+        while (g_workers.num_running > 0) {
+            condition_wait(g_workers.done_condition, g_workers.mutex);
+        }
+        mutex_unlock(g_workers.mutex);
+    } else {
+        workfunc(userdata);
+    }
+}
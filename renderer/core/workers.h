@@ -0,0 +1,16 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include "platform.h"
+
+#define MAX_THREADS 64  /* including the calling thread */
+
+/* worker management */
+void workers_start(int num_threads);
+void workers_stop(void);
+int workers_get_index(void);
+
+/* work dispatching */
+void workers_run(threadfunc_t *workfunc, void *userdata, int num_threads);
+
+#endif
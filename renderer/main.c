@@ -4,25 +4,31 @@
 #include <time.h>
 #include "core/api.h"
 #include "shaders/cache_helper.h"
+#include "tests/test_bench.h"
 #include "tests/test_blinn.h"
+#include "tests/test_golden.h"
 #include "tests/test_pbr.h"
 
-typedef void testfunc_t(int argc, char *argv[]);
+typedef int testfunc_t(int argc, char *argv[]);
 typedef struct {const char *testname; testfunc_t *testfunc;} testcase_t;
 
 static testcase_t g_testcases[] = {
     {"blinn", test_blinn},
     {"pbr", test_pbr},
+    {"golden", test_golden},
+    {"bench", test_bench},
 };
 
 int main(int argc, char *argv[]) {
     int num_testcases = ARRAY_SIZE(g_testcases);
     const char *testname = NULL;
     testfunc_t *testfunc = NULL;
+    int status = EXIT_FAILURE;
     int i;
 
     srand((unsigned int)time(NULL));
     platform_initialize();
+    graphics_set_num_threads(platform_get_num_cores());
 
     if (argc > 1) {
         testname = argv[1];
@@ -33,14 +39,15 @@ int main(int argc, char *argv[]) {
             }
         }
     } else {
-        i = rand() % num_testcases;
+        /* except the golden images and the benchmark */
+        i = rand() % (num_testcases - 2);
         testname = g_testcases[i].testname;
         testfunc = g_testcases[i].testfunc;
     }
 
     if (testfunc) {
         printf("test: %s\n", testname);
-        testfunc(argc, argv);
+        status = testfunc(argc, argv);
     } else {
         printf("test not found: %s\n", testname);
         printf("available tests: ");
@@ -53,8 +60,10 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    workers_stop();
+    trace_stop();
     platform_terminate();
     cache_cleanup();
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,89 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/graphics.h"
+#include "../core/macro.h"
+#include "../core/platform.h"
+
+/*
+ * a platform without a window system, for machines with no display
+ * server, windows are closed as soon as they are created, and frames
+ * are rendered offscreen with the --headless option instead
+ */
+
+struct window {
+    void *userdata;
+};
+
+/* platform initialization */
+
+void platform_terminate(void) {
+}
+
+/* window related functions */
+
+window_t *window_create(const char *title, int width, int height) {
+    window_t *window;
+
+    assert(width > 0 && height > 0);
+    UNUSED_VAR(width);
+    UNUSED_VAR(height);
+
+    printf("no window system for %s, use --headless\n", title);
+    window = (window_t*)malloc(sizeof(window_t));
+    memset(window, 0, sizeof(window_t));
+    return window;
+}
+
+void window_destroy(window_t *window) {
+    free(window);
+}
+
+int window_should_close(window_t *window) {
+    UNUSED_VAR(window);
+    return 1;
+}
+
+void window_set_userdata(window_t *window, void *userdata) {
+    window->userdata = userdata;
+}
+
+void *window_get_userdata(window_t *window) {
+    return window->userdata;
+}
+
+void window_draw_buffer(window_t *window, framebuffer_t *buffer) {
+    UNUSED_VAR(window);
+    UNUSED_VAR(buffer);
+}
+
+/* input related functions */
+
+void input_poll_events(void) {
+}
+
+int input_key_pressed(window_t *window, keycode_t key) {
+    assert(key >= 0 && key < KEY_NUM);
+    UNUSED_VAR(window);
+    UNUSED_VAR(key);
+    return 0;
+}
+
+int input_button_pressed(window_t *window, button_t button) {
+    assert(button >= 0 && button < BUTTON_NUM);
+    UNUSED_VAR(window);
+    UNUSED_VAR(button);
+    return 0;
+}
+
+void input_query_cursor(window_t *window, float *xpos, float *ypos) {
+    UNUSED_VAR(window);
+    *xpos = 0;
+    *ypos = 0;
+}
+
+void input_set_callbacks(window_t *window, callbacks_t callbacks) {
+    UNUSED_VAR(window);
+    UNUSED_VAR(callbacks);
+}
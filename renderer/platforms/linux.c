@@ -1,8 +1,6 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
-#include <unistd.h>
 #include <X11/Xlib.h>
 #include <X11/Xutil.h>
 #include "../core/graphics.h"
@@ -28,6 +26,10 @@ struct window {
 static Display *g_display = NULL;
 static XContext g_context;
 
+/*
+ * the display is opened by the first window, so that frames can still be
+ * rendered offscreen with the --headless option without a display server
+ */
 static void open_display(void) {
     g_display = XOpenDisplay(NULL);
     assert(g_display != NULL);
@@ -39,32 +41,10 @@ static void close_display(void) {
     g_display = NULL;
 }
 
-static void initialize_path(void) {
-    char path[PATH_SIZE];
-    ssize_t bytes;
-    int error;
-
-    bytes = readlink("/proc/self/exe", path, PATH_SIZE - 1);
-    assert(bytes != -1);
-    path[bytes] = '\0';
-    *strrchr(path, '/') = '\0';
-
-    error = chdir(path);
-    assert(error == 0);
-    error = chdir("assets");
-    assert(error == 0);
-    UNUSED_VAR(error);
-}
-
-void platform_initialize(void) {
-    assert(g_display == NULL);
-    open_display();
-    initialize_path();
-}
-
 void platform_terminate(void) {
-    assert(g_display != NULL);
-    close_display();
+    if (g_display != NULL) {
+        close_display();
+    }
 }
 
 /* window related functions */
@@ -132,8 +112,11 @@ window_t *window_create(const char *title, int width, int height) {
     image_t *surface;
     XImage *ximage;
 
-    assert(g_display && width > 0 && height > 0);
+    assert(width > 0 && height > 0);
 
+    if (g_display == NULL) {
+        open_display();
+    }
     handle = create_window(title, width, height);
     create_surface(width, height, &surface, &ximage);
 
@@ -306,19 +289,3 @@ void input_query_cursor(window_t *window, float *xpos, float *ypos) {
 void input_set_callbacks(window_t *window, callbacks_t callbacks) {
     window->callbacks = callbacks;
 }
-
-/* misc platform functions */
-
-static double get_native_time(void) {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
-}
-
-float platform_get_time(void) {
-    static double initial = -1;
-    if (initial < 0) {
-        initial = get_native_time();
-    }
-    return (float)(get_native_time() - initial);
-}
@@ -4,6 +4,7 @@
 #include <Cocoa/Cocoa.h>
 #include <mach-o/dyld.h>
 #include <mach/mach_time.h>
+#include <pthread.h>
 #include <unistd.h>
 #include "../core/graphics.h"
 #include "../core/image.h"
@@ -336,6 +337,121 @@ void input_set_callbacks(window_t *window, callbacks_t callbacks) {
     window->callbacks = callbacks;
 }
 
+/* thread related functions */
+
+struct thread {
+    pthread_t handle;
+    threadfunc_t *threadfunc;
+    void *userdata;
+};
+
+struct mutex {
+    pthread_mutex_t handle;
+};
+
+struct condition {
+    pthread_cond_t handle;
+};
+
+struct threadlocal {
+    pthread_key_t handle;
+};
+
+static void *thread_entry(void *thread_) {
+    thread_t *thread = (thread_t*)thread_;
+    thread->threadfunc(thread->userdata);
+    return NULL;
+}
+
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata) {
+    thread_t *thread;
+    int error;
+
+    thread = (thread_t*)malloc(sizeof(thread_t));
+    thread->threadfunc = threadfunc;
+    thread->userdata = userdata;
+    error = pthread_create(&thread->handle, NULL, thread_entry, thread);
+    assert(error == 0);
+
+    UNUSED_VAR(error);
+    return thread;
+}
+
+void thread_join(thread_t *thread) {
+    int error = pthread_join(thread->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    free(thread);
+}
+
+mutex_t *mutex_create(void) {
+    mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+    int error = pthread_mutex_init(&mutex->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return mutex;
+}
+
+void mutex_release(mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->handle);
+    free(mutex);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    pthread_mutex_lock(&mutex->handle);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    pthread_mutex_unlock(&mutex->handle);
+}
+
+condition_t *condition_create(void) {
+    condition_t *condition = (condition_t*)malloc(sizeof(condition_t));
+    int error = pthread_cond_init(&condition->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return condition;
+}
+
+void condition_release(condition_t *condition) {
+    pthread_cond_destroy(&condition->handle);
+    free(condition);
+}
+
+void condition_wait(condition_t *condition, mutex_t *mutex) {
+    pthread_cond_wait(&condition->handle, &mutex->handle);
+}
+
+void condition_signal(condition_t *condition) {
+    pthread_cond_signal(&condition->handle);
+}
+
+void condition_broadcast(condition_t *condition) {
+    pthread_cond_broadcast(&condition->handle);
+}
+
+/* NULL for the threads that never set it */
+threadlocal_t *threadlocal_create(void) {
+    threadlocal_t *threadlocal = (threadlocal_t*)malloc(sizeof(threadlocal_t));
+    int error = pthread_key_create(&threadlocal->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return threadlocal;
+}
+
+void threadlocal_release(threadlocal_t *threadlocal) {
+    pthread_key_delete(threadlocal->handle);
+    free(threadlocal);
+}
+
+void threadlocal_set(threadlocal_t *threadlocal, void *value) {
+    pthread_setspecific(threadlocal->handle, value);
+}
+
+void *threadlocal_get(threadlocal_t *threadlocal) {
+    return pthread_getspecific(threadlocal->handle);
+}
+
 /* misc platform functions */
 
 static double get_native_time(void) {
@@ -355,3 +471,12 @@ float platform_get_time(void) {
     }
     return (float)(get_native_time() - initial);
 }
+
+double platform_get_clock(void) {
+    return get_native_time();
+}
+
+int platform_get_num_cores(void) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cores > 0 ? (int)num_cores : 1;
+}
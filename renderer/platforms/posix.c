@@ -0,0 +1,177 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "../core/macro.h"
+#include "../core/platform.h"
+
+/*
+ * the initialization, thread and time functions shared by the platforms
+ * built on posix, the x11 and the headless ones
+ */
+
+/* platform initialization */
+
+static void initialize_path(void) {
+    char path[PATH_SIZE];
+    ssize_t bytes;
+    int error;
+
+    bytes = readlink("/proc/self/exe", path, PATH_SIZE - 1);
+    assert(bytes > 0);
+    if (bytes > 0) {
+        path[bytes] = '\0';
+        *strrchr(path, '/') = '\0';
+        error = chdir(path);
+        assert(error == 0);
+    }
+    error = chdir("assets");
+    assert(error == 0);
+    UNUSED_VAR(error);
+}
+
+void platform_initialize(void) {
+    initialize_path();
+}
+
+/* thread related functions */
+
+struct thread {
+    pthread_t handle;
+    threadfunc_t *threadfunc;
+    void *userdata;
+};
+
+struct mutex {
+    pthread_mutex_t handle;
+};
+
+struct condition {
+    pthread_cond_t handle;
+};
+
+struct threadlocal {
+    pthread_key_t handle;
+};
+
+static void *thread_entry(void *thread_) {
+    thread_t *thread = (thread_t*)thread_;
+    thread->threadfunc(thread->userdata);
+    return NULL;
+}
+
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata) {
+    thread_t *thread;
+    int error;
+
+    thread = (thread_t*)malloc(sizeof(thread_t));
+    thread->threadfunc = threadfunc;
+    thread->userdata = userdata;
+    error = pthread_create(&thread->handle, NULL, thread_entry, thread);
+    assert(error == 0);
+
+    UNUSED_VAR(error);
+    return thread;
+}
+
+void thread_join(thread_t *thread) {
+    int error = pthread_join(thread->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    free(thread);
+}
+
+mutex_t *mutex_create(void) {
+    mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+    int error = pthread_mutex_init(&mutex->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return mutex;
+}
+
+void mutex_release(mutex_t *mutex) {
+    pthread_mutex_destroy(&mutex->handle);
+    free(mutex);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    pthread_mutex_lock(&mutex->handle);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    pthread_mutex_unlock(&mutex->handle);
+}
+
+condition_t *condition_create(void) {
+    condition_t *condition = (condition_t*)malloc(sizeof(condition_t));
+    int error = pthread_cond_init(&condition->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return condition;
+}
+
+void condition_release(condition_t *condition) {
+    pthread_cond_destroy(&condition->handle);
+    free(condition);
+}
+
+void condition_wait(condition_t *condition, mutex_t *mutex) {
+    pthread_cond_wait(&condition->handle, &mutex->handle);
+}
+
+void condition_signal(condition_t *condition) {
+    pthread_cond_signal(&condition->handle);
+}
+
+void condition_broadcast(condition_t *condition) {
+    pthread_cond_broadcast(&condition->handle);
+}
+
+/* NULL for the threads that never set it */
+threadlocal_t *threadlocal_create(void) {
+    threadlocal_t *threadlocal = (threadlocal_t*)malloc(sizeof(threadlocal_t));
+    int error = pthread_key_create(&threadlocal->handle, NULL);
+    assert(error == 0);
+    UNUSED_VAR(error);
+    return threadlocal;
+}
+
+void threadlocal_release(threadlocal_t *threadlocal) {
+    pthread_key_delete(threadlocal->handle);
+    free(threadlocal);
+}
+
+void threadlocal_set(threadlocal_t *threadlocal, void *value) {
+    pthread_setspecific(threadlocal->handle, value);
+}
+
+void *threadlocal_get(threadlocal_t *threadlocal) {
+    return pthread_getspecific(threadlocal->handle);
+}
+
+/* misc platform functions */
+
+static double get_native_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+float platform_get_time(void) {
+    static double initial = -1;
+    if (initial < 0) {
+        initial = get_native_time();
+    }
+    return (float)(get_native_time() - initial);
+}
+
+double platform_get_clock(void) {
+    return get_native_time();
+}
+
+int platform_get_num_cores(void) {
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cores > 0 ? (int)num_cores : 1;
+}
@@ -317,6 +317,112 @@ void input_set_callbacks(window_t *window, callbacks_t callbacks) {
     window->callbacks = callbacks;
 }
 
+/* thread related functions */
+
+struct thread {
+    HANDLE handle;
+    threadfunc_t *threadfunc;
+    void *userdata;
+};
+
+struct mutex {
+    CRITICAL_SECTION handle;
+};
+
+struct condition {
+    CONDITION_VARIABLE handle;
+};
+
+struct threadlocal {
+    DWORD handle;
+};
+
+static DWORD WINAPI thread_entry(LPVOID thread_) {
+    thread_t *thread = (thread_t*)thread_;
+    thread->threadfunc(thread->userdata);
+    return 0;
+}
+
+thread_t *thread_create(threadfunc_t *threadfunc, void *userdata) {
+    thread_t *thread;
+
+    thread = (thread_t*)malloc(sizeof(thread_t));
+    thread->threadfunc = threadfunc;
+    thread->userdata = userdata;
+    thread->handle = CreateThread(NULL, 0, thread_entry, thread, 0, NULL);
+    assert(thread->handle != NULL);
+
+    return thread;
+}
+
+void thread_join(thread_t *thread) {
+    WaitForSingleObject(thread->handle, INFINITE);
+    CloseHandle(thread->handle);
+    free(thread);
+}
+
+mutex_t *mutex_create(void) {
+    mutex_t *mutex = (mutex_t*)malloc(sizeof(mutex_t));
+    InitializeCriticalSection(&mutex->handle);
+    return mutex;
+}
+
+void mutex_release(mutex_t *mutex) {
+    DeleteCriticalSection(&mutex->handle);
+    free(mutex);
+}
+
+void mutex_lock(mutex_t *mutex) {
+    EnterCriticalSection(&mutex->handle);
+}
+
+void mutex_unlock(mutex_t *mutex) {
+    LeaveCriticalSection(&mutex->handle);
+}
+
+condition_t *condition_create(void) {
+    condition_t *condition = (condition_t*)malloc(sizeof(condition_t));
+    InitializeConditionVariable(&condition->handle);
+    return condition;
+}
+
+void condition_release(condition_t *condition) {
+    free(condition);
+}
+
+void condition_wait(condition_t *condition, mutex_t *mutex) {
+    SleepConditionVariableCS(&condition->handle, &mutex->handle, INFINITE);
+}
+
+void condition_signal(condition_t *condition) {
+    WakeConditionVariable(&condition->handle);
+}
+
+void condition_broadcast(condition_t *condition) {
+    WakeAllConditionVariable(&condition->handle);
+}
+
+/* NULL for the threads that never set it */
+threadlocal_t *threadlocal_create(void) {
+    threadlocal_t *threadlocal = (threadlocal_t*)malloc(sizeof(threadlocal_t));
+    threadlocal->handle = TlsAlloc();
+    assert(threadlocal->handle != TLS_OUT_OF_INDEXES);
+    return threadlocal;
+}
+
+void threadlocal_release(threadlocal_t *threadlocal) {
+    TlsFree(threadlocal->handle);
+    free(threadlocal);
+}
+
+void threadlocal_set(threadlocal_t *threadlocal, void *value) {
+    TlsSetValue(threadlocal->handle, value);
+}
+
+void *threadlocal_get(threadlocal_t *threadlocal) {
+    return TlsGetValue(threadlocal->handle);
+}
+
 /* misc platform functions */
 
 static double get_native_time(void) {
@@ -338,3 +444,13 @@ float platform_get_time(void) {
     }
     return (float)(get_native_time() - initial);
 }
+
+double platform_get_clock(void) {
+    return get_native_time();
+}
+
+int platform_get_num_cores(void) {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
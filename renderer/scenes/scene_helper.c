@@ -360,10 +360,36 @@ static scene_model_t *read_models(FILE *file) {
     return models;
 }
 
+/*
+ * the models of a scene file that share a skeleton are the parts of one
+ * character, so they share one animation instance, which is owned by the
+ * scene and updated once per frame for all of them
+ */
+static animation_t **create_animations(model_t **models) {
+    int num_models = darray_size(models);
+    animation_t **animations = NULL;
+    int i, j;
+
+    for (i = 0; i < num_models; i++) {
+        skeleton_t *skeleton = models[i]->skeleton;
+        if (skeleton && models[i]->animation == NULL) {
+            animation_t *animation = animation_create(skeleton, 0);
+            for (j = i; j < num_models; j++) {
+                if (models[j]->skeleton == skeleton) {
+                    models[j]->animation = animation;
+                }
+            }
+            darray_push(animations, animation);
+        }
+    }
+    return animations;
+}
+
 static scene_t *create_scene(scene_light_t *light, model_t **models) {
     model_t *skybox;
     int shadow_width;
     int shadow_height;
+    scene_t *scene;
 
     if (equals_to(light->skybox, "off")) {
         skybox = NULL;
@@ -398,9 +424,11 @@ static scene_t *create_scene(scene_light_t *light, model_t **models) {
         }
     }
 
-    return scene_create(light->background, skybox, models,
-                        light->ambient, light->punctual,
-                        shadow_width, shadow_height);
+    scene = scene_create(light->background, skybox, models,
+                         light->ambient, light->punctual,
+                         shadow_width, shadow_height);
+    scene->animations = create_animations(models);
+    return scene;
 }
 
 static scene_t *create_blinn_scene(scene_light_t *scene_light,
@@ -578,6 +606,7 @@ scene_t *scene_from_file(const char *filename, mat4_t root) {
     FILE *file;
     int items;
 
+    trace_begin_file("scene_from_file", filename);
     file = fopen(filename, "rb");
     assert(file != NULL);
     items = fscanf(file, " type: %s", scene_type);
@@ -615,6 +644,7 @@ scene_t *scene_from_file(const char *filename, mat4_t root) {
         scene = NULL;
     }
     fclose(file);
+    trace_end();
 
     return scene;
 }
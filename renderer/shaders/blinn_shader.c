@@ -6,46 +6,10 @@
 
 /* low-level api */
 
-static mat4_t get_model_matrix(blinn_attribs_t *attribs,
-                               blinn_uniforms_t *uniforms) {
-    if (uniforms->joint_matrices) {
-        mat4_t joint_matrices[4];
-        mat4_t skin_matrix;
-
-        joint_matrices[0] = uniforms->joint_matrices[(int)attribs->joint.x];
-        joint_matrices[1] = uniforms->joint_matrices[(int)attribs->joint.y];
-        joint_matrices[2] = uniforms->joint_matrices[(int)attribs->joint.z];
-        joint_matrices[3] = uniforms->joint_matrices[(int)attribs->joint.w];
-
-        skin_matrix = mat4_combine(joint_matrices, attribs->weight);
-        return mat4_mul_mat4(uniforms->model_matrix, skin_matrix);
-    } else {
-        return uniforms->model_matrix;
-    }
-}
-
-static mat3_t get_normal_matrix(blinn_attribs_t *attribs,
-                                blinn_uniforms_t *uniforms) {
-    if (uniforms->joint_n_matrices) {
-        mat3_t joint_n_matrices[4];
-        mat3_t skin_n_matrix;
-
-        joint_n_matrices[0] = uniforms->joint_n_matrices[(int)attribs->joint.x];
-        joint_n_matrices[1] = uniforms->joint_n_matrices[(int)attribs->joint.y];
-        joint_n_matrices[2] = uniforms->joint_n_matrices[(int)attribs->joint.z];
-        joint_n_matrices[3] = uniforms->joint_n_matrices[(int)attribs->joint.w];
-
-        skin_n_matrix = mat3_combine(joint_n_matrices, attribs->weight);
-        return mat3_mul_mat3(uniforms->normal_matrix, skin_n_matrix);
-    } else {
-        return uniforms->normal_matrix;
-    }
-}
-
 static vec4_t shadow_vertex_shader(blinn_attribs_t *attribs,
                                    blinn_varyings_t *varyings,
                                    blinn_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
     vec4_t input_position = vec4_from_vec3(attribs->position, 1);
@@ -59,8 +23,8 @@ static vec4_t shadow_vertex_shader(blinn_attribs_t *attribs,
 static vec4_t common_vertex_shader(blinn_attribs_t *attribs,
                                    blinn_varyings_t *varyings,
                                    blinn_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
-    mat3_t normal_matrix = get_normal_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
+    mat3_t normal_matrix = uniforms->normal_matrix;
     mat4_t camera_vp_matrix = uniforms->camera_vp_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
@@ -91,14 +55,28 @@ vec4_t blinn_vertex_shader(void *attribs_, void *varyings_, void *uniforms_) {
     }
 }
 
+static vec4_t sample_texture(texture_t *texture, blinn_varyings_t *varyings,
+                             blinn_uniforms_t *uniforms) {
+    vec2_t texcoord = varyings->texcoord;
+    if (uniforms->texture_filter == FILTER_NEAREST) {
+        return texture_sample(texture, texcoord);
+    } else {
+        /* the derivatives follow the varyings */
+        vec2_t ddx = varyings[1].texcoord;
+        vec2_t ddy = varyings[2].texcoord;
+        return texture_sample_grad(texture, texcoord, ddx, ddy,
+                                   uniforms->texture_filter);
+    }
+}
+
 static vec4_t shadow_fragment_shader(blinn_varyings_t *varyings,
                                      blinn_uniforms_t *uniforms,
                                      int *discard) {
     if (uniforms->alpha_cutoff > 0) {
         float alpha = uniforms->basecolor.w;
         if (uniforms->diffuse_map) {
-            vec2_t texcoord = varyings->texcoord;
-            alpha *= texture_sample(uniforms->diffuse_map, texcoord).w;
+            texture_t *diffuse_map = uniforms->diffuse_map;
+            alpha *= sample_texture(diffuse_map, varyings, uniforms).w;
         }
         if (alpha < uniforms->alpha_cutoff) {
             *discard = 1;
@@ -119,7 +97,6 @@ typedef struct {
 static material_t get_material(blinn_varyings_t *varyings,
                                blinn_uniforms_t *uniforms,
                                int backface) {
-    vec2_t texcoord = varyings->texcoord;
     vec3_t diffuse, specular, normal, emission;
     float alpha, shininess;
     material_t material;
@@ -127,14 +104,16 @@ static material_t get_material(blinn_varyings_t *varyings,
     diffuse = vec3_from_vec4(uniforms->basecolor);
     alpha = uniforms->basecolor.w;
     if (uniforms->diffuse_map) {
-        vec4_t sample = texture_sample(uniforms->diffuse_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->diffuse_map, varyings,
+                                       uniforms);
         diffuse = vec3_modulate(diffuse, vec3_from_vec4(sample));
         alpha *= sample.w;
     }
 
     specular = vec3_new(0, 0, 0);
     if (uniforms->specular_map) {
-        vec4_t sample = texture_sample(uniforms->specular_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->specular_map, varyings,
+                                       uniforms);
         specular = vec3_from_vec4(sample);
     }
     shininess = uniforms->shininess;
@@ -146,7 +125,8 @@ static material_t get_material(blinn_varyings_t *varyings,
 
     emission = vec3_new(0, 0, 0);
     if (uniforms->emission_map) {
-        vec4_t sample = texture_sample(uniforms->emission_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->emission_map, varyings,
+                                       uniforms);
         emission = vec3_from_vec4(sample);
     }
 
@@ -253,26 +233,15 @@ vec4_t blinn_fragment_shader(void *varyings_, void *uniforms_,
 static void update_model(model_t *model, perframe_t *perframe) {
     float ambient_intensity = perframe->ambient_intensity;
     float punctual_intensity = perframe->punctual_intensity;
-    skeleton_t *skeleton = model->skeleton;
+    animation_t *animation = model->animation;
     mat4_t model_matrix = model->transform;
     mat3_t normal_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     blinn_uniforms_t *uniforms;
 
-    if (skeleton) {
-        skeleton_update_joints(skeleton, perframe->frame_time);
-        joint_matrices = skeleton_get_joint_matrices(skeleton);
-        joint_n_matrices = skeleton_get_normal_matrices(skeleton);
-        if (model->attached >= 0) {
-            mat4_t node_matrix = joint_matrices[model->attached];
-            model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
-            joint_matrices = NULL;
-            joint_n_matrices = NULL;
-        }
-    } else {
-        joint_matrices = NULL;
-        joint_n_matrices = NULL;
+    if (animation && model->attached >= 0) {
+        mat4_t *joint_matrices = animation_get_joint_matrices(animation);
+        mat4_t node_matrix = joint_matrices[model->attached];
+        model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
     }
     normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
 
@@ -285,37 +254,42 @@ static void update_model(model_t *model, perframe_t *perframe) {
                                               perframe->light_view_matrix);
     uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
                                                perframe->camera_view_matrix);
-    uniforms->joint_matrices = joint_matrices;
-    uniforms->joint_n_matrices = joint_n_matrices;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
+    uniforms->texture_filter = perframe->texture_filter;
+    program_set_derivatives(model->program,
+                            perframe->texture_filter != FILTER_NEAREST);
+}
+
+static void fetch_attribs(void *source, int index, void *attribs_) {
+    model_t *model = (model_t*)source;
+    vertex_t vertex = mesh_get_vertex(model->mesh, index);
+    blinn_attribs_t *attribs = (blinn_attribs_t*)attribs_;
+    if (model->skinned) {
+        vertex.position = model->skinned[index].position;
+        vertex.normal = model->skinned[index].normal;
+        vertex.tangent = model->skinned[index].tangent;
+    }
+    attribs->position = vertex.position;
+    attribs->texcoord = vertex.texcoord;
+    attribs->normal = vertex.normal;
 }
 
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
     mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
-    program_t *program = model->program;
+    int num_vertices = mesh_get_num_vertices(mesh);
+    int num_indices = mesh_get_num_faces(mesh) * 3;
+    void *indices = mesh_get_indices(mesh);
+    int index_size = mesh_get_index_size(mesh);
     blinn_uniforms_t *uniforms;
-    blinn_attribs_t *attribs;
-    int i, j;
 
     uniforms = (blinn_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            attribs = (blinn_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
-        }
-        graphics_draw_triangle(framebuffer, program);
-    }
+    graphics_draw_indexed(framebuffer, model->program,
+                          fetch_attribs, model, num_vertices,
+                          indices, index_size, num_indices);
 }
 
 static void release_model(model_t *model) {
@@ -327,6 +301,7 @@ static void release_model(model_t *model) {
     program_release(model->program);
     cache_release_skeleton(model->skeleton);
     cache_release_mesh(model->mesh);
+    free(model->skinned);
     free(model);
 }
 
@@ -361,9 +336,17 @@ model_t *blinn_create_model(const char *mesh, mat4_t transform,
     model->program = program;
     model->transform = transform;
     model->skeleton = cache_acquire_skeleton(skeleton);
+    model->animation = NULL;  /* assigned by the scene */
     model->attached = attached;
+    if (model->skeleton && attached < 0) {
+        int num_vertices = mesh_get_num_vertices(model->mesh);
+        model->skinned = (skinned_t*)malloc(sizeof(skinned_t) * num_vertices);
+    } else {
+        model->skinned = NULL;
+    }
     model->opaque = !material->enable_blend;
     model->distance = 0;
+    model->alpha_tested = material->alpha_cutoff > 0;
     model->update = update_model;
     model->draw = draw_model;
     model->release = release_model;
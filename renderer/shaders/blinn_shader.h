@@ -9,8 +9,6 @@ typedef struct {
     vec3_t position;
     vec2_t texcoord;
     vec3_t normal;
-    vec4_t joint;
-    vec4_t weight;
 } blinn_attribs_t;
 
 typedef struct {
@@ -27,8 +25,6 @@ typedef struct {
     mat3_t normal_matrix;
     mat4_t light_vp_matrix;
     mat4_t camera_vp_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     float ambient_intensity;
     float punctual_intensity;
     texture_t *shadow_map;
@@ -41,6 +37,7 @@ typedef struct {
     /* render controls */
     float alpha_cutoff;
     int shadow_pass;
+    filter_t texture_filter;
 } blinn_uniforms_t;
 
 vec4_t blinn_vertex_shader(void *attribs, void *varyings, void *uniforms);
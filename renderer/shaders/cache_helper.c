@@ -140,6 +140,23 @@ typedef struct {
 } cached_texture_t;
 
 static cached_texture_t *g_textures = NULL;
+static int g_mipmapped_textures = 0;
+static int g_virtual_textures = 0;
+
+static texture_t *load_texture(const char *filename, usage_t usage) {
+    texture_t *texture;
+    trace_begin_file("load_texture", filename);
+    texture = texture_from_file(filename, usage);
+    if (g_virtual_textures) {
+        /* the mipmaps are generated too, only the coarse levels stay */
+        texture_make_virtual(texture);
+    } else if (g_mipmapped_textures) {
+        /* nearest sampling reads the base level only */
+        texture_generate_mipmaps(texture);
+    }
+    trace_end();
+    return texture;
+}
 
 texture_t *cache_acquire_texture(const char *filename, usage_t usage) {
     if (filename != NULL) {
@@ -155,8 +172,8 @@ texture_t *cache_acquire_texture(const char *filename, usage_t usage) {
                     } else {
                         assert(g_textures[i].references == 0);
                         assert(g_textures[i].texture == NULL);
-                        g_textures[i].texture = texture_from_file(filename,
-                                                                  usage);
+                        g_textures[i].texture = load_texture(filename,
+                                                             usage);
                         g_textures[i].references = 1;
                     }
                     return g_textures[i].texture;
@@ -166,7 +183,7 @@ texture_t *cache_acquire_texture(const char *filename, usage_t usage) {
 
         cached_texture.filename = duplicate_string(filename);
         cached_texture.usage = usage;
-        cached_texture.texture = texture_from_file(filename, usage);
+        cached_texture.texture = load_texture(filename, usage);
         cached_texture.references = 1;
         darray_push(g_textures, cached_texture);
         return cached_texture.texture;
@@ -194,6 +211,63 @@ void cache_release_texture(texture_t *texture) {
     }
 }
 
+static const char *get_block_format(storage_t storage) {
+    if (storage == STORAGE_BC1) {
+        return "bc1";
+    } else if (storage == STORAGE_BC4) {
+        return "bc4";
+    } else if (storage == STORAGE_BC5) {
+        return "bc5";
+    } else {
+        assert(storage == STORAGE_BC7);
+        return "bc7";
+    }
+}
+
+/* the errors are in the order of the source channels */
+static void print_compression(const char *filename, storage_t source,
+                              storage_t storage, vec4_t errors) {
+    const char *format = get_block_format(storage);
+    if (source == STORAGE_R8) {
+        printf("compressed %s: %s, rmse l %.2f\n", filename, format,
+               errors.x);
+    } else if (source == STORAGE_RG8) {
+        printf("compressed %s: %s, rmse l %.2f a %.2f\n", filename, format,
+               errors.x, errors.y);
+    } else {
+        printf("compressed %s: %s, rmse r %.2f g %.2f b %.2f a %.2f\n",
+               filename, format, errors.x, errors.y, errors.z, errors.w);
+    }
+}
+
+void cache_compress_textures(void) {
+    int num_textures = darray_size(g_textures);
+    int i;
+    trace_begin("cache_compress_textures");
+    for (i = 0; i < num_textures; i++) {
+        texture_t *texture = g_textures[i].texture;
+        if (texture != NULL && texture->pagetable == NULL
+                && (texture->storage == STORAGE_R8
+                    || texture->storage == STORAGE_RG8
+                    || texture->storage == STORAGE_RGBA8)) {
+            storage_t source = texture->storage;
+            vec4_t errors = texture_compress(texture);
+            print_compression(g_textures[i].filename, source,
+                              texture->storage, errors);
+        }
+    }
+    trace_end();
+}
+
+void cache_enable_mipmaps(void) {
+    g_mipmapped_textures = 1;
+}
+
+void cache_enable_virtual_textures(int page_budget) {
+    g_virtual_textures = 1;
+    texture_set_page_budget(page_budget);
+}
+
 /* skybox related functions */
 
 typedef struct {
@@ -211,6 +285,7 @@ static cubemap_t *load_skybox(const char *skybox_name, int blur_level) {
     cubemap_t *skybox;
     int i;
 
+    trace_begin_file("load_skybox", skybox_name);
     for (i = 0; i < 6; i++) {
         const char *format;
         if (blur_level == -1) {
@@ -226,6 +301,7 @@ static cubemap_t *load_skybox(const char *skybox_name, int blur_level) {
     skybox = cubemap_from_files(paths[0], paths[1], paths[2],
                                 paths[3], paths[4], paths[5],
                                 USAGE_LDR_COLOR);
+    trace_end();
 
     return skybox;
 }
@@ -308,6 +384,7 @@ static ibldata_t *load_ibldata(const char *env_name, int mip_levels) {
     ibldata_t *ibldata;
     int i, j;
 
+    trace_begin_file("load_ibldata", env_name);
     ibldata = (ibldata_t*)malloc(sizeof(ibldata_t));
     memset(ibldata, 0, sizeof(ibldata_t));
     ibldata->mip_levels = mip_levels;
@@ -334,6 +411,7 @@ static ibldata_t *load_ibldata(const char *env_name, int mip_levels) {
     /* brdf lookup texture */
     ibldata->brdf_lut = cache_acquire_texture("common/brdf_lut.hdr",
                                               USAGE_HDR_DATA);
+    trace_end();
 
     return ibldata;
 }
@@ -392,6 +470,36 @@ void cache_release_ibldata(ibldata_t *ibldata) {
     }
 }
 
+/* texture layout */
+
+void cache_tile_textures(void) {
+    int num_textures = darray_size(g_textures);
+    int num_skyboxes = darray_size(g_skyboxes);
+    int num_ibldata = ARRAY_SIZE(g_ibldata);
+    int i, j;
+    trace_begin("cache_tile_textures");
+    for (i = 0; i < num_textures; i++) {
+        if (g_textures[i].texture != NULL) {
+            texture_set_layout(g_textures[i].texture, LAYOUT_TILED);
+        }
+    }
+    for (i = 0; i < num_skyboxes; i++) {
+        if (g_skyboxes[i].skybox != NULL) {
+            cubemap_set_layout(g_skyboxes[i].skybox, LAYOUT_TILED);
+        }
+    }
+    for (i = 0; i < num_ibldata; i++) {
+        ibldata_t *ibldata = g_ibldata[i].ibldata;
+        if (ibldata != NULL) {
+            cubemap_set_layout(ibldata->diffuse_map, LAYOUT_TILED);
+            for (j = 0; j < ibldata->mip_levels; j++) {
+                cubemap_set_layout(ibldata->specular_maps[j], LAYOUT_TILED);
+            }
+        }
+    }
+    trace_end();
+}
+
 /* misc cache functions */
 
 void cache_cleanup(void) {
@@ -16,6 +16,10 @@ void cache_release_skeleton(skeleton_t *skeleton);
 /* texture related functions */
 texture_t *cache_acquire_texture(const char *filename, usage_t usage);
 void cache_release_texture(texture_t *texture);
+void cache_compress_textures(void);
+void cache_tile_textures(void);
+void cache_enable_mipmaps(void);
+void cache_enable_virtual_textures(int page_budget);
 
 /* skybox related functions */
 cubemap_t *cache_acquire_skybox(const char *skybox_name, int blur_level);
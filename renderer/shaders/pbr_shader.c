@@ -7,46 +7,10 @@
 
 /* low-level api */
 
-static mat4_t get_model_matrix(pbr_attribs_t *attribs,
-                               pbr_uniforms_t *uniforms) {
-    if (uniforms->joint_matrices) {
-        mat4_t joint_matrices[4];
-        mat4_t skin_matrix;
-
-        joint_matrices[0] = uniforms->joint_matrices[(int)attribs->joint.x];
-        joint_matrices[1] = uniforms->joint_matrices[(int)attribs->joint.y];
-        joint_matrices[2] = uniforms->joint_matrices[(int)attribs->joint.z];
-        joint_matrices[3] = uniforms->joint_matrices[(int)attribs->joint.w];
-
-        skin_matrix = mat4_combine(joint_matrices, attribs->weight);
-        return mat4_mul_mat4(uniforms->model_matrix, skin_matrix);
-    } else {
-        return uniforms->model_matrix;
-    }
-}
-
-static mat3_t get_normal_matrix(pbr_attribs_t *attribs,
-                                pbr_uniforms_t *uniforms) {
-    if (uniforms->joint_n_matrices) {
-        mat3_t joint_n_matrices[4];
-        mat3_t skin_n_matrix;
-
-        joint_n_matrices[0] = uniforms->joint_n_matrices[(int)attribs->joint.x];
-        joint_n_matrices[1] = uniforms->joint_n_matrices[(int)attribs->joint.y];
-        joint_n_matrices[2] = uniforms->joint_n_matrices[(int)attribs->joint.z];
-        joint_n_matrices[3] = uniforms->joint_n_matrices[(int)attribs->joint.w];
-
-        skin_n_matrix = mat3_combine(joint_n_matrices, attribs->weight);
-        return mat3_mul_mat3(uniforms->normal_matrix, skin_n_matrix);
-    } else {
-        return uniforms->normal_matrix;
-    }
-}
-
 static vec4_t shadow_vertex_shader(pbr_attribs_t *attribs,
                                    pbr_varyings_t *varyings,
                                    pbr_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
     vec4_t input_position = vec4_from_vec3(attribs->position, 1);
@@ -60,8 +24,8 @@ static vec4_t shadow_vertex_shader(pbr_attribs_t *attribs,
 static vec4_t common_vertex_shader(pbr_attribs_t *attribs,
                                    pbr_varyings_t *varyings,
                                    pbr_uniforms_t *uniforms) {
-    mat4_t model_matrix = get_model_matrix(attribs, uniforms);
-    mat3_t normal_matrix = get_normal_matrix(attribs, uniforms);
+    mat4_t model_matrix = uniforms->model_matrix;
+    mat3_t normal_matrix = uniforms->normal_matrix;
     mat4_t camera_vp_matrix = uniforms->camera_vp_matrix;
     mat4_t light_vp_matrix = uniforms->light_vp_matrix;
 
@@ -110,6 +74,20 @@ vec4_t pbr_vertex_shader(void *attribs_, void *varyings_, void *uniforms_) {
     }
 }
 
+static vec4_t sample_texture(texture_t *texture, pbr_varyings_t *varyings,
+                             pbr_uniforms_t *uniforms) {
+    vec2_t texcoord = varyings->texcoord;
+    if (uniforms->texture_filter == FILTER_NEAREST) {
+        return texture_sample(texture, texcoord);
+    } else {
+        /* the derivatives follow the varyings */
+        vec2_t ddx = varyings[1].texcoord;
+        vec2_t ddy = varyings[2].texcoord;
+        return texture_sample_grad(texture, texcoord, ddx, ddy,
+                                   uniforms->texture_filter);
+    }
+}
+
 static vec4_t shadow_fragment_shader(pbr_varyings_t *varyings,
                                      pbr_uniforms_t *uniforms,
                                      int *discard) {
@@ -118,14 +96,14 @@ static vec4_t shadow_fragment_shader(pbr_varyings_t *varyings,
         if (uniforms->workflow == METALNESS_WORKFLOW) {
             alpha = uniforms->basecolor_factor.w;
             if (uniforms->basecolor_map) {
-                vec2_t texcoord = varyings->texcoord;
-                alpha *= texture_sample(uniforms->basecolor_map, texcoord).w;
+                texture_t *basecolor_map = uniforms->basecolor_map;
+                alpha *= sample_texture(basecolor_map, varyings, uniforms).w;
             }
         } else {
             alpha = uniforms->diffuse_factor.w;
             if (uniforms->diffuse_map) {
-                vec2_t texcoord = varyings->texcoord;
-                alpha *= texture_sample(uniforms->diffuse_map, texcoord).w;
+                texture_t *diffuse_map = uniforms->diffuse_map;
+                alpha *= sample_texture(diffuse_map, varyings, uniforms).w;
             }
         }
         if (alpha < uniforms->alpha_cutoff) {
@@ -145,7 +123,8 @@ typedef struct {
     vec3_t emission;
 } material_t;
 
-static material_t get_pbrm_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
+static material_t get_pbrm_material(pbr_varyings_t *varyings,
+                                    pbr_uniforms_t *uniforms) {
     vec3_t diffuse, specular, basecolor;
     float alpha, roughness, metalness;
     material_t material;
@@ -153,20 +132,23 @@ static material_t get_pbrm_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
     basecolor = vec3_from_vec4(uniforms->basecolor_factor);
     alpha = uniforms->basecolor_factor.w;
     if (uniforms->basecolor_map) {
-        vec4_t sample = texture_sample(uniforms->basecolor_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->basecolor_map, varyings,
+                                       uniforms);
         basecolor = vec3_modulate(basecolor, vec3_from_vec4(sample));
         alpha *= sample.w;
     }
 
     metalness = uniforms->metalness_factor;
     if (uniforms->metalness_map) {
-        vec4_t sample = texture_sample(uniforms->metalness_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->metalness_map, varyings,
+                                       uniforms);
         metalness *= sample.x;
     }
 
     roughness = uniforms->roughness_factor;
     if (uniforms->roughness_map) {
-        vec4_t sample = texture_sample(uniforms->roughness_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->roughness_map, varyings,
+                                       uniforms);
         roughness *= sample.x;
     }
 
@@ -185,7 +167,8 @@ static float max_component(vec3_t v) {
     return v.x > v.y && v.x > v.z ? v.x : (v.y > v.z ? v.y : v.z);
 }
 
-static material_t get_pbrs_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
+static material_t get_pbrs_material(pbr_varyings_t *varyings,
+                                    pbr_uniforms_t *uniforms) {
     vec3_t diffuse, specular;
     float alpha, roughness, glossiness;
     material_t material;
@@ -193,20 +176,23 @@ static material_t get_pbrs_material(pbr_uniforms_t *uniforms, vec2_t texcoord) {
     diffuse = vec3_from_vec4(uniforms->diffuse_factor);
     alpha = uniforms->diffuse_factor.w;
     if (uniforms->diffuse_map) {
-        vec4_t sample = texture_sample(uniforms->diffuse_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->diffuse_map, varyings,
+                                       uniforms);
         diffuse = vec3_modulate(diffuse, vec3_from_vec4(sample));
         alpha *= sample.w;
     }
 
     specular = uniforms->specular_factor;
     if (uniforms->specular_map) {
-        vec4_t sample = texture_sample(uniforms->specular_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->specular_map, varyings,
+                                       uniforms);
         specular = vec3_modulate(specular, vec3_from_vec4(sample));
     }
 
     glossiness = uniforms->glossiness_factor;
     if (uniforms->glossiness_map) {
-        vec4_t sample = texture_sample(uniforms->glossiness_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->glossiness_map, varyings,
+                                       uniforms);
         glossiness *= sample.x;
     }
 
@@ -226,8 +212,8 @@ static vec3_t get_normal_dir(pbr_varyings_t *varyings,
                              int backface) {
     vec3_t normal_dir;
     if (uniforms->normal_map) {
-        vec4_t sample = texture_sample(uniforms->normal_map,
-                                       varyings->texcoord);
+        vec4_t sample = sample_texture(uniforms->normal_map, varyings,
+                                       uniforms);
         vec3_t tangent_normal = vec3_new(sample.x * 2 - 1,
                                          sample.y * 2 - 1,
                                          sample.z * 2 - 1);
@@ -245,26 +231,27 @@ static vec3_t get_normal_dir(pbr_varyings_t *varyings,
 static material_t get_pixel_material(pbr_varyings_t *varyings,
                                      pbr_uniforms_t *uniforms,
                                      int backface) {
-    vec2_t texcoord = varyings->texcoord;
     material_t material;
 
     if (uniforms->workflow == METALNESS_WORKFLOW) {
-        material = get_pbrm_material(uniforms, texcoord);
+        material = get_pbrm_material(varyings, uniforms);
     } else {
-        material = get_pbrs_material(uniforms, texcoord);
+        material = get_pbrs_material(varyings, uniforms);
     }
 
     material.normal = get_normal_dir(varyings, uniforms, backface);
 
     if (uniforms->occlusion_map) {
-        vec4_t sample = texture_sample(uniforms->occlusion_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->occlusion_map, varyings,
+                                       uniforms);
         material.occlusion = sample.x;
     } else {
         material.occlusion = 1;
     }
 
     if (uniforms->emission_map) {
-        vec4_t sample = texture_sample(uniforms->emission_map, texcoord);
+        vec4_t sample = sample_texture(uniforms->emission_map, varyings,
+                                       uniforms);
         material.emission = vec3_from_vec4(sample);
     } else {
         material.emission = vec3_new(0, 0, 0);
@@ -506,26 +493,15 @@ vec4_t pbr_fragment_shader(void *varyings_, void *uniforms_,
 static void update_model(model_t *model, perframe_t *perframe) {
     float ambient_intensity = perframe->ambient_intensity;
     float punctual_intensity = perframe->punctual_intensity;
-    skeleton_t *skeleton = model->skeleton;
+    animation_t *animation = model->animation;
     mat4_t model_matrix = model->transform;
     mat3_t normal_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     pbr_uniforms_t *uniforms;
 
-    if (skeleton) {
-        skeleton_update_joints(skeleton, perframe->frame_time);
-        joint_matrices = skeleton_get_joint_matrices(skeleton);
-        joint_n_matrices = skeleton_get_normal_matrices(skeleton);
-        if (model->attached >= 0) {
-            mat4_t node_matrix = joint_matrices[model->attached];
-            model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
-            joint_matrices = NULL;
-            joint_n_matrices = NULL;
-        }
-    } else {
-        joint_matrices = NULL;
-        joint_n_matrices = NULL;
+    if (animation && model->attached >= 0) {
+        mat4_t *joint_matrices = animation_get_joint_matrices(animation);
+        mat4_t node_matrix = joint_matrices[model->attached];
+        model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
     }
     normal_matrix = mat3_inverse_transpose(mat3_from_mat4(model_matrix));
 
@@ -538,39 +514,44 @@ static void update_model(model_t *model, perframe_t *perframe) {
                                               perframe->light_view_matrix);
     uniforms->camera_vp_matrix = mat4_mul_mat4(perframe->camera_proj_matrix,
                                                perframe->camera_view_matrix);
-    uniforms->joint_matrices = joint_matrices;
-    uniforms->joint_n_matrices = joint_n_matrices;
     uniforms->ambient_intensity = float_clamp(ambient_intensity, 0, 5);
     uniforms->punctual_intensity = float_clamp(punctual_intensity, 0, 5);
     uniforms->shadow_map = perframe->shadow_map;
     uniforms->layer_view = perframe->layer_view;
+    uniforms->texture_filter = perframe->texture_filter;
+    program_set_derivatives(model->program,
+                            perframe->texture_filter != FILTER_NEAREST);
+}
+
+static void fetch_attribs(void *source, int index, void *attribs_) {
+    model_t *model = (model_t*)source;
+    vertex_t vertex = mesh_get_vertex(model->mesh, index);
+    pbr_attribs_t *attribs = (pbr_attribs_t*)attribs_;
+    if (model->skinned) {
+        vertex.position = model->skinned[index].position;
+        vertex.normal = model->skinned[index].normal;
+        vertex.tangent = model->skinned[index].tangent;
+    }
+    attribs->position = vertex.position;
+    attribs->texcoord = vertex.texcoord;
+    attribs->normal = vertex.normal;
+    attribs->tangent = vertex.tangent;
 }
 
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
     mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
-    program_t *program = model->program;
+    int num_vertices = mesh_get_num_vertices(mesh);
+    int num_indices = mesh_get_num_faces(mesh) * 3;
+    void *indices = mesh_get_indices(mesh);
+    int index_size = mesh_get_index_size(mesh);
     pbr_uniforms_t *uniforms;
-    pbr_attribs_t *attribs;
-    int i, j;
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->shadow_pass = shadow_pass;
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            attribs = (pbr_attribs_t*)program_get_attribs(program, j);
-            attribs->position = vertex.position;
-            attribs->texcoord = vertex.texcoord;
-            attribs->normal = vertex.normal;
-            attribs->tangent = vertex.tangent;
-            attribs->joint = vertex.joint;
-            attribs->weight = vertex.weight;
-        }
-        graphics_draw_triangle(framebuffer, program);
-    }
+    graphics_draw_indexed(framebuffer, model->program,
+                          fetch_attribs, model, num_vertices,
+                          indices, index_size, num_indices);
 }
 
 static void release_model(model_t *model) {
@@ -589,12 +570,14 @@ static void release_model(model_t *model) {
     program_release(model->program);
     cache_release_skeleton(model->skeleton);
     cache_release_mesh(model->mesh);
+    free(model->skinned);
     free(model);
 }
 
 static model_t *create_model(const char *mesh, mat4_t transform,
                              const char *skeleton, int attached,
-                             int double_sided, int enable_blend) {
+                             int double_sided, int enable_blend,
+                             float alpha_cutoff) {
     int sizeof_attribs = sizeof(pbr_attribs_t);
     int sizeof_varyings = sizeof(pbr_varyings_t);
     int sizeof_uniforms = sizeof(pbr_uniforms_t);
@@ -610,9 +593,17 @@ static model_t *create_model(const char *mesh, mat4_t transform,
     model->program = program;
     model->transform = transform;
     model->skeleton = cache_acquire_skeleton(skeleton);
+    model->animation = NULL;  /* assigned by the scene */
     model->attached = attached;
+    if (model->skeleton && attached < 0) {
+        int num_vertices = mesh_get_num_vertices(model->mesh);
+        model->skinned = (skinned_t*)malloc(sizeof(skinned_t) * num_vertices);
+    } else {
+        model->skinned = NULL;
+    }
     model->opaque = !enable_blend;
     model->distance = 0;
+    model->alpha_tested = alpha_cutoff > 0;
     model->update = update_model;
     model->draw = draw_model;
     model->release = release_model;
@@ -635,7 +626,8 @@ model_t *pbrm_create_model(const char *mesh, mat4_t transform,
     model_t *model;
 
     model = create_model(mesh, transform, skeleton, attached,
-                         material->double_sided, material->enable_blend);
+                         material->double_sided, material->enable_blend,
+                         material->alpha_cutoff);
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->basecolor_factor = material->basecolor_factor;
@@ -662,7 +654,8 @@ model_t *pbrs_create_model(const char *mesh, mat4_t transform,
     model_t *model;
 
     model = create_model(mesh, transform, skeleton, attached,
-                         material->double_sided, material->enable_blend);
+                         material->double_sided, material->enable_blend,
+                         material->alpha_cutoff);
 
     uniforms = (pbr_uniforms_t*)program_get_uniforms(model->program);
     uniforms->diffuse_factor = material->diffuse_factor;
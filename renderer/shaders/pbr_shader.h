@@ -22,8 +22,6 @@ typedef struct {
     vec2_t texcoord;
     vec3_t normal;
     vec4_t tangent;
-    vec4_t joint;
-    vec4_t weight;
 } pbr_attribs_t;
 
 typedef struct {
@@ -43,8 +41,6 @@ typedef struct {
     mat3_t normal_matrix;
     mat4_t light_vp_matrix;
     mat4_t camera_vp_matrix;
-    mat4_t *joint_matrices;
-    mat3_t *joint_n_matrices;
     float ambient_intensity;
     float punctual_intensity;
     texture_t *shadow_map;
@@ -73,6 +69,7 @@ typedef struct {
     float alpha_cutoff;
     int shadow_pass;
     int layer_view;
+    filter_t texture_filter;
 } pbr_uniforms_t;
 
 vec4_t pbr_vertex_shader(void *attribs, void *varyings, void *uniforms);
@@ -44,24 +44,23 @@ static void update_model(model_t *model, perframe_t *perframe) {
     uniforms->vp_matrix = mat4_mul_mat4(proj_matrix, view_matrix);
 }
 
+static void fetch_attribs(void *source, int index, void *attribs_) {
+    vertex_t vertex = mesh_get_vertex((mesh_t*)source, index);
+    skybox_attribs_t *attribs = (skybox_attribs_t*)attribs_;
+    attribs->position = vertex.position;
+}
+
 static void draw_model(model_t *model, framebuffer_t *framebuffer,
                        int shadow_pass) {
     if (!shadow_pass) {
         mesh_t *mesh = model->mesh;
-        int num_faces = mesh_get_num_faces(mesh);
-        vertex_t *vertices = mesh_get_vertices(mesh);
-        program_t *program = model->program;
-        skybox_attribs_t *attribs;
-        int i, j;
-
-        for (i = 0; i < num_faces; i++) {
-            for (j = 0; j < 3; j++) {
-                vertex_t vertex = vertices[i * 3 + j];
-                attribs = (skybox_attribs_t*)program_get_attribs(program, j);
-                attribs->position = vertex.position;
-            }
-            graphics_draw_triangle(framebuffer, program);
-        }
+        int num_vertices = mesh_get_num_vertices(mesh);
+        int num_indices = mesh_get_num_faces(mesh) * 3;
+        void *indices = mesh_get_indices(mesh);
+        int index_size = mesh_get_index_size(mesh);
+        graphics_draw_indexed(framebuffer, model->program,
+                              fetch_attribs, mesh, num_vertices,
+                              indices, index_size, num_indices);
     }
 }
 
@@ -94,9 +93,12 @@ model_t *skybox_create_model(const char *skybox_name, int blur_level) {
     model->program = program;
     model->transform = mat4_identity();
     model->skeleton = NULL;
+    model->animation = NULL;
     model->attached = -1;
+    model->skinned = NULL;
     model->opaque = 1;
     model->distance = 0;
+    model->alpha_tested = 0;
     model->update = update_model;
     model->draw = draw_model;
     model->release = release_model;
@@ -0,0 +1,308 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/api.h"
+#include "../core/raster.h"
+#include "test_bench.h"
+#include "test_blinn.h"
+#include "test_helper.h"
+#include "test_pbr.h"
+
+/*
+ * every blinn and pbr scene is rendered headless at fixed resolutions, along
+ * the same camera orbit and animation timeline, and the statistics of the
+ * frame times are written as json to a file, apart from the logs on the
+ * standard output, so that runs can be compared
+ *
+ * before the scenes, a synthetic texture is sampled in the linear and the
+ * tiled layouts along rows, columns and rotated directions, with and
+ * without minification, walking the pixels in 8x8 blocks as the binned
+ * rasterizer does, and the best time of each layout is kept
+ */
+
+static const int NUM_FRAMES = 30;
+
+static const int RESOLUTIONS[][2] = {
+    {800, 600},
+    {1920, 1080},
+};
+
+static const int TEXTURE_SIZE = 4096;  /* far larger than the caches */
+static const int NUM_SAMPLES = 2048;   /* per side of the sampled pixels */
+static const int BLOCK_SIZE = 8;
+static const int NUM_RUNS = 5;         /* interleaved between the layouts */
+
+typedef struct {
+    const char *name;
+    float angle;  /* of the rows of pixels in texture space, in degrees */
+    float scale;  /* texels between neighboring pixels */
+} pattern_t;
+
+static const pattern_t PATTERNS[] = {
+    {"horizontal", 0, 1},
+    {"vertical", 90, 1},
+    {"rotated", 30, 1},
+    {"minified", 30, 2},
+};
+
+typedef struct {
+    const char *pattern_name;
+    float linear_millis;
+    float tiled_millis;
+} sampling_t;
+
+typedef struct {
+    const char *test_name;
+    const char *scene_name;
+    int width, height;
+    int num_faces;
+    int num_frames;
+    float min_millis;
+    float median_millis;
+    float p95_millis;
+    float p99_millis;
+    float faces_per_second;
+} result_t;
+
+static void tick_function(context_t *context, void *userdata) {
+    scene_t *scene = (scene_t*)userdata;
+    perframe_t perframe = test_build_perframe(scene, context);
+    test_draw_scene(scene, context->framebuffer, &perframe);
+}
+
+static int compare_times(const void *time1p, const void *time2p) {
+    float time1 = *(const float*)time1p;
+    float time2 = *(const float*)time2p;
+    return time1 < time2 ? -1 : (time1 > time2 ? 1 : 0);
+}
+
+/* nearest-rank percentile of the sorted frame times, in milliseconds */
+static float get_percentile(float *frame_times, int num_frames, float rank) {
+    int index = (int)ceil(rank * (float)num_frames) - 1;
+    if (index < 0) {
+        index = 0;
+    }
+    return frame_times[index] * 1000;
+}
+
+static result_t run_benchmark(scene_t *scene, int width, int height,
+                              int num_frames) {
+    float *frame_times;
+    float sum_times = 0;
+    result_t result;
+    int i;
+
+    frame_times = test_render_headless(tick_function, scene, width, height,
+                                       num_frames, NULL);
+    for (i = 0; i < num_frames; i++) {
+        sum_times += frame_times[i];
+    }
+    qsort(frame_times, num_frames, sizeof(float), compare_times);
+
+    memset(&result, 0, sizeof(result_t));
+    result.width = width;
+    result.height = height;
+    result.num_faces = test_count_faces(scene);
+    result.num_frames = num_frames;
+    result.min_millis = frame_times[0] * 1000;
+    result.median_millis = get_percentile(frame_times, num_frames, 0.5f);
+    result.p95_millis = get_percentile(frame_times, num_frames, 0.95f);
+    result.p99_millis = get_percentile(frame_times, num_frames, 0.99f);
+    result.faces_per_second = (float)result.num_faces * (float)num_frames
+                              / sum_times;
+    darray_free(frame_times);
+
+    return result;
+}
+
+static void bench_creators(const char *test_name, creator_t creators[],
+                           int argc, char *argv[], int num_frames,
+                           result_t **results) {
+    int num_resolutions = ARRAY_SIZE(RESOLUTIONS);
+    int i, j;
+    for (i = 0; creators[i].scene_name != NULL; i++) {
+        scene_t *scene;
+        printf("scene: %s\n", creators[i].scene_name);
+        trace_begin_file("create_scene", creators[i].scene_name);
+        scene = creators[i].create_scene();
+        trace_end();
+        test_parse_options(scene, argc, argv);
+        for (j = 0; j < num_resolutions; j++) {
+            int width = RESOLUTIONS[j][0];
+            int height = RESOLUTIONS[j][1];
+            result_t result = run_benchmark(scene, width, height, num_frames);
+            result.test_name = test_name;
+            result.scene_name = creators[i].scene_name;
+            printf("bench: %dx%d, min: %.2f ms, median: %.2f ms, "
+                   "p99: %.2f ms\n", width, height, result.min_millis,
+                   result.median_millis, result.p99_millis);
+            darray_push(*results, result);
+        }
+        scene_release(scene);
+    }
+}
+
+static texture_t *create_texture(layout_t layout) {
+    image_t *image = image_create(TEXTURE_SIZE, TEXTURE_SIZE, 4, FORMAT_LDR);
+    int num_bytes = TEXTURE_SIZE * TEXTURE_SIZE * 4;
+    texture_t *texture;
+    int i;
+
+    for (i = 0; i < num_bytes; i++) {
+        image->ldr_buffer[i] = (unsigned char)(i * 7 + (i >> 12) * 13);
+    }
+    texture = texture_from_image(image, USAGE_LDR_DATA);
+    texture_set_layout(texture, layout);
+    image_release(image);
+
+    return texture;
+}
+
+/* the sum of the samples, to compare the layouts and keep the fetches */
+static double sample_texture(texture_t *texture, const pattern_t *pattern,
+                             float *millis) {
+    float radians = TO_RADIANS(pattern->angle);
+    float step = pattern->scale / (float)TEXTURE_SIZE;
+    vec2_t ddx = vec2_new((float)cos(radians) * step,
+                          (float)sin(radians) * step);
+    vec2_t ddy = vec2_new(-ddx.y, ddx.x);
+    double sum = 0;
+    float start = platform_get_time();
+    int block_x, block_y, x, y;
+
+    for (block_y = 0; block_y < NUM_SAMPLES; block_y += BLOCK_SIZE) {
+        for (block_x = 0; block_x < NUM_SAMPLES; block_x += BLOCK_SIZE) {
+            for (y = block_y; y < block_y + BLOCK_SIZE; y++) {
+                for (x = block_x; x < block_x + BLOCK_SIZE; x++) {
+                    float px = (float)x + 0.5f;
+                    float py = (float)y + 0.5f;
+                    vec2_t texcoord = vec2_new(px * ddx.x + py * ddy.x,
+                                               px * ddx.y + py * ddy.y);
+                    sum += texture_repeat_sample(texture, texcoord).x;
+                }
+            }
+        }
+    }
+    *millis = (platform_get_time() - start) * 1000;
+
+    return sum;
+}
+
+static sampling_t *bench_sampling(void) {
+    texture_t *linear = create_texture(LAYOUT_LINEAR);
+    texture_t *tiled = create_texture(LAYOUT_TILED);
+    int num_patterns = ARRAY_SIZE(PATTERNS);
+    sampling_t *samplings = NULL;
+    int i, j;
+
+    for (i = 0; i < num_patterns; i++) {
+        sampling_t sampling;
+        sampling.pattern_name = PATTERNS[i].name;
+        for (j = 0; j < NUM_RUNS; j++) {
+            float linear_millis, tiled_millis;
+            double linear_sum, tiled_sum;
+            linear_sum = sample_texture(linear, &PATTERNS[i], &linear_millis);
+            tiled_sum = sample_texture(tiled, &PATTERNS[i], &tiled_millis);
+            assert(linear_sum == tiled_sum);
+            UNUSED_VAR(linear_sum);
+            UNUSED_VAR(tiled_sum);
+            if (j == 0 || linear_millis < sampling.linear_millis) {
+                sampling.linear_millis = linear_millis;
+            }
+            if (j == 0 || tiled_millis < sampling.tiled_millis) {
+                sampling.tiled_millis = tiled_millis;
+            }
+        }
+        printf("texture: %s, linear: %.2f ms, tiled: %.2f ms\n",
+               sampling.pattern_name, sampling.linear_millis,
+               sampling.tiled_millis);
+        darray_push(samplings, sampling);
+    }
+    texture_release(linear);
+    texture_release(tiled);
+
+    return samplings;
+}
+
+static void write_samplings(FILE *file, sampling_t *samplings) {
+    int num_samplings = darray_size(samplings);
+    int i;
+    fprintf(file, "  \"texture_size\": %d,\n", TEXTURE_SIZE);
+    fprintf(file, "  \"texture_samples\": %d,\n",
+            NUM_SAMPLES * NUM_SAMPLES);
+    fprintf(file, "  \"textures\": [\n");
+    for (i = 0; i < num_samplings; i++) {
+        sampling_t *sampling = &samplings[i];
+        fprintf(file, "    {\"pattern\": \"%s\", ", sampling->pattern_name);
+        fprintf(file, "\"linear_ms\": %.3f, \"tiled_ms\": %.3f}%s\n",
+                sampling->linear_millis, sampling->tiled_millis,
+                i + 1 < num_samplings ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+}
+
+static void write_results(FILE *file, result_t *results,
+                          sampling_t *samplings, int num_frames) {
+    int num_results = darray_size(results);
+    int i;
+    fprintf(file, "{\n");
+    fprintf(file, "  \"frames\": %d,\n", num_frames);
+    fprintf(file, "  \"threads\": %d,\n", graphics_get_num_threads());
+    fprintf(file, "  \"kernel\": \"%s\",\n", raster_get_kernel());
+    write_samplings(file, samplings);
+    fprintf(file, "  \"results\": [\n");
+    for (i = 0; i < num_results; i++) {
+        result_t *result = &results[i];
+        fprintf(file, "    {\"test\": \"%s\", \"scene\": \"%s\", ",
+                result->test_name, result->scene_name);
+        fprintf(file, "\"width\": %d, \"height\": %d, \"triangles\": %d, ",
+                result->width, result->height, result->num_faces);
+        fprintf(file, "\"min_ms\": %.3f, \"median_ms\": %.3f, ",
+                result->min_millis, result->median_millis);
+        fprintf(file, "\"p95_ms\": %.3f, \"p99_ms\": %.3f, ",
+                result->p95_millis, result->p99_millis);
+        fprintf(file, "\"triangles_per_sec\": %.0f}%s\n",
+                result->faces_per_second, i + 1 < num_results ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+int test_bench(int argc, char *argv[]) {
+    const char *filename = argc > 2 ? argv[2] : NULL;
+    int num_frames = NUM_FRAMES;
+    result_t *results = NULL;
+    sampling_t *samplings;
+    FILE *file;
+    int i;
+
+    if (filename == NULL || strncmp(filename, "--", 2) == 0) {
+        printf("usage: Viewer bench result_file [options]\n");
+        return EXIT_FAILURE;
+    }
+    for (i = 3; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && atoi(argv[i + 1]) > 0) {
+            num_frames = atoi(argv[i + 1]);
+        }
+    }
+
+    /* opened first, so that a wrong path fails before the long run */
+    file = fopen(filename, "wb");
+    assert(file != NULL);
+
+    samplings = bench_sampling();
+    test_parse_load_options(argc, argv);
+    bench_creators("blinn", test_blinn_creators(), argc, argv, num_frames,
+                   &results);
+    bench_creators("pbr", test_pbr_creators(), argc, argv, num_frames,
+                   &results);
+
+    write_results(file, results, samplings, num_frames);
+    fclose(file);
+    printf("results: %s\n", filename);
+    darray_free(results);
+    darray_free(samplings);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,6 @@
+#ifndef TEST_BENCH_H
+#define TEST_BENCH_H
+
+int test_bench(int argc, char *argv[]);
+
+#endif
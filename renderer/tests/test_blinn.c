@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include "../core/api.h"
 #include "../scenes/blinn_scenes.h"
 #include "test_blinn.h"
@@ -26,11 +27,18 @@ static void tick_function(context_t *context, void *userdata) {
     test_draw_scene(scene, context->framebuffer, &perframe);
 }
 
-void test_blinn(int argc, char *argv[]) {
-    const char *scene_name = argc > 2 ? argv[2] : NULL;
-    scene_t *scene = test_create_scene(g_creators, scene_name);
+creator_t *test_blinn_creators(void) {
+    return g_creators;
+}
+
+int test_blinn(int argc, char *argv[]) {
+    scene_t *scene = test_create_scene(g_creators, argc, argv);
     if (scene) {
+        test_parse_options(scene, argc, argv);
         test_enter_mainloop(tick_function, scene);
         scene_release(scene);
+        return EXIT_SUCCESS;
+    } else {
+        return EXIT_FAILURE;
     }
 }
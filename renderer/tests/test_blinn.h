@@ -1,6 +1,9 @@
 #ifndef TEST_BLINN_H
 #define TEST_BLINN_H
 
-void test_blinn(int argc, char *argv[]);
+#include "test_helper.h"
+
+int test_blinn(int argc, char *argv[]);
+creator_t *test_blinn_creators(void);
 
 #endif
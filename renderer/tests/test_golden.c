@@ -0,0 +1,453 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/api.h"
+#include "test_blinn.h"
+#include "test_golden.h"
+#include "test_helper.h"
+#include "test_pbr.h"
+
+/*
+ * every blinn and pbr scene is rendered headless from canonical viewpoints
+ * around it, at the start of its animations, and compared against the
+ * reference images in a directory, a view fails if its reference is
+ * missing, if too many of its pixels differ by more than a threshold in any
+ * channel, or if its structural similarity to the reference is too low, the
+ * rendered and difference images of failures are saved as well
+ *
+ * with --threads, the views rendered by a single thread and by worker
+ * threads are compared instead, and must be bit-exact, since binned
+ * rasterization processes the fragments of every pixel in submission order
+ *
+ * with --dqs, the animated scenes have references of their own, since dual
+ * quaternion skinning preserves the volume that linear blend skinning loses
+ * around the joints, and moves their silhouettes by design
+ *
+ * with --virtual, the pages are evicted before every view, so that a view
+ * does not depend on the ones rendered before it, and the view is rendered
+ * again until none of its fetches missed a page
+ *
+ * with --compressed, the threshold is looser by default, since the block
+ * compression moves the texels by a few levels, while the coverage lost by
+ * an alpha tested material still differs by far more than it
+ */
+
+static const float VIEWPOINTS[] = {0, 1 / 3.0f, 2 / 3.0f};  /* in turns */
+static const char *const DIRECTORY = "golden";
+static const int WIDTH = 200;  /* small enough to keep the references */
+static const int HEIGHT = 150;
+static const int THRESHOLD = 8;
+static const int COMPRESSED_THRESHOLD = 16;
+static const float MAX_OUTLIERS = 0.001f;  /* fraction of the pixels */
+static const float MIN_SSIM = 0.98f;
+static const int MIN_THREADS = 2;
+static const int MAX_RENDERS = 16;  /* until the pages of a view are loaded */
+
+typedef struct {
+    const char *directory;
+    const char *scene_name;  /* NULL for all the scenes */
+    int threshold;
+    float min_ssim;
+    int exact;
+    int update;
+    int threads;
+    int dual_quat;
+} settings_t;
+
+typedef struct {
+    int num_passed;
+    int num_failed;
+    int num_recorded;
+} summary_t;
+
+typedef struct {
+    int num_outliers;
+    int max_difference;
+    float ssim;
+} comparison_t;
+
+static void tick_function(context_t *context, void *userdata) {
+    scene_t *scene = (scene_t*)userdata;
+    perframe_t perframe = test_build_perframe(scene, context);
+    test_draw_scene(scene, context->framebuffer, &perframe);
+}
+
+static image_t *render_view(scene_t *scene, float orbit) {
+    image_t *image = NULL;
+    int i;
+
+    texture_evict_pages();
+    for (i = 0; i < MAX_RENDERS; i++) {
+        int num_misses = texture_get_page_stats().num_misses;
+        if (image != NULL) {
+            image_release(image);
+        }
+        image = test_render_view(tick_function, scene, WIDTH, HEIGHT, orbit);
+        if (texture_get_page_stats().num_misses == num_misses) {
+            break;
+        }
+    }
+    return image;
+}
+
+static int get_difference(image_t *image1, image_t *image2, int index) {
+    int difference = 0;
+    int k;
+    for (k = 0; k < 3; k++) {
+        int value1 = image1->ldr_buffer[index * 3 + k];
+        int value2 = image2->ldr_buffer[index * 3 + k];
+        int channel = value1 > value2 ? value1 - value2 : value2 - value1;
+        if (channel > difference) {
+            difference = channel;
+        }
+    }
+    return difference;
+}
+
+static float *get_lumas(image_t *image) {
+    int num_pixels = image->width * image->height;
+    float *lumas = (float*)malloc(sizeof(float) * num_pixels);
+    int i;
+    for (i = 0; i < num_pixels; i++) {
+        unsigned char *pixel = &image->ldr_buffer[i * 3];
+        lumas[i] = 0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2];
+    }
+    return lumas;
+}
+
+/*
+ * for structural similarity, see
+ * https://en.wikipedia.org/wiki/Structural_similarity
+ *
+ * the similarity of the lumas is averaged over windows of 8x8 pixels,
+ * which are 4 pixels apart, with uniform rather than gaussian weights
+ */
+
+#define WINDOW_SIZE 8
+#define WINDOW_STEP 4
+
+static float compute_ssim(image_t *image1, image_t *image2) {
+    double c1 = (0.01 * 255) * (0.01 * 255);
+    double c2 = (0.03 * 255) * (0.03 * 255);
+    double num_samples = WINDOW_SIZE * WINDOW_SIZE;
+    float *lumas1 = get_lumas(image1);
+    float *lumas2 = get_lumas(image2);
+    int width = image1->width;
+    double sum_ssim = 0;
+    int num_windows = 0;
+    int x, y, i, j;
+
+    for (y = 0; y + WINDOW_SIZE <= image1->height; y += WINDOW_STEP) {
+        for (x = 0; x + WINDOW_SIZE <= width; x += WINDOW_STEP) {
+            double sum1 = 0, sum2 = 0, sum11 = 0, sum22 = 0, sum12 = 0;
+            double mean1, mean2, var1, var2, covar;
+            for (j = y; j < y + WINDOW_SIZE; j++) {
+                for (i = x; i < x + WINDOW_SIZE; i++) {
+                    double luma1 = lumas1[j * width + i];
+                    double luma2 = lumas2[j * width + i];
+                    sum1 += luma1;
+                    sum2 += luma2;
+                    sum11 += luma1 * luma1;
+                    sum22 += luma2 * luma2;
+                    sum12 += luma1 * luma2;
+                }
+            }
+            mean1 = sum1 / num_samples;
+            mean2 = sum2 / num_samples;
+            var1 = sum11 / num_samples - mean1 * mean1;
+            var2 = sum22 / num_samples - mean2 * mean2;
+            covar = sum12 / num_samples - mean1 * mean2;
+            sum_ssim += (2 * mean1 * mean2 + c1) * (2 * covar + c2)
+                        / ((mean1 * mean1 + mean2 * mean2 + c1)
+                           * (var1 + var2 + c2));
+            num_windows += 1;
+        }
+    }
+
+    free(lumas1);
+    free(lumas2);
+    return num_windows > 0 ? (float)(sum_ssim / num_windows) : 1;
+}
+
+static comparison_t compare_images(image_t *reference, image_t *image,
+                                   int threshold) {
+    int num_pixels = image->width * image->height;
+    comparison_t comparison;
+    int i;
+
+    comparison.num_outliers = 0;
+    comparison.max_difference = 0;
+    for (i = 0; i < num_pixels; i++) {
+        int difference = get_difference(reference, image, i);
+        if (difference > threshold) {
+            comparison.num_outliers += 1;
+        }
+        if (difference > comparison.max_difference) {
+            comparison.max_difference = difference;
+        }
+    }
+    comparison.ssim = compute_ssim(reference, image);
+    return comparison;
+}
+
+/* the reference dimmed in gray, with the outliers in red */
+static void save_difference(image_t *reference, image_t *image,
+                            int threshold, const char *filename) {
+    int num_pixels = image->width * image->height;
+    image_t *difference;
+    int i;
+
+    difference = image_create(image->width, image->height, 3, FORMAT_LDR);
+    for (i = 0; i < num_pixels; i++) {
+        unsigned char *pixel = &reference->ldr_buffer[i * 3];
+        unsigned char *output = &difference->ldr_buffer[i * 3];
+        int value = get_difference(reference, image, i);
+        if (value > threshold) {
+            output[0] = (unsigned char)(value < 64 ? 128 + value * 2 : 255);
+            output[1] = 0;
+            output[2] = 0;
+        } else {
+            int luma = (pixel[0] + pixel[1] + pixel[2]) / 12;
+            output[0] = output[1] = output[2] = (unsigned char)luma;
+        }
+    }
+    image_save(difference, filename);
+    image_release(difference);
+}
+
+static void get_view_name(const char *directory, const char *test_name,
+                          const char *scene_name, int view,
+                          const char *suffix, char *name) {
+    assert(strlen(directory) + strlen(test_name) + strlen(scene_name)
+           + strlen(suffix) + 16 < PATH_SIZE);
+    sprintf(name, "%s/%s_%s_%d%s.tga", directory, test_name, scene_name,
+            view, suffix);
+}
+
+static int file_exists(const char *filename) {
+    FILE *file = fopen(filename, "rb");
+    if (file != NULL) {
+        fclose(file);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+static int check_view(image_t *reference, image_t *image,
+                      settings_t *settings, const char *output_name,
+                      const char *difference_name) {
+    int threshold = settings->exact ? 0 : settings->threshold;
+    int num_pixels = image->width * image->height;
+    int max_outliers = settings->exact ? 0 : (int)(MAX_OUTLIERS * num_pixels);
+    comparison_t comparison;
+    int passed;
+
+    assert(reference->channels == 3 && reference->format == FORMAT_LDR);
+    if (reference->width != image->width
+            || reference->height != image->height) {
+        printf("FAILED, reference size: %dx%d\n", reference->width,
+               reference->height);
+        return 0;
+    }
+
+    comparison = compare_images(reference, image, threshold);
+    passed = comparison.num_outliers <= max_outliers;
+    if (!settings->exact && comparison.ssim < settings->min_ssim) {
+        passed = 0;
+    }
+    printf("%s, outliers: %d, max difference: %d, ssim: %.4f\n",
+           passed ? "passed" : "FAILED", comparison.num_outliers,
+           comparison.max_difference, comparison.ssim);
+    if (!passed) {
+        image_save(image, output_name);
+        save_difference(reference, image, threshold, difference_name);
+        printf("saved: %s, %s\n", output_name, difference_name);
+    }
+    return passed;
+}
+
+static void check_threads(scene_t *scene, const char *test_name,
+                          const char *scene_name, settings_t *settings,
+                          summary_t *summary) {
+    int num_views = ARRAY_SIZE(VIEWPOINTS);
+    int num_configured = graphics_get_num_threads();
+    int num_threads = platform_get_num_cores();
+    int i;
+
+    if (num_threads < MIN_THREADS) {
+        num_threads = MIN_THREADS;
+    }
+    for (i = 0; i < num_views; i++) {
+        char output_name[PATH_SIZE];
+        char difference_name[PATH_SIZE];
+        image_t *serial, *threaded;
+
+        get_view_name(settings->directory, test_name, scene_name, i,
+                      "_threaded", output_name);
+        get_view_name(settings->directory, test_name, scene_name, i,
+                      "_threads_diff", difference_name);
+        graphics_set_num_threads(1);
+        serial = render_view(scene, VIEWPOINTS[i]);
+        graphics_set_num_threads(num_threads);
+        threaded = render_view(scene, VIEWPOINTS[i]);
+
+        printf("view %d, 1 vs %d threads: ", i, num_threads);
+        if (check_view(serial, threaded, settings, output_name,
+                       difference_name)) {
+            summary->num_passed += 1;
+        } else {
+            summary->num_failed += 1;
+        }
+        image_release(serial);
+        image_release(threaded);
+    }
+    graphics_set_num_threads(num_configured);
+}
+
+static void check_references(scene_t *scene, const char *test_name,
+                             const char *scene_name, settings_t *settings,
+                             summary_t *summary) {
+    int num_views = ARRAY_SIZE(VIEWPOINTS);
+    int dual_quat = settings->dual_quat && darray_size(scene->animations) > 0;
+    int i;
+    for (i = 0; i < num_views; i++) {
+        char reference_name[PATH_SIZE];
+        char output_name[PATH_SIZE];
+        char difference_name[PATH_SIZE];
+        image_t *image;
+
+        get_view_name(settings->directory, test_name, scene_name, i,
+                      dual_quat ? "_dqs" : "", reference_name);
+        get_view_name(settings->directory, test_name, scene_name, i,
+                      dual_quat ? "_dqs_out" : "_out", output_name);
+        get_view_name(settings->directory, test_name, scene_name, i,
+                      dual_quat ? "_dqs_diff" : "_diff", difference_name);
+        image = render_view(scene, VIEWPOINTS[i]);
+
+        printf("view %d: ", i);
+        if (settings->update) {
+            image_save(image, reference_name);
+            printf("recorded: %s\n", reference_name);
+            summary->num_recorded += 1;
+        } else if (!file_exists(reference_name)) {
+            printf("FAILED, missing: %s\n", reference_name);
+            summary->num_failed += 1;
+        } else {
+            image_t *reference = image_load(reference_name);
+            if (check_view(reference, image, settings, output_name,
+                           difference_name)) {
+                summary->num_passed += 1;
+            } else {
+                summary->num_failed += 1;
+            }
+            image_release(reference);
+        }
+        image_release(image);
+    }
+}
+
+static void check_creators(const char *test_name, creator_t creators[],
+                           int argc, char *argv[], settings_t *settings,
+                           summary_t *summary) {
+    int i;
+    for (i = 0; creators[i].scene_name != NULL; i++) {
+        const char *scene_name = creators[i].scene_name;
+        scene_t *scene;
+
+        if (settings->scene_name != NULL
+                && strcmp(settings->scene_name, scene_name) != 0) {
+            continue;
+        }
+        printf("scene: %s\n", scene_name);
+        trace_begin_file("create_scene", scene_name);
+        scene = creators[i].create_scene();
+        trace_end();
+        test_parse_options(scene, argc, argv);
+        if (settings->threads) {
+            check_threads(scene, test_name, scene_name, settings, summary);
+        } else {
+            check_references(scene, test_name, scene_name, settings, summary);
+        }
+        scene_release(scene);
+    }
+}
+
+/*
+ * the options of the test are taken out, the others apply to every scene,
+ * and the directory is always in place of the scene name
+ */
+static char **parse_settings(int argc, char *argv[], settings_t *settings) {
+    char **scene_argv = NULL;
+    int compressed = 0;
+    int i = 2;
+
+    if (argc > 2 && strncmp(argv[2], "--", 2) != 0) {
+        settings->directory = argv[i++];
+    } else {
+        settings->directory = DIRECTORY;
+    }
+    darray_push(scene_argv, argv[0]);
+    darray_push(scene_argv, argv[1]);
+    darray_push(scene_argv, (char*)settings->directory);
+
+    settings->scene_name = NULL;
+    settings->threshold = -1;  /* depends on the compression */
+    settings->min_ssim = MIN_SSIM;
+    settings->exact = 0;
+    settings->update = 0;
+    settings->threads = 0;
+    settings->dual_quat = 0;
+    for (; i < argc; i++) {
+        if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            settings->scene_name = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            settings->threshold = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--ssim") == 0 && i + 1 < argc) {
+            settings->min_ssim = (float)atof(argv[++i]);
+        } else if (strcmp(argv[i], "--exact") == 0) {
+            settings->exact = 1;
+        } else if (strcmp(argv[i], "--update") == 0) {
+            settings->update = 1;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            settings->threads = 1;
+            settings->exact = 1;
+        } else if (strcmp(argv[i], "--dqs") == 0) {
+            settings->dual_quat = 1;  /* applies to the scenes as well */
+            darray_push(scene_argv, argv[i]);
+        } else if (strcmp(argv[i], "--compressed") == 0) {
+            compressed = 1;  /* applies to the scenes as well */
+            darray_push(scene_argv, argv[i]);
+        } else {
+            darray_push(scene_argv, argv[i]);
+        }
+    }
+    if (settings->threshold < 0) {
+        settings->threshold = compressed ? COMPRESSED_THRESHOLD : THRESHOLD;
+    }
+    return scene_argv;
+}
+
+int test_golden(int argc, char *argv[]) {
+    settings_t settings;
+    summary_t summary;
+    char **scene_argv;
+    int scene_argc;
+
+    scene_argv = parse_settings(argc, argv, &settings);
+    scene_argc = darray_size(scene_argv);
+
+    memset(&summary, 0, sizeof(summary_t));
+    test_parse_load_options(scene_argc, scene_argv);
+    check_creators("blinn", test_blinn_creators(), scene_argc, scene_argv,
+                   &settings, &summary);
+    check_creators("pbr", test_pbr_creators(), scene_argc, scene_argv,
+                   &settings, &summary);
+    darray_free(scene_argv);
+
+    printf("golden: %d passed, %d failed, %d recorded\n",
+           summary.num_passed, summary.num_failed, summary.num_recorded);
+    return summary.num_failed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
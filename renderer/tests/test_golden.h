@@ -0,0 +1,6 @@
+#ifndef TEST_GOLDEN_H
+#define TEST_GOLDEN_H
+
+int test_golden(int argc, char *argv[]);
+
+#endif
@@ -1,8 +1,11 @@
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "../core/api.h"
+#include "../core/private.h"
+#include "../shaders/cache_helper.h"
 #include "test_helper.h"
 
 /* mainloop related functions */
@@ -20,6 +23,20 @@ static const float LIGHT_SPEED = PI;
 
 static const float CLICK_DELAY = 0.25f;
 
+static const int PAGE_BUDGET = 16 * 1024 * 1024;
+
+static const float HEADLESS_TIMESTEP = 1 / 60.0f;
+static const float HEADLESS_ORBIT = 0.125f;  /* turns per second */
+
+typedef struct {
+    int enabled;
+    int num_frames;
+    int width, height;
+    const char *output;  /* NULL if the frames are not saved */
+} headless_t;
+
+static headless_t g_headless = {0, 0, 0, 0, NULL};
+
 typedef struct {
     /* orbit */
     int is_orbiting;
@@ -168,6 +185,199 @@ static vec3_t get_light_dir(record_t *record) {
     return vec3_new(-x, -y, -z);
 }
 
+static void print_page_stats(pagestats_t *last_stats) {
+    pagestats_t stats = texture_get_page_stats();
+    if (stats.num_resident > 0) {
+        printf("pages: %d hits, %d misses, %d resident (%d KB)\n",
+               stats.num_hits - last_stats->num_hits,
+               stats.num_misses - last_stats->num_misses,
+               stats.num_resident, stats.resident_bytes / 1024);
+    }
+    *last_stats = stats;
+}
+
+/* averages per frame, printed only if compiled with GRAPHICS_STATS */
+static void print_pipeline_stats(int num_frames) {
+    stats_t stats = graphics_get_stats();
+    if (stats.num_triangles > 0) {
+        double millis = 1000 / (double)num_frames;
+        printf("triangles: %d submitted, %d clipped, %d outside, "
+               "%d backfacing, %d degenerate, %d occluded\n",
+               stats.num_triangles / num_frames,
+               stats.num_clipped / num_frames,
+               stats.num_outside / num_frames,
+               stats.num_backfacing / num_frames,
+               stats.num_degenerate / num_frames,
+               stats.num_occluded / num_frames);
+        printf("fragments: %d tested, %d depth rejected, %d shaded, "
+               "%d discarded, %d blended\n",
+               stats.num_tested / num_frames,
+               stats.num_depth_rejected / num_frames,
+               stats.num_shaded / num_frames,
+               stats.num_discarded / num_frames,
+               stats.num_blended / num_frames);
+        printf("stages: vertex %.2f ms, clip %.2f ms, raster %.2f ms, "
+               "fragment %.2f ms\n",
+               stats.vertex_time * millis, stats.clip_time * millis,
+               stats.raster_time * millis, stats.fragment_time * millis);
+    }
+    graphics_reset_stats();
+}
+
+/*
+ * frames are rendered offscreen without a window, with a fixed timestep,
+ * the camera orbiting around its target and the light circling around the
+ * scene, so that the same options always produce the same frames
+ */
+
+static image_t *capture_frame(framebuffer_t *framebuffer, format_t format) {
+    int num_pixels = framebuffer->width * framebuffer->height;
+    image_t *image;
+    int i, k;
+
+    /* images store the bottom row first, like the framebuffer */
+    image = image_create(framebuffer->width, framebuffer->height, 3, format);
+    for (i = 0; i < num_pixels; i++) {
+        for (k = 0; k < 3; k++) {
+            unsigned char value = framebuffer->color_buffer[i * 4 + k];
+            if (format == FORMAT_HDR) {
+                image->hdr_buffer[i * 3 + k] = float_from_uchar(value);
+            } else {
+                image->ldr_buffer[i * 3 + k] = value;
+            }
+        }
+    }
+    return image;
+}
+
+static void save_frame(framebuffer_t *framebuffer, const char *filename) {
+    int is_hdr = strcmp(private_get_extension(filename), "hdr") == 0;
+    image_t *image = capture_frame(framebuffer,
+                                   is_hdr ? FORMAT_HDR : FORMAT_LDR);
+    image_save(image, filename);
+    image_release(image);
+}
+
+static void get_frame_name(const char *output, int frame, char *name) {
+    const char *extension = private_get_extension(output);
+    int length = (int)(extension - output) - 1;  /* without the dot */
+    assert(length >= 0 && strlen(output) + 5 < PATH_SIZE);
+    sprintf(name, "%.*s_%04d.%s", length, output, frame, extension);
+}
+
+/* returns a darray of the frame times in seconds, without saving */
+float *test_render_headless(tickfunc_t *tickfunc, void *userdata,
+                            int width, int height, int num_frames,
+                            const char *output) {
+    float aspect = (float)width / (float)height;
+    framebuffer_t *framebuffer = framebuffer_create(width, height);
+    camera_t *camera = camera_create(CAMERA_POSITION, CAMERA_TARGET, aspect);
+    float *frame_times = NULL;
+    record_t record;
+    context_t context;
+    int i;
+
+    memset(&record, 0, sizeof(record_t));
+    record.light_theta = LIGHT_THETA;
+    record.light_phi = LIGHT_PHI;
+
+    memset(&context, 0, sizeof(context_t));
+    context.framebuffer = framebuffer;
+    context.camera = camera;
+    context.delta_time = HEADLESS_TIMESTEP;
+
+    for (i = 0; i < num_frames; i++) {
+        double start_time;
+        if (i > 0) {
+            motion_t motion;
+            motion.orbit = vec2_new(HEADLESS_ORBIT * HEADLESS_TIMESTEP, 0);
+            motion.pan = vec2_new(0, 0);
+            motion.dolly = 0;
+            camera_update_transform(camera, motion);
+            record.light_theta += LIGHT_SPEED * HEADLESS_TIMESTEP;
+        }
+        context.light_dir = get_light_dir(&record);
+        context.frame_time = (float)i * HEADLESS_TIMESTEP;
+        trace_begin("frame");
+        start_time = platform_get_clock();
+        tickfunc(&context, userdata);
+        darray_push(frame_times,
+                    (float)(platform_get_clock() - start_time));
+        trace_end();
+
+        if (output != NULL) {
+            trace_begin("save frame");
+            if (num_frames == 1) {
+                save_frame(framebuffer, output);
+            } else {
+                char name[PATH_SIZE];
+                get_frame_name(output, i, name);
+                save_frame(framebuffer, name);
+            }
+            trace_end();
+        }
+    }
+
+    framebuffer_release(framebuffer);
+    camera_release(camera);
+    return frame_times;
+}
+
+/* returns the first frame as seen after orbiting the camera, in turns */
+image_t *test_render_view(tickfunc_t *tickfunc, void *userdata,
+                          int width, int height, float orbit) {
+    float aspect = (float)width / (float)height;
+    framebuffer_t *framebuffer = framebuffer_create(width, height);
+    camera_t *camera = camera_create(CAMERA_POSITION, CAMERA_TARGET, aspect);
+    image_t *image;
+    record_t record;
+    context_t context;
+    motion_t motion;
+
+    motion.orbit = vec2_new(orbit, 0);
+    motion.pan = vec2_new(0, 0);
+    motion.dolly = 0;
+    camera_update_transform(camera, motion);
+
+    memset(&record, 0, sizeof(record_t));
+    record.light_theta = LIGHT_THETA;
+    record.light_phi = LIGHT_PHI;
+
+    memset(&context, 0, sizeof(context_t));
+    context.framebuffer = framebuffer;
+    context.camera = camera;
+    context.light_dir = get_light_dir(&record);
+    context.frame_time = 0;
+    context.delta_time = HEADLESS_TIMESTEP;
+
+    trace_begin("frame");
+    tickfunc(&context, userdata);
+    trace_end();
+    image = capture_frame(framebuffer, FORMAT_LDR);
+
+    framebuffer_release(framebuffer);
+    camera_release(camera);
+    return image;
+}
+
+static void run_headless(tickfunc_t *tickfunc, void *userdata) {
+    float *frame_times;
+    float sum_times = 0;
+    int i;
+
+    graphics_reset_stats();
+    frame_times = test_render_headless(
+        tickfunc, userdata, g_headless.width, g_headless.height,
+        g_headless.num_frames, g_headless.output);
+    for (i = 0; i < g_headless.num_frames; i++) {
+        sum_times += frame_times[i];
+    }
+    printf("frames: %d, avg: %.2f ms\n", g_headless.num_frames,
+           sum_times * 1000 / (float)g_headless.num_frames);
+    print_pipeline_stats(g_headless.num_frames);
+    darray_free(frame_times);
+}
+
 void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     window_t *window;
     framebuffer_t *framebuffer;
@@ -179,6 +389,12 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     float prev_time;
     float print_time;
     int num_frames;
+    pagestats_t page_stats;
+
+    if (g_headless.enabled) {
+        run_headless(tickfunc, userdata);
+        return;
+    }
 
     window = window_create(WINDOW_TITLE, WINDOW_WIDTH, WINDOW_HEIGHT);
     framebuffer = framebuffer_create(WINDOW_WIDTH, WINDOW_HEIGHT);
@@ -201,6 +417,8 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
     input_set_callbacks(window, callbacks);
 
     num_frames = 0;
+    page_stats = texture_get_page_stats();
+    graphics_reset_stats();
     prev_time = platform_get_time();
     print_time = prev_time;
     while (!window_should_close(window)) {
@@ -217,14 +435,20 @@ void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata) {
         context.double_click = record.double_click;
         context.frame_time = curr_time;
         context.delta_time = delta_time;
+        trace_begin("frame");
         tickfunc(&context, userdata);
+        trace_end();
 
+        trace_begin("present");
         window_draw_buffer(window, framebuffer);
+        trace_end();
         num_frames += 1;
         if (curr_time - print_time >= 1) {
             int sum_millis = (int)((curr_time - print_time) * 1000);
             int avg_millis = sum_millis / num_frames;
             printf("fps: %3d, avg: %3d ms\n", num_frames, avg_millis);
+            print_page_stats(&page_stats);
+            print_pipeline_stats(num_frames);
             num_frames = 0;
             print_time = curr_time;
         }
@@ -250,31 +474,28 @@ typedef struct {vec3_t min; vec3_t max;} bbox_t;
 
 static bbox_t get_model_bbox(model_t *model) {
     mesh_t *mesh = model->mesh;
-    int num_faces = mesh_get_num_faces(mesh);
-    vertex_t *vertices = mesh_get_vertices(mesh);
+    int num_vertices = mesh_get_num_vertices(mesh);
     mat4_t model_matrix = model->transform;
     bbox_t bbox;
-    int i, j;
+    int i;
 
-    if (model->skeleton && model->attached >= 0) {
+    if (model->animation && model->attached >= 0) {
         mat4_t *joint_matrices;
         mat4_t node_matrix;
-        skeleton_update_joints(model->skeleton, 0);
-        joint_matrices = skeleton_get_joint_matrices(model->skeleton);
+        animation_update_joints(model->animation, 0);
+        joint_matrices = animation_get_joint_matrices(model->animation);
         node_matrix = joint_matrices[model->attached];
         model_matrix = mat4_mul_mat4(model_matrix, node_matrix);
     }
 
     bbox.min = vec3_new(+1e6, +1e6, +1e6);
     bbox.max = vec3_new(-1e6, -1e6, -1e6);
-    for (i = 0; i < num_faces; i++) {
-        for (j = 0; j < 3; j++) {
-            vertex_t vertex = vertices[i * 3 + j];
-            vec4_t local_pos = vec4_from_vec3(vertex.position, 1);
-            vec4_t world_pos = mat4_mul_vec4(model_matrix, local_pos);
-            bbox.min = vec3_min(bbox.min, vec3_from_vec4(world_pos));
-            bbox.max = vec3_max(bbox.max, vec3_from_vec4(world_pos));
-        }
+    for (i = 0; i < num_vertices; i++) {
+        vertex_t vertex = mesh_get_vertex(mesh, i);
+        vec4_t local_pos = vec4_from_vec3(vertex.position, 1);
+        vec4_t world_pos = mat4_mul_vec4(model_matrix, local_pos);
+        bbox.min = vec3_min(bbox.min, vec3_from_vec4(world_pos));
+        bbox.max = vec3_max(bbox.max, vec3_from_vec4(world_pos));
     }
     return bbox;
 }
@@ -295,7 +516,7 @@ static bbox_t get_scene_bbox(scene_t *scene) {
     return bbox;
 }
 
-static int count_num_faces(scene_t *scene) {
+int test_count_faces(scene_t *scene) {
     int num_models = darray_size(scene->models);
     int num_faces = 0;
     int i;
@@ -307,8 +528,29 @@ static int count_num_faces(scene_t *scene) {
     return num_faces;
 }
 
-scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
+/* options that must be known before the textures are loaded */
+void test_parse_load_options(int argc, char *argv[]) {
+    int i;
+    for (i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--virtual") == 0) {
+            cache_enable_virtual_textures(PAGE_BUDGET);
+        } else if (strcmp(argv[i], "--bilinear") == 0
+                || strcmp(argv[i], "--trilinear") == 0) {
+            cache_enable_mipmaps();
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            /* started before loading, written when the viewer exits */
+            trace_start(argv[++i]);
+            printf("trace: %s\n", argv[i]);
+        }
+    }
+}
+
+scene_t *test_create_scene(creator_t creators[], int argc, char *argv[]) {
+    const char *scene_name = argc > 2 ? argv[2] : NULL;
     scene_t *scene = NULL;
+    int i;
+
+    test_parse_load_options(argc, argv);
     if (scene_name == NULL) {
         int num_creators = 0;
         while (creators[num_creators].scene_name != NULL) {
@@ -318,20 +560,23 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
             int index = rand() % num_creators;
             scene_name = creators[index].scene_name;
             printf("scene: %s\n", scene_name);
+            trace_begin_file("create_scene", scene_name);
             scene = creators[index].create_scene();
+            trace_end();
         }
     } else {
-        int i;
         for (i = 0; creators[i].scene_name != NULL; i++) {
             if (strcmp(creators[i].scene_name, scene_name) == 0) {
                 printf("scene: %s\n", scene_name);
+                trace_begin_file("create_scene", scene_name);
                 scene = creators[i].create_scene();
+                trace_end();
                 break;
             }
         }
     }
     if (scene) {
-        int num_faces = count_num_faces(scene);
+        int num_faces = test_count_faces(scene);
         bbox_t bbox = get_scene_bbox(scene);
         vec3_t center = vec3_div(vec3_add(bbox.min, bbox.max), 2);
         vec3_t extent = vec3_sub(bbox.max, bbox.min);
@@ -348,7 +593,6 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
         printf("ambient: %s\n", with_ambient ? "on" : "off");
         printf("punctual: %s\n", with_punctual ? "on" : "off");
     } else {
-        int i;
         printf("scene not found: %s\n", scene_name);
         printf("available scenes: ");
         for (i = 0; creators[i].scene_name != NULL; i++) {
@@ -362,6 +606,121 @@ scene_t *test_create_scene(creator_t creators[], const char *scene_name) {
     return scene;
 }
 
+/* returns the number of models whose vertices fit the packed layout */
+static int pack_scene_meshes(scene_t *scene) {
+    int num_models = darray_size(scene->models);
+    int num_packed = 0;
+    int i;
+    for (i = 0; i < num_models; i++) {
+        mesh_t *mesh = scene->models[i]->mesh;
+        mesh_pack_vertices(mesh);
+        if (mesh_is_packed(mesh)) {
+            num_packed += 1;
+        }
+    }
+    return num_packed;
+}
+
+static const char *get_filter_name(filter_t filter) {
+    if (filter == FILTER_BILINEAR) {
+        return "bilinear";
+    } else if (filter == FILTER_TRILINEAR) {
+        return "trilinear";
+    } else {
+        return "nearest";
+    }
+}
+
+static void set_scene_skinning(scene_t *scene, skinning_t skinning) {
+    int num_animations = darray_size(scene->animations);
+    int i;
+    for (i = 0; i < num_animations; i++) {
+        animation_set_skinning(scene->animations[i], skinning);
+    }
+}
+
+void test_parse_options(scene_t *scene, int argc, char *argv[]) {
+    int packed = -1;  /* the number of packed models if requested */
+    int dual_quat = 0;
+    int compressed = 0;
+    int tiled = 0;
+    int virtual_textures = 0;
+    int i;
+
+    g_headless.num_frames = 1;
+    g_headless.width = WINDOW_WIDTH;
+    g_headless.height = WINDOW_HEIGHT;
+    for (i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--prepass") == 0) {
+            scene->depth_prepass = 1;
+        } else if (strcmp(argv[i], "--visibility") == 0) {
+            scene->visibility_buffer = 1;
+        } else if (strcmp(argv[i], "--packed") == 0) {
+            packed = pack_scene_meshes(scene);
+        } else if (strcmp(argv[i], "--dqs") == 0) {
+            set_scene_skinning(scene, SKINNING_DUAL_QUATERNION);
+            dual_quat = 1;
+        } else if (strcmp(argv[i], "--bilinear") == 0) {
+            scene->texture_filter = FILTER_BILINEAR;
+        } else if (strcmp(argv[i], "--trilinear") == 0) {
+            scene->texture_filter = FILTER_TRILINEAR;
+        } else if (strcmp(argv[i], "--compressed") == 0) {
+            cache_compress_textures();
+            compressed = 1;
+        } else if (strcmp(argv[i], "--tiled") == 0) {
+            cache_tile_textures();
+            tiled = 1;
+        } else if (strcmp(argv[i], "--virtual") == 0) {
+            virtual_textures = 1;  /* applied when the scene was created */
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            g_headless.enabled = 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            g_headless.num_frames = atoi(argv[++i]);
+            if (g_headless.num_frames < 1) {
+                g_headless.num_frames = 1;
+            }
+        } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            int width, height;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2
+                    && width > 0 && height > 0) {
+                g_headless.width = width;
+                g_headless.height = height;
+            } else {
+                printf("invalid size: %s\n", argv[i]);
+            }
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            const char *extension = private_get_extension(argv[++i]);
+            if (strcmp(extension, "tga") == 0
+                    || strcmp(extension, "hdr") == 0) {
+                g_headless.output = argv[i];
+            } else {
+                printf("invalid output: %s\n", argv[i]);
+            }
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            i += 1;  /* started when the scene was created */
+        } else {
+            printf("unknown option: %s\n", argv[i]);
+        }
+    }
+    printf("prepass: %s\n", scene->depth_prepass ? "on" : "off");
+    printf("visibility: %s\n", scene->visibility_buffer ? "on" : "off");
+    if (packed >= 0) {
+        printf("packed: %d of %d models\n", packed,
+               darray_size(scene->models));
+    } else {
+        printf("packed: off\n");
+    }
+    printf("skinning: %s\n", dual_quat ? "dual quaternion" : "linear");
+    printf("compressed: %s\n", compressed ? "on" : "off");
+    printf("tiled: %s\n", tiled ? "on" : "off");
+    printf("virtual: %s\n", virtual_textures ? "on" : "off");
+    printf("filter: %s\n", get_filter_name(scene->texture_filter));
+    if (g_headless.enabled) {
+        printf("headless: %d frames at %dx%d\n", g_headless.num_frames,
+               g_headless.width, g_headless.height);
+    }
+}
+
 static mat4_t get_light_view_matrix(vec3_t light_dir) {
     vec3_t light_pos = vec3_negate(light_dir);
     vec3_t light_target = vec3_new(0, 0, 0);
@@ -391,6 +750,7 @@ perframe_t test_build_perframe(scene_t *scene, context_t *context) {
     perframe.punctual_intensity = scene->punctual_intensity;
     perframe.shadow_map = scene->shadow_map;
     perframe.layer_view = -1;
+    perframe.texture_filter = scene->texture_filter;
 
     return perframe;
 }
@@ -414,6 +774,7 @@ static void sort_models(model_t **models, mat4_t view_matrix) {
     int num_models = darray_size(models);
     int i;
     if (num_models > 1) {
+        trace_begin("sort models");
         for (i = 0; i < num_models; i++) {
             model_t *model = models[i];
             vec3_t center = mesh_get_center(model->mesh);
@@ -423,9 +784,148 @@ static void sort_models(model_t **models, mat4_t view_matrix) {
             model->distance = -view_pos.z;
         }
         qsort(models, num_models, sizeof(model_t*), compare_models);
+        trace_end();
     }
 }
 
+static int is_solid(model_t *model) {
+    return model->opaque && !model->alpha_tested;
+}
+
+/*
+ * opaque models are drawn depth-only first, and then shaded with an equal
+ * depth test, so that fragment shaders run once per visible pixel at the
+ * cost of transforming the vertices twice, alpha-tested models need their
+ * fragment shaders to discard and are drawn only once as usual
+ */
+static void draw_depth_prepass(model_t **models, framebuffer_t *framebuffer) {
+    int num_models = darray_size(models);
+    int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        if (is_solid(model)) {
+            program_set_depth_mode(model->program, DEPTH_ONLY);
+            model->draw(model, framebuffer, 0);
+            program_set_depth_mode(model->program, DEPTH_EQUAL);
+        }
+    }
+}
+
+/*
+ * opaque models are drawn into the visibility buffer, which is resolved
+ * with a single fragment shader invocation per pixel before the remaining
+ * models are drawn as usual, alpha-tested models are excluded as well
+ */
+static void draw_visibility_pass(model_t **models,
+                                 framebuffer_t *framebuffer) {
+    int num_models = darray_size(models);
+    int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        if (is_solid(model)) {
+            program_set_depth_mode(model->program, DEPTH_VISIBILITY);
+            model->draw(model, framebuffer, 0);
+        }
+    }
+    graphics_resolve_visibility(framebuffer);
+}
+
+static void draw_forward(scene_t *scene, model_t *model,
+                         framebuffer_t *framebuffer) {
+    if (!scene->visibility_buffer || !is_solid(model)) {
+        model->draw(model, framebuffer, 0);
+    }
+}
+
+static void reset_depth_modes(model_t **models) {
+    int num_models = darray_size(models);
+    int i;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        if (is_solid(model)) {
+            program_set_depth_mode(model->program, DEPTH_DEFAULT);
+        }
+    }
+}
+
+/*
+ * skinned models are skinned once per frame after their joints have been
+ * updated, the vertices of all the skinned models are split into ranges,
+ * which are skinned in parallel and then drawn as static meshes by both
+ * the shadow pass and the main pass
+ */
+
+#define SKINNING_RANGE 1024
+
+typedef struct {
+    model_t *model;
+    int begin, end;
+} skinrange_t;
+
+typedef struct {
+    skinrange_t *ranges;
+    mutex_t *mutex;
+    int next_range;
+} skinwork_t;
+
+static void skin_ranges(void *userdata) {
+    skinwork_t *skinwork = (skinwork_t*)userdata;
+    int num_ranges = darray_size(skinwork->ranges);
+    while (1) {
+        skinrange_t *range;
+        int index;
+
+        mutex_lock(skinwork->mutex);
+        index = skinwork->next_range++;
+        mutex_unlock(skinwork->mutex);
+        if (index >= num_ranges) {
+            break;
+        }
+
+        range = &skinwork->ranges[index];
+        animation_skin_vertices(range->model->animation, range->model->mesh,
+                                range->begin, range->end,
+                                range->model->skinned);
+    }
+}
+
+static void skin_models(model_t **models) {
+    int num_models = darray_size(models);
+    skinwork_t skinwork;
+    int num_threads;
+    int i;
+
+    skinwork.ranges = NULL;
+    for (i = 0; i < num_models; i++) {
+        model_t *model = models[i];
+        if (model->skinned) {
+            int num_vertices = mesh_get_num_vertices(model->mesh);
+            int begin;
+            for (begin = 0; begin < num_vertices; begin += SKINNING_RANGE) {
+                int end = begin + SKINNING_RANGE;
+                skinrange_t range;
+                range.model = model;
+                range.begin = begin;
+                range.end = end < num_vertices ? end : num_vertices;
+                darray_push(skinwork.ranges, range);
+            }
+        }
+    }
+    if (skinwork.ranges == NULL) {
+        return;
+    }
+
+    skinwork.mutex = mutex_create();
+    skinwork.next_range = 0;
+    num_threads = graphics_get_num_threads();
+    if (num_threads > darray_size(skinwork.ranges)) {
+        num_threads = darray_size(skinwork.ranges);
+    }
+    workers_run(skin_ranges, &skinwork, num_threads);
+    mutex_release(skinwork.mutex);
+    darray_free(skinwork.ranges);
+}
+
 void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                      perframe_t *perframe) {
     model_t *skybox = scene->skybox;
@@ -433,6 +933,9 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
     int num_models = darray_size(models);
     int i;
 
+    trace_begin("update models");
+    animation_update_batch(scene->animations, darray_size(scene->animations),
+                           perframe->frame_time, graphics_get_num_threads());
     for (i = 0; i < num_models; i++) {
         model_t *model = models[i];
         model->update(model, perframe);
@@ -440,8 +943,13 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
     if (skybox != NULL) {
         skybox->update(skybox, perframe);
     }
+    trace_end();
+    trace_begin("skin models");
+    skin_models(models);
+    trace_end();
 
     if (scene->shadow_buffer && scene->shadow_map) {
+        trace_begin("shadow pass");
         sort_models(models, perframe->light_view_matrix);
         framebuffer_clear_depth(scene->shadow_buffer, 1);
         for (i = 0; i < num_models; i++) {
@@ -450,17 +958,29 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                 model->draw(model, scene->shadow_buffer, 1);
             }
         }
-        texture_from_depthbuffer(scene->shadow_map, scene->shadow_buffer);
+        graphics_flush(scene->shadow_buffer);
+        trace_end();
     }
 
     sort_models(models, perframe->camera_view_matrix);
     framebuffer_clear_color(framebuffer, scene->background);
     framebuffer_clear_depth(framebuffer, 1);
+    if (scene->visibility_buffer) {
+        trace_begin("visibility pass");
+        draw_visibility_pass(models, framebuffer);
+        trace_end();
+    } else if (scene->depth_prepass) {
+        trace_begin("depth prepass");
+        draw_depth_prepass(models, framebuffer);
+        trace_end();
+    }
     if (skybox == NULL || perframe->layer_view >= 0) {
+        trace_begin("forward pass");
         for (i = 0; i < num_models; i++) {
             model_t *model = models[i];
-            model->draw(model, framebuffer, 0);
+            draw_forward(scene, model, framebuffer);
         }
+        trace_end();
     } else {
         int num_opaques = 0;
         for (i = 0; i < num_models; i++) {
@@ -472,14 +992,25 @@ void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
             }
         }
 
+        trace_begin("opaque pass");
         for (i = 0; i < num_opaques; i++) {
             model_t *model = models[i];
-            model->draw(model, framebuffer, 0);
+            draw_forward(scene, model, framebuffer);
         }
+        trace_end();
+        trace_begin("skybox");
         skybox->draw(skybox, framebuffer, 0);
+        trace_end();
+        trace_begin("transparent pass");
         for (i = num_opaques; i < num_models; i++) {
             model_t *model = models[i];
-            model->draw(model, framebuffer, 0);
+            draw_forward(scene, model, framebuffer);
         }
+        trace_end();
     }
+    reset_depth_modes(models);
+    graphics_flush(framebuffer);
+    trace_begin("update pages");
+    texture_update_pages();
+    trace_end();
 }
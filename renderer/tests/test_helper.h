@@ -22,7 +22,15 @@ typedef struct {
 typedef void tickfunc_t(context_t *context, void *userdata);
 
 void test_enter_mainloop(tickfunc_t *tickfunc, void *userdata);
-scene_t *test_create_scene(creator_t creators[], const char *scene_name);
+float *test_render_headless(tickfunc_t *tickfunc, void *userdata,
+                            int width, int height, int num_frames,
+                            const char *output);
+image_t *test_render_view(tickfunc_t *tickfunc, void *userdata,
+                          int width, int height, float orbit);
+int test_count_faces(scene_t *scene);
+void test_parse_load_options(int argc, char *argv[]);
+scene_t *test_create_scene(creator_t creators[], int argc, char *argv[]);
+void test_parse_options(scene_t *scene, int argc, char *argv[]);
 perframe_t test_build_perframe(scene_t *scene, context_t *context);
 void test_draw_scene(scene_t *scene, framebuffer_t *framebuffer,
                      perframe_t *perframe);
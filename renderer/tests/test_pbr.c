@@ -1,4 +1,5 @@
 #include <stddef.h>
+#include <stdlib.h>
 #include "../core/api.h"
 #include "../scenes/pbr_scenes.h"
 #include "../shaders/cache_helper.h"
@@ -118,11 +119,15 @@ static texture_t *acquire_label_texture(const char *filename) {
     return cache_acquire_texture(filename, USAGE_LDR_COLOR);
 }
 
-void test_pbr(int argc, char *argv[]) {
-    const char *scene_name = argc > 2 ? argv[2] : NULL;
-    scene_t *scene = test_create_scene(g_creators, scene_name);
+creator_t *test_pbr_creators(void) {
+    return g_creators;
+}
+
+int test_pbr(int argc, char *argv[]) {
+    scene_t *scene = test_create_scene(g_creators, argc, argv);
     if (scene) {
         userdata_t userdata;
+        test_parse_options(scene, argc, argv);
         userdata.scene = scene;
         userdata.layer = -1;
         userdata.labels[0] = acquire_label_texture("common/diffuse.tga");
@@ -139,5 +144,8 @@ void test_pbr(int argc, char *argv[]) {
         cache_release_texture(userdata.labels[2]);
         cache_release_texture(userdata.labels[3]);
         cache_release_texture(userdata.labels[4]);
+        return EXIT_SUCCESS;
+    } else {
+        return EXIT_FAILURE;
     }
 }
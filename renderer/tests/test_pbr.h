@@ -1,6 +1,9 @@
 #ifndef TEST_PBR_H
 #define TEST_PBR_H
 
-void test_pbr(int argc, char *argv[]);
+#include "test_helper.h"
+
+int test_pbr(int argc, char *argv[]);
+creator_t *test_pbr_creators(void);
 
 #endif